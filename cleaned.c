@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "sizes.h"
 #include "keys.h"
 #include "loaders.h"
@@ -8,6 +9,9 @@
 #define CHUNK_LENGTH (51)
 #define min(x,y) ((x < y) ? x : y)
 
+/* the biggest number lynx_mont does a word at a time, in 32-bit words */
+#define MAX_WORDS (16)
+
 /* helper function for dumping out blocks of data in a human readable form */
 void print_data(const unsigned char * data, int size)
 {
@@ -61,42 +65,31 @@ void double_value(unsigned char *result, const int length)
     /* shouldn't carry */
 }
 
-/* result -= value */
+/* result -= value, but only if result >= value */
 int minus_equals_value(unsigned char *result, 
                        const unsigned char *value, 
                        const int length)
 {
     int i, x;
-    unsigned char *tmp;
 
-    /* allocate temporary buffer */
-    tmp = calloc(1, length);
+    /* both are big endian and the same length, so memcmp orders them the
+     * same way the numbers are ordered */
+    if (memcmp(result, value, length) < 0)
+    {
+        /* this didn't carry */
+        return 0;
+    }
 
     x = 0;
     for (i = length - 1; i >= 0; i--) 
     {
 	    x += result[i] - value[i];
-	    tmp[i] = (unsigned char) (x & 0xFF);
+	    result[i] = (unsigned char) (x & 0xFF);
 	    x >>= 8;
     }
 
-    if (x >= 0) 
-    {
-        /* move the result back to BB */
-        memcpy(result, tmp, length);
-        
-        /* free the temporary buffer */
-        free(tmp);
-
-        /* this had a carry */
-        return 1;
-    }
-
-    /* free the temporary buffer */
-    free(tmp);
-
-    /* this didn't carry */
-    return 0;
+    /* this had a carry */
+    return 1;
 }
 
 /* result += value */
@@ -118,12 +111,14 @@ void plus_equals_value(unsigned char *result,
     }
 }
 
-/* L = M * N mod modulus */
-void lynx_mont(unsigned char *L,            /* result */
-               const unsigned char *M,      /* original chunk of encrypted data */
-               const unsigned char *N,      /* copy of encrypted data */
-               const unsigned char *modulus,/* modulus */
-		       const int length)
+/* L = M * N mod modulus, a bit at a time the way the Lynx ROM does it.  This
+ * is the reference lynx_mont below is checked against, and what it falls
+ * back on for the odd inputs it can't do a word at a time. */
+void lynx_mont_bits(unsigned char *L,            /* result */
+                    const unsigned char *M,      /* original chunk of encrypted data */
+                    const unsigned char *N,      /* copy of encrypted data */
+                    const unsigned char *modulus,/* modulus */
+                    const int length)
 {
     int i, j;
     int carry;
@@ -138,7 +133,7 @@ void lynx_mont(unsigned char *L,            /* result */
         /* get the next byte from N */
 	    tmp = N[i];
 
-        for(j = 0; j < 8; j++) 
+        for(j = 0; j < 8; j++)
         {
             /* L = L * 2 */
 	        double_value(L, length);
@@ -148,8 +143,8 @@ void lynx_mont(unsigned char *L,            /* result */
 
             /* shift tmp's bits to the left by one */
 	        tmp <<= 1;
-	   
-            if(increment != 0) 
+
+            if(increment != 0)
             {
                 /* increment the result... */
                 /* L += M */
@@ -163,7 +158,7 @@ void lynx_mont(unsigned char *L,            /* result */
                 /* L -= modulus */
                 if (carry != 0)
                     minus_equals_value(L, modulus, length);
-            } 
+            }
             else
             {
                 /* instead decrement the result */
@@ -176,6 +171,210 @@ void lynx_mont(unsigned char *L,            /* result */
 }
 
 
+/* the same numbers as 32-bit words, least significant word first */
+typedef struct mont_key_s
+{
+    int length;                         /* in bytes */
+    int words;
+    unsigned char modulus[4 * MAX_WORDS];
+    uint32_t m[MAX_WORDS];
+    uint32_t rr[MAX_WORDS];             /* 2**(64 * words) mod m */
+    uint32_t minv;                      /* -1/m mod 2**32 */
+} mont_key_t;
+
+/* big endian bytes to words */
+void bytes_to_words(uint32_t *w, const unsigned char *bytes, const int length, const int words)
+{
+    int i;
+
+    memset(w, 0, words * sizeof(uint32_t));
+    for(i = 0; i < length; i++)
+    {
+        w[i / 4] |= (uint32_t)bytes[(length - 1) - i] << (8 * (i % 4));
+    }
+}
+
+/* words to big endian bytes */
+void words_to_bytes(unsigned char *bytes, const uint32_t *w, const int length)
+{
+    int i;
+
+    for(i = 0; i < length; i++)
+    {
+        bytes[(length - 1) - i] = (unsigned char)(w[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+/* a -= b, returns the borrow */
+uint32_t words_minus(uint32_t *a, const uint32_t *b, const int words)
+{
+    int i;
+    uint64_t x;
+    uint32_t borrow = 0;
+
+    for(i = 0; i < words; i++)
+    {
+        x = (uint64_t)a[i] - b[i] - borrow;
+        a[i] = (uint32_t)x;
+        borrow = (uint32_t)(x >> 32) & 1;
+    }
+
+    return borrow;
+}
+
+/* a = 2 * a, dropping the top bit */
+void words_double(uint32_t *a, const int words)
+{
+    int i;
+
+    for(i = words - 1; i > 0; i--)
+    {
+        a[i] = (a[i] << 1) | (a[i - 1] >> 31);
+    }
+    a[0] <<= 1;
+}
+
+/* returns 1 if a >= b */
+int words_at_least(const uint32_t *a, const uint32_t *b, const int words)
+{
+    int i;
+
+    for(i = words - 1; i >= 0; i--)
+    {
+        if(a[i] != b[i])
+            return (a[i] > b[i]);
+    }
+
+    return 1;
+}
+
+/* This sets up the word-wise constants for a modulus.  There is only ever
+ * one modulus, so the last one is kept and only worked out again when it
+ * changes. */
+const mont_key_t * mont_key(const unsigned char *modulus, const int length)
+{
+    static mont_key_t key;
+    int i;
+    uint32_t top, inv;
+
+    if((key.length == length) && (memcmp(key.modulus, modulus, length) == 0))
+        return &key;
+
+    key.length = length;
+    key.words = (length + 3) / 4;
+    memcpy(key.modulus, modulus, length);
+    bytes_to_words(key.m, modulus, length, key.words);
+
+    /* Newton's method, each step doubles the number of good bits and an odd
+     * number is its own inverse to 3 bits */
+    inv = key.m[0];
+    for(i = 0; i < 4; i++)
+    {
+        inv *= 2 - (key.m[0] * inv);
+    }
+    key.minv = -inv;
+
+    /* 2**(64 * words) mod m by doubling 1 that many times */
+    memset(key.rr, 0, sizeof(key.rr));
+    key.rr[0] = 1;
+    for(i = 0; i < (64 * key.words); i++)
+    {
+        top = key.rr[key.words - 1] >> 31;
+        words_double(key.rr, key.words);
+        if(top || words_at_least(key.rr, key.m, key.words))
+            words_minus(key.rr, key.m, key.words);
+    }
+
+    return &key;
+}
+
+/* r = a * b / 2**(32 * words) mod m.  Each word of b is multiplied in and
+ * one word is reduced away straight after, so t never grows past words + 2.
+ * a has to be below m, b only has to fit, and r comes out below m. */
+void mont_mul_words(uint32_t *r, const uint32_t *a, const uint32_t *b, const mont_key_t *key)
+{
+    int i, j;
+    int k = key->words;
+    uint32_t t[MAX_WORDS + 2];
+    uint32_t u;
+    uint64_t x;
+
+    memset(t, 0, sizeof(t));
+    for(i = 0; i < k; i++)
+    {
+        /* t += a * b[i] */
+        x = 0;
+        for(j = 0; j < k; j++)
+        {
+            x = ((uint64_t)a[j] * b[i]) + t[j] + (x >> 32);
+            t[j] = (uint32_t)x;
+        }
+        x = (uint64_t)t[k] + (x >> 32);
+        t[k] = (uint32_t)x;
+        t[k + 1] = (uint32_t)(x >> 32);
+
+        /* t = (t + u * m) / 2**32, u picked so the low word is 0 */
+        u = t[0] * key->minv;
+        x = ((uint64_t)u * key->m[0]) + t[0];
+        for(j = 1; j < k; j++)
+        {
+            x = ((uint64_t)u * key->m[j]) + t[j] + (x >> 32);
+            t[j - 1] = (uint32_t)x;
+        }
+        x = (uint64_t)t[k] + (x >> 32);
+        t[k - 1] = (uint32_t)x;
+        t[k] = t[k + 1] + (uint32_t)(x >> 32);
+    }
+
+    /* t is below 2 * m */
+    if(t[k] || words_at_least(t, key->m, k))
+        words_minus(t, key->m, k);
+
+    memcpy(r, t, k * sizeof(uint32_t));
+}
+
+/* L = M * N mod modulus
+ *
+ * This gives exactly what lynx_mont_bits gives, but a 32-bit word of N at a
+ * time with Montgomery multiplication instead of a bit at a time with a
+ * subtraction after every bit.  The first multiply gives M * N / R, R being
+ * 2**(32 * words), and multiplying that by R**2 mod modulus divides by R
+ * once more and leaves M * N.
+ *
+ * The bit at a time version only comes out fully reduced when M is below the
+ * modulus, and only if 3 * modulus fits in length bytes so nothing carries
+ * off the top.  A good loader never gives it anything else, but to stay
+ * identical for the ones that do, those go to lynx_mont_bits, as does an even
+ * modulus which Montgomery can't do. */
+void lynx_mont(unsigned char *L,            /* result */
+               const unsigned char *M,      /* original chunk of encrypted data */
+               const unsigned char *N,      /* copy of encrypted data */
+               const unsigned char *modulus,/* modulus */
+		       const int length)
+{
+    const mont_key_t *key;
+    uint32_t a[MAX_WORDS];
+    uint32_t b[MAX_WORDS];
+
+    if((length > (4 * MAX_WORDS)) || (modulus[0] >= 0x40) ||
+       !(modulus[length - 1] & 1) || (memcmp(M, modulus, length) >= 0))
+    {
+        lynx_mont_bits(L, M, N, modulus, length);
+        return;
+    }
+
+    key = mont_key(modulus, length);
+    bytes_to_words(a, M, length, key->words);
+    bytes_to_words(b, N, length, key->words);
+
+    /* M * N / R, then * R**2 / R */
+    mont_mul_words(a, a, b, key);
+    mont_mul_words(a, a, key->rr, key);
+
+    words_to_bytes(L, a, length);
+}
+
+
 /* this decrypts a single block of encrypted data by using the montgomery
  * multiplication method to do modular exponentiation.
  */
@@ -189,14 +388,12 @@ int decrypt_block(int accumulator,
     int i;
     unsigned char* rptr = result;
     const unsigned char* eptr = encrypted;
-    unsigned char *A;
-    unsigned char *B;
-    unsigned char *TMP;
+    unsigned char A[4 * MAX_WORDS];
+    unsigned char B[4 * MAX_WORDS];
+    unsigned char TMP[4 * MAX_WORDS];
 
-    /* allocate the working buffers */
-    A = calloc(1, length);
-    B = calloc(1, length);
-    TMP = calloc(1, length);
+    if (length > (4 * MAX_WORDS))
+        return accumulator;
 
     /* this copies the next length sized block of data from the encrypted
      * data into our temporary memory buffer in reverse order */
@@ -246,11 +443,6 @@ int decrypt_block(int accumulator,
         rptr++;
     }
     print_data(result, length);
-    
-    /* free the temporary buffer memory */
-    free(A);
-    free(B);
-    free(TMP);
 
     return accumulator;
 }
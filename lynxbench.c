@@ -0,0 +1,770 @@
+/* Atari Lynx Encryption Benchmark
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This times every way the tree has of doing the RSA step against each
+ * other, on the loaders in loaders.h and on a made up image of any number of
+ * full frames:
+ *
+ *     bn        OpenSSL BN_mod_exp through a lynx_ctx_t, one block at a time
+ *     mont64    the 64-bit limb engine in lynxmont.c, one block at a time
+ *     batch     lynx_encrypt_image/lynx_decrypt_image, the whole image at
+ *               once through the multi-buffer engine
+ *     modexp    the byte-wise lynx_mod_exp in lynxrom.c, one block at a time
+ *     rom       the ROM-faithful LynxMont/sub5000, one frame at a time
+ *     cleaned   lynx_mont from cleaned.c, one block at a time
+ *
+ * The ROM and cleaned.c can only decrypt.  Every call is timed on its own
+ * and the latencies are per block, so a call that did a whole frame or image
+ * counts as that many blocks of its average.  Every result is checked
+ * against the image, a wrong answer is reported instead of a time.
+ *
+ * The allocation count comes from wrapping malloc and friends, which also
+ * sees the ones OpenSSL makes.  Build it with "make bench", which compiles
+ * the library sources with optimisation rather than using the -O0 objects.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "lynxcrypt.h"
+
+/* cleaned.c is a program of its own with its own copy of the keys, so it is
+ * pulled in with its main and keys renamed out of the way of the library.
+ * It brings loaders.h with it. */
+#define main                cleaned_main
+#define lynx_public_mod     cleaned_public_mod
+#define lynx_public_exp     cleaned_public_exp
+#define lynx_private_exp    cleaned_private_exp
+#define keyfile_1           cleaned_keyfile_1
+#define keyfile_2           cleaned_keyfile_2
+#define keyfile_3           cleaned_keyfile_3
+#include "cleaned.c"
+#undef main
+#undef lynx_public_mod
+#undef lynx_public_exp
+#undef lynx_private_exp
+#undef keyfile_1
+#undef keyfile_2
+#undef keyfile_3
+
+#define MAX_FRAMES                  (4096)
+#define DEFAULT_FRAMES              (64)
+#define DEFAULT_MSECS               (200)
+
+/* an encrypted image and what it decrypts to */
+typedef struct bench_image_s
+{
+    const char * name;
+    unsigned char * encrypted;
+    size_t encrypted_size;
+    unsigned char * plaintext;      /* the frames' blocks back to back */
+    size_t plaintext_size;
+    int frame_count;
+    int blocks;
+    lynx_frame_def_t * frames;      /* where each frame is in plaintext */
+    size_t * frame_start;           /* where each frame is in encrypted */
+} bench_image_t;
+
+/* one timed call */
+typedef struct bench_sample_s
+{
+    double ns;                      /* ns per block */
+    long blocks;                    /* blocks done by the call */
+} bench_sample_t;
+
+/* the timings for one engine on one image */
+typedef struct bench_run_s
+{
+    bench_sample_t * samples;
+    int count;
+    int size;
+    long blocks;
+    double ns;
+    long allocs;
+    int failed;
+} bench_run_t;
+
+/* the shared state the engines work with */
+typedef struct bench_s
+{
+    lynx_ctx_t * bn;
+    lynx_ctx_t * mont64;
+    lynx_ctx_t * batch;
+    lynx_rom_t rom;
+    unsigned char modulus_le[LYNX_RSA_KEY_SIZE];
+    unsigned char public_exp_le[LYNX_RSA_KEY_SIZE];
+    unsigned char private_exp_le[LYNX_RSA_KEY_SIZE];
+    unsigned char * out;            /* scratch output, one image's worth */
+} bench_t;
+
+/* one engine: decrypts or encrypts a whole image, timing each call it
+ * makes with bench_sample, and returns 0 if it got anything wrong */
+typedef int (*bench_fn_t)(bench_t * bench, bench_run_t * run, const bench_image_t * image);
+typedef struct bench_engine_s
+{
+    const char * name;
+    bench_fn_t decrypt;
+    bench_fn_t encrypt;
+} bench_engine_t;
+
+
+/* count the allocations by wrapping the libc allocator */
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+extern void __libc_free(void * ptr);
+
+static long allocations = 0;
+
+void * malloc(size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void * ptr)
+{
+    __libc_free(ptr);
+}
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+
+/* This function records one timed call that did 'blocks' blocks */
+static void bench_sample(bench_run_t * run, double start, int blocks)
+{
+    double ns = now_ns() - start;
+
+    if(run->count == run->size)
+    {
+        run->size = run->size ? (2 * run->size) : 1024;
+        run->samples = realloc(run->samples, run->size * sizeof(bench_sample_t));
+    }
+
+    run->samples[run->count].ns = ns / blocks;
+    run->samples[run->count].blocks = blocks;
+    run->count++;
+    run->blocks += blocks;
+    run->ns += ns;
+}
+
+
+/* the bn and mont64 engines, one lynx_decrypt_block call per block */
+static int ctx_decrypt(lynx_ctx_t * ctx, bench_run_t * run, const bench_image_t * image, unsigned char * out)
+{
+    int i, j, acc;
+    double start;
+    const unsigned char * in;
+    unsigned char * p;
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        in = &image->encrypted[image->frame_start[i] + 1];
+        p = &out[image->frames[i].offset];
+        acc = 0;
+        for(j = 0; j < image->frames[i].blocks; j++)
+        {
+            start = now_ns();
+            acc = lynx_decrypt_block(ctx, &p[j * PLAINTEXT_BLOCK_SIZE], &in[j * ENCRYPTED_BLOCK_SIZE], acc);
+            bench_sample(run, start, 1);
+        }
+    }
+
+    return (memcmp(out, image->plaintext, image->plaintext_size) == 0);
+}
+
+
+/* the bn and mont64 engines, one lynx_encrypt_block call per block */
+static int ctx_encrypt(lynx_ctx_t * ctx, bench_run_t * run, const bench_image_t * image, unsigned char * out)
+{
+    int i, j, acc;
+    double start;
+    const unsigned char * p;
+    unsigned char * e;
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        p = &image->plaintext[image->frames[i].offset];
+        e = &out[image->frame_start[i]];
+        e[0] = (unsigned char)(256 - image->frames[i].blocks);
+        for(j = 0; j < image->frames[i].blocks; j++)
+        {
+            acc = j ? p[(j * PLAINTEXT_BLOCK_SIZE) - 1] : 0;
+            start = now_ns();
+            lynx_encrypt_block(ctx, &e[1 + (j * ENCRYPTED_BLOCK_SIZE)], &p[j * PLAINTEXT_BLOCK_SIZE], acc);
+            bench_sample(run, start, 1);
+        }
+    }
+
+    return (memcmp(out, image->encrypted, image->encrypted_size) == 0);
+}
+
+
+static int bn_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    return ctx_decrypt(bench->bn, run, image, bench->out);
+}
+
+static int bn_encrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    return ctx_encrypt(bench->bn, run, image, bench->out);
+}
+
+static int mont64_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    return ctx_decrypt(bench->mont64, run, image, bench->out);
+}
+
+static int mont64_encrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    return ctx_encrypt(bench->mont64, run, image, bench->out);
+}
+
+
+/* the batch engine, one call for the whole image */
+static int batch_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    int i;
+    size_t size;
+    size_t expected = image->frame_count * MAX_PLAINTEXT_FRAME_SIZE;
+    double start = now_ns();
+
+    /* every frame comes out MAX_PLAINTEXT_FRAME_SIZE long */
+    size = lynx_decrypt_image(bench->batch, bench->out, expected,
+                              image->encrypted, image->encrypted_size);
+    bench_sample(run, start, image->blocks);
+
+    if(size != expected)
+        return 0;
+    for(i = 0; i < image->frame_count; i++)
+    {
+        if(memcmp(&bench->out[i * MAX_PLAINTEXT_FRAME_SIZE],
+                  &image->plaintext[image->frames[i].offset],
+                  image->frames[i].blocks * PLAINTEXT_BLOCK_SIZE))
+            return 0;
+    }
+    return 1;
+}
+
+static int batch_encrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    size_t size;
+    double start = now_ns();
+
+    size = lynx_encrypt_image(bench->batch, bench->out, image->encrypted_size,
+                              image->plaintext, image->plaintext_size,
+                              image->frames, image->frame_count);
+    bench_sample(run, start, image->blocks);
+
+    return (size == image->encrypted_size) &&
+           (memcmp(bench->out, image->encrypted, image->encrypted_size) == 0);
+}
+
+
+/* This function undoes the encoding of a decrypted block that is least
+ * significant byte first, the way cleaned.c does it */
+static int decode_le(unsigned char * plaintext, const unsigned char * block, int acc)
+{
+    int i;
+
+    for(i = 0; i < PLAINTEXT_BLOCK_SIZE; i++)
+    {
+        acc = (acc + block[i]) & 0xFF;
+        plaintext[i] = (unsigned char)acc;
+    }
+
+    return acc;
+}
+
+
+/* the byte-wise engine, one lynx_mod_exp call per block */
+static int modexp_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    int i, j, acc;
+    double start;
+    const unsigned char * in;
+    unsigned char block[LYNX_RSA_KEY_SIZE];
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        in = &image->encrypted[image->frame_start[i] + 1];
+        acc = 0;
+        for(j = 0; j < image->frames[i].blocks; j++)
+        {
+            start = now_ns();
+            lynx_mod_exp(block, &in[j * ENCRYPTED_BLOCK_SIZE], bench->public_exp_le,
+                         bench->modulus_le, LYNX_RSA_KEY_SIZE);
+            acc = decode_le(&bench->out[image->frames[i].offset + (j * PLAINTEXT_BLOCK_SIZE)], block, acc);
+            bench_sample(run, start, 1);
+        }
+    }
+
+    return (memcmp(bench->out, image->plaintext, image->plaintext_size) == 0);
+}
+
+static int modexp_encrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    int i, j, k, acc;
+    double start;
+    const unsigned char * p;
+    unsigned char * e;
+    unsigned char encoded[ENCRYPTED_BLOCK_SIZE];
+    unsigned char block[LYNX_RSA_KEY_SIZE];
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        p = &image->plaintext[image->frames[i].offset];
+        e = &bench->out[image->frame_start[i]];
+        e[0] = (unsigned char)(256 - image->frames[i].blocks);
+        for(j = 0; j < image->frames[i].blocks; j++)
+        {
+            acc = j ? p[(j * PLAINTEXT_BLOCK_SIZE) - 1] : 0;
+            start = now_ns();
+            lynx_encode_block(encoded, &p[j * PLAINTEXT_BLOCK_SIZE], acc);
+            for(k = 0; k < ENCRYPTED_BLOCK_SIZE; k++)
+            {
+                block[k] = encoded[(ENCRYPTED_BLOCK_SIZE - 1) - k];
+            }
+            lynx_mod_exp(&e[1 + (j * ENCRYPTED_BLOCK_SIZE)], block, bench->private_exp_le,
+                         bench->modulus_le, LYNX_RSA_KEY_SIZE);
+            bench_sample(run, start, 1);
+        }
+    }
+
+    return (memcmp(bench->out, image->encrypted, image->encrypted_size) == 0);
+}
+
+
+/* the ROM-faithful decryptor, one lynx_verify_frame call per frame.  The
+ * random frames of the synthetic image fail the checks the ROM makes on a
+ * real loader, so only the plaintext is checked. */
+static int rom_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    int i;
+    double start;
+    size_t consumed;
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        start = now_ns();
+        lynx_verify_frame(&bench->rom, &bench->out[image->frames[i].offset],
+                                 &image->encrypted[image->frame_start[i]],
+                                 image->encrypted_size - image->frame_start[i],
+                                 &consumed);
+        bench_sample(run, start, image->frames[i].blocks);
+    }
+
+    return (memcmp(bench->out, image->plaintext, image->plaintext_size) == 0);
+}
+
+
+/* cleaned.c's lynx_mont, twice per block the way its decrypt_block does it
+ * but without the printing */
+static int cleaned_decrypt(bench_t * bench, bench_run_t * run, const bench_image_t * image)
+{
+    int i, j, k, acc;
+    double start;
+    const unsigned char * in;
+    unsigned char B[LYNX_RSA_KEY_SIZE];
+    unsigned char A[LYNX_RSA_KEY_SIZE];
+    unsigned char T[LYNX_RSA_KEY_SIZE];
+
+    for(i = 0; i < image->frame_count; i++)
+    {
+        in = &image->encrypted[image->frame_start[i] + 1];
+        acc = 0;
+        for(j = 0; j < image->frames[i].blocks; j++)
+        {
+            start = now_ns();
+            for(k = 0; k < LYNX_RSA_KEY_SIZE; k++)
+            {
+                B[k] = in[(j * ENCRYPTED_BLOCK_SIZE) + (LYNX_RSA_KEY_SIZE - 1) - k];
+            }
+            lynx_mont(A, B, B, cleaned_public_mod, LYNX_RSA_KEY_SIZE);
+            memcpy(T, A, LYNX_RSA_KEY_SIZE);
+            lynx_mont(A, B, T, cleaned_public_mod, LYNX_RSA_KEY_SIZE);
+            for(k = 0; k < LYNX_RSA_KEY_SIZE; k++)
+            {
+                T[k] = A[(LYNX_RSA_KEY_SIZE - 1) - k];
+            }
+            acc = decode_le(&bench->out[image->frames[i].offset + (j * PLAINTEXT_BLOCK_SIZE)], T, acc);
+            bench_sample(run, start, 1);
+        }
+    }
+
+    return (memcmp(bench->out, image->plaintext, image->plaintext_size) == 0);
+}
+
+
+static const bench_engine_t engines[] =
+{
+    { "bn",         bn_decrypt,         bn_encrypt },
+    { "mont64",     mont64_decrypt,     mont64_encrypt },
+    { "batch",      batch_decrypt,      batch_encrypt },
+    { "modexp",     modexp_decrypt,     modexp_encrypt },
+    { "rom",        rom_decrypt,        0 },
+    { "cleaned",    cleaned_decrypt,    0 },
+};
+
+#define ENGINE_COUNT                ((int)(sizeof(engines) / sizeof(engines[0])))
+
+
+/* This function sets up an image from its encrypted form.  The plaintext is
+ * worked out with the bn engine so every other engine is checked against
+ * OpenSSL.  It returns 0 if the image is not made of whole frames. */
+static int image_init(bench_image_t * image, bench_t * bench, const char * name,
+                      const unsigned char * encrypted, size_t size)
+{
+    int i, blocks;
+    size_t pos = 0;
+
+    memset(image, 0, sizeof(bench_image_t));
+    image->name = name;
+    image->frames = calloc(MAX_FRAMES, sizeof(lynx_frame_def_t));
+    image->frame_start = calloc(MAX_FRAMES, sizeof(size_t));
+    image->encrypted = malloc(size);
+    if(!image->frames || !image->frame_start || !image->encrypted)
+        return 0;
+    memcpy(image->encrypted, encrypted, size);
+    image->encrypted_size = size;
+
+    while(pos < size)
+    {
+        blocks = 256 - encrypted[pos];
+        if((image->frame_count == MAX_FRAMES) || (blocks < 1) ||
+           (blocks > MAX_BLOCKS_PER_FRAME) || (pos + 1 + ENCRYPTED_FRAME_SIZE(blocks) > size))
+            return 0;
+
+        image->frame_start[image->frame_count] = pos;
+        image->frames[image->frame_count].offset = image->plaintext_size;
+        image->frames[image->frame_count].blocks = blocks;
+        image->frame_count++;
+        image->blocks += blocks;
+        image->plaintext_size += blocks * PLAINTEXT_BLOCK_SIZE;
+        pos += 1 + ENCRYPTED_FRAME_SIZE(blocks);
+    }
+
+    if(!(image->plaintext = malloc(image->plaintext_size)))
+        return 0;
+    for(i = 0; i < image->frame_count; i++)
+    {
+        lynx_decrypt_frame(bench->bn, &image->plaintext[image->frames[i].offset],
+                           &image->encrypted[image->frame_start[i] + 1],
+                           image->frames[i].blocks, i);
+    }
+
+    return 1;
+}
+
+
+/* This function makes up an image of full frames of random bytes */
+static int image_synthetic(bench_image_t * image, bench_t * bench, int frame_count)
+{
+    int i, ok;
+    size_t size = frame_count * (1 + ENCRYPTED_FRAME_SIZE(MAX_BLOCKS_PER_FRAME));
+    unsigned char * plaintext = malloc(frame_count * MAX_BLOCKS_PER_FRAME * PLAINTEXT_BLOCK_SIZE);
+    unsigned char * encrypted = malloc(size);
+    unsigned char * e;
+
+    if(!plaintext || !encrypted)
+    {
+        free(plaintext);
+        free(encrypted);
+        return 0;
+    }
+
+    srand(1);
+    for(i = 0; i < frame_count * MAX_BLOCKS_PER_FRAME * PLAINTEXT_BLOCK_SIZE; i++)
+    {
+        plaintext[i] = (unsigned char)rand();
+    }
+
+    e = encrypted;
+    for(i = 0; i < frame_count; i++)
+    {
+        e[0] = (unsigned char)(256 - MAX_BLOCKS_PER_FRAME);
+        lynx_encrypt_frame(bench->bn, &e[1],
+                           &plaintext[i * MAX_BLOCKS_PER_FRAME * PLAINTEXT_BLOCK_SIZE],
+                           MAX_BLOCKS_PER_FRAME, i);
+        e += 1 + ENCRYPTED_FRAME_SIZE(MAX_BLOCKS_PER_FRAME);
+    }
+
+    ok = image_init(image, bench, "synthetic", encrypted, size);
+    free(plaintext);
+    free(encrypted);
+    return ok;
+}
+
+
+static void image_free(bench_image_t * image)
+{
+    free(image->encrypted);
+    free(image->plaintext);
+    free(image->frames);
+    free(image->frame_start);
+}
+
+
+static int compare_samples(const void * a, const void * b)
+{
+    double x = ((const bench_sample_t *)a)->ns;
+    double y = ((const bench_sample_t *)b)->ns;
+
+    return (x > y) - (x < y);
+}
+
+
+/* This function finds the block latencies that half and 99% of the blocks
+ * were done in.  Calls that did several blocks count once per block. */
+static void percentiles(bench_run_t * run, double * p50, double * p99)
+{
+    int i;
+    long seen = 0;
+    long half = run->blocks / 2;
+    long most = (long)(0.99 * (double)run->blocks);
+
+    (*p50) = (*p99) = 0.0;
+    if(!run->count)
+        return;
+
+    qsort(run->samples, run->count, sizeof(bench_sample_t), compare_samples);
+
+    (*p50) = (*p99) = run->samples[run->count - 1].ns;
+    for(i = 0; i < run->count; i++)
+    {
+        if((seen <= half) && (seen + run->samples[i].blocks > half))
+            (*p50) = run->samples[i].ns;
+        seen += run->samples[i].blocks;
+        if(seen > most)
+        {
+            (*p99) = run->samples[i].ns;
+            break;
+        }
+    }
+}
+
+
+/* This function runs one engine over an image for at least 'msecs' and
+ * prints a line of results */
+static void bench_engine(bench_t * bench, const bench_image_t * image,
+                         const char * engine, const char * op, bench_fn_t fn, int msecs)
+{
+    bench_run_t run;
+    double start;
+    double p50, p99;
+    long allocs;
+
+    memset(&run, 0, sizeof(bench_run_t));
+
+    /* one round to warm up, then as many as fit */
+    if(!fn(bench, &run, image))
+        run.failed = 1;
+
+    run.count = 0;
+    run.blocks = 0;
+    run.ns = 0.0;
+    allocs = allocations;
+    start = now_ns();
+    do
+    {
+        if(!fn(bench, &run, image))
+            run.failed = 1;
+    } while(!run.failed && ((now_ns() - start) < (msecs * 1e6)));
+    run.allocs = allocations - allocs;
+
+    printf("%-10s %-8s %-8s", image->name, engine, op);
+    if(run.failed)
+    {
+        printf(" WRONG RESULT\n");
+    }
+    else
+    {
+        percentiles(&run, &p50, &p99);
+        printf(" %12.0f %12.0f %12.0f %12.0f %12.2f\n",
+               (double)run.blocks * 1e9 / run.ns,
+               run.ns / (double)run.blocks,
+               p50, p99,
+               (double)run.allocs / (double)run.blocks);
+    }
+
+    free(run.samples);
+}
+
+
+static void print_help(char * name)
+{
+    int i;
+
+    printf("usage: %s [-n <frames>] [-t <milliseconds>] [-e <engine>]\n\n", name);
+    printf("    -n  full frames in the synthetic image (default %d)\n", DEFAULT_FRAMES);
+    printf("    -t  how long to run each engine on each image (default %d)\n", DEFAULT_MSECS);
+    printf("    -e  only run this engine, one of:");
+    for(i = 0; i < ENGINE_COUNT; i++)
+    {
+        printf(" %s", engines[i].name);
+    }
+    printf("\n\n");
+}
+
+
+int main(int argc, char ** argv)
+{
+    int i, j;
+    int opt;
+    int status = EXIT_FAILURE;
+    int frame_count = DEFAULT_FRAMES;
+    int msecs = DEFAULT_MSECS;
+    char * only = 0;
+    size_t largest = 0;
+    bench_t bench;
+    bench_image_t images[3];
+    int image_count = 0;
+
+    memset(&bench, 0, sizeof(bench_t));
+
+    while((opt = getopt(argc, argv, "hn:t:e:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                frame_count = atoi(optarg);
+                if((frame_count < 1) || (frame_count > MAX_FRAMES))
+                {
+                    fprintf(stderr, "error: invalid frame count: %s\n\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                msecs = atoi(optarg);
+                if(msecs < 1)
+                {
+                    fprintf(stderr, "error: invalid time: %s\n\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                only = optarg;
+                break;
+            case 'h':
+                print_help(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* the byte-wise engine wants the keys least significant byte first */
+    for(i = 0; i < LYNX_RSA_KEY_SIZE; i++)
+    {
+        bench.modulus_le[i] = lynx_public_mod[(LYNX_RSA_KEY_SIZE - 1) - i];
+        bench.public_exp_le[i] = lynx_public_exp[(LYNX_RSA_KEY_SIZE - 1) - i];
+        bench.private_exp_le[i] = lynx_private_exp[(LYNX_RSA_KEY_SIZE - 1) - i];
+    }
+
+    bench.bn = lynx_ctx_new();
+    bench.mont64 = lynx_ctx_new();
+    bench.batch = lynx_ctx_new();
+    if(!bench.bn || !bench.mont64 || !bench.batch ||
+       !lynx_ctx_set_engine(bench.bn, LYNX_ENGINE_BN) ||
+       !lynx_ctx_set_engine(bench.mont64, LYNX_ENGINE_MONT64))
+    {
+        fprintf(stderr, "failed to set up the crypto contexts\n");
+        goto cleanup;
+    }
+
+    if(!image_init(&images[image_count++], &bench, "micro",
+                   wookies_micro_loader_encrypted_bin, sizeof(wookies_micro_loader_encrypted_bin)) ||
+       !image_init(&images[image_count++], &bench, "harry",
+                   HarrysEncryptedLoader, LOADER_LENGTH) ||
+       !image_synthetic(&images[image_count++], &bench, frame_count))
+    {
+        fprintf(stderr, "failed to set up the test images\n");
+        goto cleanup;
+    }
+
+    for(i = 0; i < image_count; i++)
+    {
+        if(images[i].plaintext_size > largest)
+            largest = images[i].plaintext_size;
+        if(images[i].encrypted_size > largest)
+            largest = images[i].encrypted_size;
+        if((size_t)(images[i].frame_count * MAX_PLAINTEXT_FRAME_SIZE) > largest)
+            largest = images[i].frame_count * MAX_PLAINTEXT_FRAME_SIZE;
+    }
+    if(!(bench.out = malloc(largest)))
+        goto cleanup;
+
+    lynx_print_version("lynxbench");
+    printf("    synthetic image:     %d frames, %d blocks\n\n", frame_count, images[2].blocks);
+    printf("%-10s %-8s %-8s %12s %12s %12s %12s %12s\n",
+           "image", "engine", "op", "blocks/s", "ns/block", "p50 ns", "p99 ns", "allocs/block");
+
+    for(i = 0; i < ENGINE_COUNT; i++)
+    {
+        if(only && strcmp(only, engines[i].name))
+            continue;
+
+        for(j = 0; j < image_count; j++)
+        {
+            bench_engine(&bench, &images[j], engines[i].name, "decrypt", engines[i].decrypt, msecs);
+            if(engines[i].encrypt)
+                bench_engine(&bench, &images[j], engines[i].name, "encrypt", engines[i].encrypt, msecs);
+        }
+    }
+    status = EXIT_SUCCESS;
+
+cleanup:
+    for(i = 0; i < image_count; i++)
+    {
+        image_free(&images[i]);
+    }
+    free(bench.out);
+    lynx_ctx_free(bench.bn);
+    lynx_ctx_free(bench.mont64);
+    lynx_ctx_free(bench.batch);
+    return status;
+}
@@ -0,0 +1,614 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The lynxd client.  It takes the same options as lynxenc and lynxdec and
+ * hands the work to the daemon, so a build script can switch over without
+ * changing anything but the name of the tool.  Copy or link it to lynxenc or
+ * lynxdec and it works out what to do from its name, otherwise the first
+ * argument is enc, dec or verify:
+ *
+ *   lynxc enc -c <config file> -p <plaintext binary> -e <encrypted binary>
+ *   lynxc enc -m <manifest> [-j <connections>]
+ *   lynxc dec <encrypted.bin> <plaintext.bin>
+ *   lynxc verify <encrypted.bin> [<plaintext.bin>]
+ *
+ * With a manifest every image is sent before the first answer is read, one
+ * thread sends while another reads, so the daemon never sits waiting on the
+ * round trip.  -j spreads the images over that many connections, and so over
+ * that many daemon threads.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "lynxd.h"
+
+/* the bits lynx_verify_image returns, from lynxcrypt.h */
+#define VERIFY_ZERO_LEAD            (0x01)
+#define VERIFY_RANGE                (0x02)
+#define VERIFY_MARKER               (0x04)
+#define VERIFY_ACCUMULATOR          (0x08)
+#define VERIFY_TRUNCATED            (0x10)
+#define VERIFY_COUNT                (0x20)
+
+#define MODE_ENC                    (0)
+#define MODE_DEC                    (1)
+#define MODE_VERIFY                 (2)
+
+/* one line of a manifest and what became of it */
+typedef struct batch_item_s
+{
+    char * cfg_file;
+    char * plaintext_file;
+    char * encrypted_file;
+    int ok;
+} batch_item_t;
+
+/* one connection's share of a manifest, items first, first + stride... */
+typedef struct batch_conn_s
+{
+    int fd;
+    batch_item_t * items;
+    int first;
+    int stride;
+    int count;
+} batch_conn_t;
+
+static const char * socket_path = 0;
+
+
+/* This reads a whole file into memory.  room bytes are left free in front
+ * of the contents for a request header to go in. */
+static unsigned char * read_file(const char * name, const size_t room, size_t * size)
+{
+    FILE * f;
+    long len;
+    unsigned char * data;
+
+    if(!(f = fopen(name, "rb")))
+        return 0;
+
+    if((fseek(f, 0, SEEK_END) != 0) || ((len = ftell(f)) < 0) ||
+       (fseek(f, 0, SEEK_SET) != 0) || !(data = malloc(room + len + 1)))
+    {
+        fclose(f);
+        return 0;
+    }
+
+    if(fread(data + room, 1, len, f) != (size_t)len)
+    {
+        free(data);
+        fclose(f);
+        return 0;
+    }
+
+    fclose(f);
+    (*size) = len;
+    return data;
+}
+
+
+static int write_file(const char * name, const unsigned char * data, const size_t size)
+{
+    FILE * f;
+    int ok;
+
+    if(!(f = fopen(name, "wb+")))
+        return 0;
+
+    ok = (fwrite(data, 1, size, f) == size);
+    return (fclose(f) == 0) && ok;
+}
+
+
+static int connect_daemon(void)
+{
+    int fd;
+    const char * path = lynxd_socket_path(socket_path);
+
+    if((fd = lynxd_connect(path)) < 0)
+        fprintf(stderr, "failed to connect to lynxd on %s\n", path);
+
+    return fd;
+}
+
+
+/* This sends the config file and the plaintext of one image */
+static int send_encrypt(int fd, uint32_t id, const char * cfg_file, const char * plaintext_file)
+{
+    int ok;
+    size_t cfg_size;
+    size_t plaintext_size;
+    uint32_t cfg_len;
+    unsigned char * cfg;
+    unsigned char * payload;
+
+    if(!(cfg = read_file(cfg_file, 0, &cfg_size)))
+    {
+        fprintf(stderr, "failed to open config file: %s\n", cfg_file);
+        return 0;
+    }
+
+    /* the plaintext is read in behind the config file and its length */
+    if(!(payload = read_file(plaintext_file, sizeof(cfg_len) + cfg_size, &plaintext_size)))
+    {
+        fprintf(stderr, "failed to open plaintext loader file: %s\n", plaintext_file);
+        free(cfg);
+        return 0;
+    }
+
+    cfg_len = (uint32_t)cfg_size;
+    memcpy(payload, &cfg_len, sizeof(cfg_len));
+    memcpy(payload + sizeof(cfg_len), cfg, cfg_size);
+    ok = lynxd_send(fd, LYNXD_OP_ENCRYPT, id, payload, sizeof(cfg_len) + cfg_size + plaintext_size);
+
+    free(cfg);
+    free(payload);
+    return ok;
+}
+
+
+/* This sends a request that is just a file */
+static int send_file(int fd, uint32_t op, uint32_t id, const char * name)
+{
+    int ok;
+    size_t size;
+    unsigned char * data;
+
+    if(!(data = read_file(name, 0, &size)))
+    {
+        fprintf(stderr, "failed to open encrypted loader file: %s\n", name);
+        return 0;
+    }
+
+    ok = lynxd_send(fd, op, id, data, size);
+    free(data);
+    return ok;
+}
+
+
+/* This reads the answer to request id.  The payload is the caller's to
+ * free when it comes back 1, 0 is a failed request and -1 a connection that
+ * can't be used any more. */
+static int recv_reply(int fd, uint32_t id, lynxd_header_t * header, unsigned char ** payload)
+{
+    if(!lynxd_recv(fd, header, payload) || (header->id != id))
+    {
+        fprintf(stderr, "lost the connection to lynxd\n");
+        free(*payload);
+        return -1;
+    }
+
+    if(header->code != LYNXD_STATUS_OK)
+    {
+        fprintf(stderr, "lynxd: %s\n", (char *)(*payload));
+        free(*payload);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* This sends every image on one connection.  An image that can't be read
+ * is sent as an empty request so the answers still line up. */
+static void * batch_sender(void * arg)
+{
+    int i;
+    batch_conn_t * conn = arg;
+    batch_item_t * item;
+
+    for(i = conn->first; i < conn->count; i += conn->stride)
+    {
+        item = &conn->items[i];
+        if(!send_encrypt(conn->fd, i, item->cfg_file, item->plaintext_file) &&
+           !lynxd_send(conn->fd, LYNXD_OP_ENCRYPT, i, 0, 0))
+            break;
+    }
+
+    /* the daemon sees the end of the requests, the answers still come */
+    shutdown(conn->fd, SHUT_WR);
+    return 0;
+}
+
+
+/* This reads the answers on one connection while batch_sender is still
+ * sending */
+static void * batch_receiver(void * arg)
+{
+    int i;
+    int status;
+    batch_conn_t * conn = arg;
+    batch_item_t * item;
+    pthread_t sender;
+    lynxd_header_t header;
+    unsigned char * payload;
+
+    if(pthread_create(&sender, 0, batch_sender, conn) != 0)
+        return 0;
+
+    for(i = conn->first; i < conn->count; i += conn->stride)
+    {
+        item = &conn->items[i];
+        if((status = recv_reply(conn->fd, i, &header, &payload)) < 0)
+            break;
+        if(status == 0)
+            continue;
+
+        item->ok = write_file(item->encrypted_file, payload, header.length);
+        if(!item->ok)
+            fprintf(stderr, "failed to write encrypted loader file: %s\n", item->encrypted_file);
+        free(payload);
+    }
+
+    pthread_join(sender, 0);
+    return 0;
+}
+
+
+/* This reads a manifest the way lynxenc does, one
+ * "<config file> <plaintext binary> <encrypted binary>" per line */
+static int read_manifest(FILE * manifest, batch_item_t ** items)
+{
+    int count = 0;
+    int size = 0;
+    int line = 0;
+    char buf[4096];
+    char * fields[3];
+    batch_item_t * tmp;
+
+    (*items) = 0;
+    while(fgets(buf, sizeof(buf), manifest))
+    {
+        line++;
+        if(!(fields[0] = strtok(buf, " \t\r\n")) || (fields[0][0] == '#'))
+            continue;
+        fields[1] = strtok(0, " \t\r\n");
+        fields[2] = strtok(0, " \t\r\n");
+        if(!fields[1] || !fields[2])
+        {
+            fprintf(stderr, "manifest line %d needs three files\n", line);
+            return -1;
+        }
+
+        if(count == size)
+        {
+            size = size ? (size * 2) : 16;
+            if(!(tmp = realloc((*items), size * sizeof(batch_item_t))))
+                return -1;
+            (*items) = tmp;
+        }
+        (*items)[count].cfg_file = strdup(fields[0]);
+        (*items)[count].plaintext_file = strdup(fields[1]);
+        (*items)[count].encrypted_file = strdup(fields[2]);
+        (*items)[count].ok = 0;
+        count++;
+    }
+
+    return count;
+}
+
+
+static int process_manifest(batch_item_t * items, const int count, int connections)
+{
+    int i;
+    int failed = 0;
+    batch_conn_t * conns;
+    pthread_t * threads;
+
+    if(connections > count)
+        connections = count;
+
+    conns = calloc(connections, sizeof(batch_conn_t));
+    threads = calloc(connections, sizeof(pthread_t));
+    if(!conns || !threads)
+    {
+        free(conns);
+        free(threads);
+        return count;
+    }
+
+    for(i = 0; i < connections; i++)
+    {
+        conns[i].items = items;
+        conns[i].first = i;
+        conns[i].stride = connections;
+        conns[i].count = count;
+        if(((conns[i].fd = connect_daemon()) < 0) ||
+           (pthread_create(&threads[i], 0, batch_receiver, &conns[i]) != 0))
+        {
+            if(conns[i].fd >= 0)
+                close(conns[i].fd);
+            conns[i].fd = -1;
+        }
+    }
+
+    for(i = 0; i < connections; i++)
+    {
+        if(conns[i].fd < 0)
+            continue;
+        pthread_join(threads[i], 0);
+        close(conns[i].fd);
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(!items[i].ok)
+        {
+            printf("FAILED %s\n", items[i].encrypted_file);
+            failed++;
+        }
+        else
+        {
+            printf("ok     %s\n", items[i].encrypted_file);
+        }
+    }
+    printf("%d of %d images encrypted\n", count - failed, count);
+
+    free(conns);
+    free(threads);
+    return failed;
+}
+
+
+/* This sends one request and writes the answer to out_file, or hands it
+ * back in payload when out_file is 0 */
+static int request(uint32_t op, const char * in_file, const char * cfg_file,
+                   const char * out_file, lynxd_header_t * header, unsigned char ** payload)
+{
+    int fd;
+    int ok;
+    unsigned char * data = 0;
+
+    if(!payload)
+        payload = &data;
+    if((fd = connect_daemon()) < 0)
+        return 0;
+
+    if(op == LYNXD_OP_ENCRYPT)
+        ok = send_encrypt(fd, 0, cfg_file, in_file);
+    else
+        ok = send_file(fd, op, 0, in_file);
+    ok = ok && (recv_reply(fd, 0, header, payload) > 0);
+    close(fd);
+
+    if(!ok || !out_file)
+        return ok;
+
+    if(!(ok = write_file(out_file, (*payload), header->length)))
+        fprintf(stderr, "failed to write loader file: %s\n", out_file);
+    free(*payload);
+    return ok;
+}
+
+
+/* This asks the daemon to run the ROM checks and prints what they found */
+static int verify(const char * encrypted_file, const char * plaintext_file)
+{
+    uint32_t result[2];
+    lynxd_header_t header;
+    unsigned char * payload;
+
+    if(!request(LYNXD_OP_VERIFY, encrypted_file, 0, 0, &header, &payload))
+        return EXIT_FAILURE;
+
+    if(header.length < sizeof(result))
+    {
+        fprintf(stderr, "short answer from lynxd\n");
+        free(payload);
+        return EXIT_FAILURE;
+    }
+    memcpy(result, payload, sizeof(result));
+    if(plaintext_file &&
+       !write_file(plaintext_file, payload + sizeof(result), header.length - sizeof(result)))
+    {
+        fprintf(stderr, "failed to write plaintext loader file: %s\n", plaintext_file);
+        free(payload);
+        return EXIT_FAILURE;
+    }
+    free(payload);
+
+    printf("%u frames\n", result[1]);
+    if(result[0] == 0)
+    {
+        printf("the ROM accepts %s\n", encrypted_file);
+        return EXIT_SUCCESS;
+    }
+
+    if(result[0] & VERIFY_ZERO_LEAD)
+        printf("    the first three bytes of a block are 0\n");
+    if(result[0] & VERIFY_RANGE)
+        printf("    a block is not below the modulus\n");
+    if(result[0] & VERIFY_MARKER)
+        printf("    a block doesn't start with 0x15\n");
+    if(result[0] & VERIFY_ACCUMULATOR)
+        printf("    a frame doesn't leave the accumulator at 0\n");
+    if(result[0] & VERIFY_TRUNCATED)
+        printf("    a frame runs past the end of the file\n");
+    if(result[0] & VERIFY_COUNT)
+        printf("    a frame has more than 5 blocks\n");
+    printf("the ROM rejects %s\n", encrypted_file);
+
+    return EXIT_FAILURE;
+}
+
+
+void print_help(char * name)
+{
+    printf("usage: %s enc -c <config file> -p <plaintext binary> -e <encrypted binary> [-q]\n", name);
+    printf("       %s enc -m <manifest> [-j <connections>] [-q]\n", name);
+    printf("       %s dec <encrypted.bin> <plaintext.bin>\n", name);
+    printf("       %s verify <encrypted.bin> [<plaintext.bin>]\n\n", name);
+    printf("named lynxenc or lynxdec it works like that tool and needs no mode\n\n");
+    printf("    -s, --socket <socket>  the lynxd socket, instead of $%s or %s\n",
+           LYNXD_SOCKET_ENV, LYNXD_DEFAULT_SOCKET);
+    printf("    -j <connections>       spread a manifest over this many connections\n");
+    printf("    -q, --quiet            accepted for lynxenc, lynxd never dumps blocks\n\n");
+}
+
+/* the long options, each of them maps onto a short one */
+static struct option long_options[] =
+{
+    { "help",       no_argument,        0, 'h' },
+    { "version",    no_argument,        0, 'V' },
+    { "quiet",      no_argument,        0, 'q' },
+    { "socket",     required_argument,  0, 's' },
+    { 0, 0, 0, 0 }
+};
+
+int main(int argc, char ** argv)
+{
+    int opt;
+    int mode;
+    int connections = 1;
+    int item_count;
+    char * name = strrchr(argv[0], '/');
+    char * cfg_file = 0;
+    char * plaintext_file = 0;
+    char * encrypted_file = 0;
+    char * manifest_file = 0;
+    FILE * manifest;
+    batch_item_t * items;
+    lynxd_header_t header;
+
+    /* the mode from the name it was run as, or the first argument */
+    name = name ? (name + 1) : argv[0];
+    if(strcmp(name, "lynxenc") == 0)
+        mode = MODE_ENC;
+    else if(strcmp(name, "lynxdec") == 0)
+        mode = MODE_DEC;
+    else
+    {
+        mode = -1;
+        if(argc > 1)
+        {
+            if(strcmp(argv[1], "enc") == 0)
+                mode = MODE_ENC;
+            else if(strcmp(argv[1], "dec") == 0)
+                mode = MODE_DEC;
+            else if(strcmp(argv[1], "verify") == 0)
+                mode = MODE_VERIFY;
+            else if(strcmp(argv[1], "--version") == 0)
+            {
+                printf("%s (lynxd client)\n    socket: %s\n", name, lynxd_socket_path(0));
+                return EXIT_SUCCESS;
+            }
+        }
+        if(mode < 0)
+        {
+            print_help(name);
+            return EXIT_FAILURE;
+        }
+
+        /* the options start after the mode */
+        argv++;
+        argc--;
+    }
+
+    /* parse the command line options */
+    while((opt = getopt_long(argc, argv, "hqs:c:p:e:j:m:", long_options, 0)) != -1)
+    {
+        switch(opt)
+        {
+            case 'c':
+                cfg_file = optarg;
+                break;
+            case 'p':
+                plaintext_file = optarg;
+                break;
+            case 'e':
+                encrypted_file = optarg;
+                break;
+            case 'm':
+                manifest_file = optarg;
+                break;
+            case 'j':
+                connections = atoi(optarg);
+                if(connections < 1)
+                {
+                    fprintf(stderr, "error: invalid connection count: %s\n\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'q':
+                break;
+            case 'h':
+                print_help(name);
+                return EXIT_SUCCESS;
+            case 'V':
+                printf("%s (lynxd client)\n    socket: %s\n", name, lynxd_socket_path(socket_path));
+                return EXIT_SUCCESS;
+            default:
+                print_help(name);
+                return EXIT_FAILURE;
+        }
+    }
+
+    switch(mode)
+    {
+        case MODE_ENC:
+            if(manifest_file)
+            {
+                if(!(manifest = fopen(manifest_file, "r")))
+                {
+                    fprintf(stderr, "failed to open manifest file: %s\n\n", manifest_file);
+                    return EXIT_FAILURE;
+                }
+                item_count = read_manifest(manifest, &items);
+                fclose(manifest);
+                if(item_count <= 0)
+                {
+                    fprintf(stderr, "failed to read manifest file\n\n");
+                    return EXIT_FAILURE;
+                }
+                return process_manifest(items, item_count, connections) ? EXIT_FAILURE : EXIT_SUCCESS;
+            }
+            if(!cfg_file || !plaintext_file || !encrypted_file)
+                break;
+            return request(LYNXD_OP_ENCRYPT, plaintext_file, cfg_file, encrypted_file,
+                           &header, 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        case MODE_DEC:
+            if(argc - optind < 2)
+                break;
+            return request(LYNXD_OP_DECRYPT, argv[optind], 0, argv[optind + 1],
+                           &header, 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        case MODE_VERIFY:
+            if(argc - optind < 1)
+                break;
+            return verify(argv[optind], (argc - optind > 1) ? argv[optind + 1] : 0);
+    }
+
+    print_help(name);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,346 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The records already in the file stay in the read-only mapping and the
+ * ones added since it was opened live in chunks on the heap.  Either way
+ * the hash table only holds pointers to them.  See lynxcache.h for the
+ * file format.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lynxcache.h"
+#include "sizes.h"
+
+#define CACHE_MAGIC             "LYNXBLK1"
+#define CACHE_VERSION           (1)
+
+/* how many new records each heap chunk holds */
+#define CHUNK_RECORDS           (256)
+
+typedef struct cache_header_s
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} cache_header_t;
+
+/* one block, 112 bytes with the padding */
+typedef struct cache_record_s
+{
+    uint64_t key_id;
+    unsigned char encoded[ENCRYPTED_BLOCK_SIZE];
+    unsigned char encrypted[ENCRYPTED_BLOCK_SIZE];
+    unsigned char pad[2];
+} cache_record_t;
+
+typedef struct cache_chunk_s
+{
+    struct cache_chunk_s * next;
+    int used;
+    cache_record_t records[CHUNK_RECORDS];
+} cache_chunk_t;
+
+struct lynx_cache_s
+{
+    pthread_mutex_t lock;
+    int fd;
+
+    /* the records that were in the file when it was opened */
+    void * map;
+    size_t map_size;
+
+    /* the ones added since */
+    cache_chunk_t * chunks;
+
+    /* open addressing, size is a power of 2 and at most half full */
+    const cache_record_t ** table;
+    size_t size;
+    size_t count;
+};
+
+
+/* FNV-1a, carried on from hash */
+static uint64_t fnv1a(uint64_t hash, const unsigned char * data, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#define FNV_OFFSET              (0xcbf29ce484222325ULL)
+
+
+uint64_t lynx_cache_key_id(const unsigned char * private_exp,
+                           const unsigned char * public_mod)
+{
+    uint64_t hash = fnv1a(FNV_OFFSET, public_mod, LYNX_RSA_KEY_SIZE);
+
+    return fnv1a(hash, private_exp, LYNX_RSA_KEY_SIZE);
+}
+
+
+static size_t record_slot(const lynx_cache_t * cache,
+                          const uint64_t key_id,
+                          const unsigned char * encoded)
+{
+    uint64_t hash = fnv1a(FNV_OFFSET, (const unsigned char *)&key_id, sizeof(key_id));
+
+    return (size_t)fnv1a(hash, encoded, ENCRYPTED_BLOCK_SIZE) & (cache->size - 1);
+}
+
+
+/* This puts a record in the table.  A later record for the same block
+ * replaces the earlier one. */
+static void table_insert(lynx_cache_t * cache, const cache_record_t * record)
+{
+    size_t i = record_slot(cache, record->key_id, record->encoded);
+
+    while(cache->table[i])
+    {
+        if((cache->table[i]->key_id == record->key_id) &&
+           (memcmp(cache->table[i]->encoded, record->encoded, ENCRYPTED_BLOCK_SIZE) == 0))
+        {
+            cache->table[i] = record;
+            return;
+        }
+        i = (i + 1) & (cache->size - 1);
+    }
+
+    cache->table[i] = record;
+    cache->count++;
+}
+
+
+/* This makes sure there is room for one more record */
+static int table_reserve(lynx_cache_t * cache)
+{
+    size_t i;
+    size_t old_size = cache->size;
+    const cache_record_t ** old = cache->table;
+
+    if((cache->count + 1) * 2 <= cache->size)
+        return 1;
+
+    cache->size = old_size ? (old_size * 2) : 1024;
+    cache->table = calloc(cache->size, sizeof(cache_record_t *));
+    if(!cache->table)
+    {
+        cache->table = old;
+        cache->size = old_size;
+        return 0;
+    }
+
+    cache->count = 0;
+    for(i = 0; i < old_size; i++)
+    {
+        if(old[i])
+            table_insert(cache, old[i]);
+    }
+    free(old);
+
+    return 1;
+}
+
+
+/* This checks the header and maps the whole records in the file.  A new
+ * file gets a header and one from another version of the cache is started
+ * over. */
+static int cache_load(lynx_cache_t * cache)
+{
+    size_t i, records;
+    struct stat st;
+    cache_header_t header;
+    const cache_record_t * record;
+
+    if(fstat(cache->fd, &st) != 0)
+        return 0;
+
+    /* never start over on top of something that isn't a cache at all */
+    if((st.st_size > 0) &&
+       ((st.st_size < (off_t)sizeof(header)) ||
+        (pread(cache->fd, &header, sizeof(header), 0) != sizeof(header)) ||
+        (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0)))
+    {
+        fprintf(stderr, "not a block cache file\n");
+        return 0;
+    }
+
+    if((st.st_size == 0) ||
+       (header.version != CACHE_VERSION) ||
+       (header.record_size != sizeof(cache_record_t)))
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.version = CACHE_VERSION;
+        header.record_size = sizeof(cache_record_t);
+        return (ftruncate(cache->fd, 0) == 0) &&
+               (write(cache->fd, &header, sizeof(header)) == sizeof(header));
+    }
+
+    /* drop a record that was cut short, so the next one lines up */
+    records = (st.st_size - sizeof(header)) / sizeof(cache_record_t);
+    cache->map_size = sizeof(header) + (records * sizeof(cache_record_t));
+    if(((size_t)st.st_size != cache->map_size) &&
+       (ftruncate(cache->fd, cache->map_size) != 0))
+        return 0;
+
+    if(records == 0)
+        return 1;
+
+    cache->map = mmap(0, cache->map_size, PROT_READ, MAP_PRIVATE, cache->fd, 0);
+    if(cache->map == MAP_FAILED)
+    {
+        cache->map = 0;
+        return 0;
+    }
+
+    record = (const cache_record_t *)((const char *)cache->map + sizeof(header));
+    for(i = 0; i < records; i++)
+    {
+        if(!table_reserve(cache))
+            return 0;
+        table_insert(cache, &record[i]);
+    }
+
+    return 1;
+}
+
+
+lynx_cache_t * lynx_cache_open(const char * path)
+{
+    lynx_cache_t * cache = calloc(1, sizeof(lynx_cache_t));
+
+    if(!cache)
+        return 0;
+
+    pthread_mutex_init(&cache->lock, 0);
+    cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if((cache->fd < 0) || !table_reserve(cache) || !cache_load(cache))
+    {
+        fprintf(stderr, "failed to open block cache: %s\n", path);
+        lynx_cache_close(cache);
+        return 0;
+    }
+
+    return cache;
+}
+
+
+void lynx_cache_close(lynx_cache_t * cache)
+{
+    cache_chunk_t * chunk;
+
+    if(!cache)
+        return;
+
+    while((chunk = cache->chunks))
+    {
+        cache->chunks = chunk->next;
+        free(chunk);
+    }
+    if(cache->map)
+        munmap(cache->map, cache->map_size);
+    if(cache->fd >= 0)
+        close(cache->fd);
+    free(cache->table);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+
+int lynx_cache_lookup(lynx_cache_t * cache,
+                      const uint64_t key_id,
+                      const unsigned char * encoded,
+                      unsigned char * encrypted)
+{
+    int hit = 0;
+    size_t i;
+
+    pthread_mutex_lock(&cache->lock);
+    i = record_slot(cache, key_id, encoded);
+    while(cache->table[i])
+    {
+        if((cache->table[i]->key_id == key_id) &&
+           (memcmp(cache->table[i]->encoded, encoded, ENCRYPTED_BLOCK_SIZE) == 0))
+        {
+            memcpy(encrypted, cache->table[i]->encrypted, ENCRYPTED_BLOCK_SIZE);
+            hit = 1;
+            break;
+        }
+        i = (i + 1) & (cache->size - 1);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return hit;
+}
+
+
+int lynx_cache_store(lynx_cache_t * cache,
+                     const uint64_t key_id,
+                     const unsigned char * encoded,
+                     const unsigned char * encrypted)
+{
+    int status = 0;
+    cache_chunk_t * chunk;
+    cache_record_t * record;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if(!cache->chunks || (cache->chunks->used == CHUNK_RECORDS))
+    {
+        if(!(chunk = calloc(1, sizeof(cache_chunk_t))))
+            goto done;
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+    }
+    if(!table_reserve(cache))
+        goto done;
+
+    record = &cache->chunks->records[cache->chunks->used++];
+    record->key_id = key_id;
+    memcpy(record->encoded, encoded, ENCRYPTED_BLOCK_SIZE);
+    memcpy(record->encrypted, encrypted, ENCRYPTED_BLOCK_SIZE);
+    table_insert(cache, record);
+
+    /* O_APPEND puts it at the end even with other writers on the file */
+    status = (write(cache->fd, record, sizeof(cache_record_t)) == sizeof(cache_record_t));
+
+done:
+    pthread_mutex_unlock(&cache->lock);
+    return status;
+}
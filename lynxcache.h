@@ -0,0 +1,72 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * An on-disk cache of encrypted blocks.  The RSA step only ever sees the 51
+ * byte encoded block, so the same encoded block under the same key always
+ * encrypts to the same bytes, and a loader that changed in a few places only
+ * has a few blocks that need the private key at all.
+ *
+ * The file is a 16 byte header followed by fixed size records, each holding
+ * the key ID, the encoded block and its encrypted form.  It is only ever
+ * appended to, so it is mapped read-only when it is opened and anything new
+ * goes on the end with a single write.  A record that was cut short by a
+ * crash is dropped the next time the file is opened.  The numbers are in
+ * the byte order of the machine that wrote them, it is a build cache and
+ * not something to pass around.
+ *
+ * A cache can be shared by any number of contexts and threads.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXCACHE_H_
+#define _LYNXCACHE_H_
+
+#include <stdint.h>
+
+typedef struct lynx_cache_s lynx_cache_t;
+
+/* open a cache file, creating it if it isn't there.  a cache written by
+ * another version of this code is started over. */
+lynx_cache_t * lynx_cache_open(const char * path);
+void lynx_cache_close(lynx_cache_t * cache);
+
+/* the ID that keeps the blocks of different keys apart, from the big endian
+ * private exponent and modulus */
+uint64_t lynx_cache_key_id(const unsigned char * private_exp,
+                           const unsigned char * public_mod);
+
+/* look up an encoded block (big endian, ENCRYPTED_BLOCK_SIZE bytes).  on a
+ * hit its encrypted form, in frame order, is copied out and 1 returned. */
+int lynx_cache_lookup(lynx_cache_t * cache,
+                      const uint64_t key_id,
+                      const unsigned char * encoded,
+                      unsigned char * encrypted);
+
+/* add a block to the cache and the end of its file */
+int lynx_cache_store(lynx_cache_t * cache,
+                     const uint64_t key_id,
+                     const unsigned char * encoded,
+                     const unsigned char * encrypted);
+
+#endif /* _LYNXCACHE_H_ */
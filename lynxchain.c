@@ -0,0 +1,398 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is a build time tool, it is not part of the library.  The private
+ * exponent in keys.h never changes, so instead of scanning it bit by bit on
+ * every block, this works out a sliding window schedule for it once and
+ * writes it out as C: a straight run of lynx_mont_mul calls with no loops
+ * and no branches on the exponent bits.  The Makefile runs it to make
+ * lynxchains.c.
+ *
+ * The encrypt paths that matter don't use the whole exponent though, they
+ * sign with CRT.  So this also factors the modulus the same way
+ * factor_modulus in lynxcrypt.c does, and with -k writes the schedules for
+ * dp and dq as multi-buffer kernel code, lynxmbchains.h, which lynxmbk.h
+ * builds into each of its 8 limb kernels.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/bn.h>
+#include "sizes.h"
+#include "keys.h"
+
+#define MAX_WINDOW                  (7)
+#define MAX_STEPS                   (8 * LYNX_RSA_KEY_SIZE)
+
+/* one window of the schedule: square 'squares' times, then multiply by the
+ * odd power 'power' */
+typedef struct chain_step_s
+{
+    int squares;
+    int power;
+} chain_step_t;
+
+/* a whole schedule for one exponent */
+typedef struct chain_s
+{
+    int window;
+    int steps;
+    int squares;        /* in the main loop, after the last window too */
+    int multiplies;     /* including filling the table */
+    chain_step_t step[MAX_STEPS];
+    int tail;           /* squares after the last window */
+} chain_t;
+
+
+/* bit i of a big endian exponent, bit 0 being the least significant */
+static int exp_bit(const unsigned char * exponent, int len, int i)
+{
+    return (exponent[(len - 1) - (i / 8)] >> (i % 8)) & 1;
+}
+
+
+/* This works out the sliding window schedule for one window size.  It
+ * returns 0 if the exponent is 0. */
+static int make_chain(chain_t * chain, const unsigned char * exponent, int len, int window)
+{
+    int i, j, k, value;
+    int squares = 0;
+
+    memset(chain, 0, sizeof(chain_t));
+    chain->window = window;
+
+    for(i = (8 * len) - 1; (i >= 0) && !exp_bit(exponent, len, i); i--);
+    if(i < 0)
+        return 0;
+
+    /* the table of odd powers a, a**3, ... a**(2**w - 1) takes one squaring
+     * and 2**(w-1) - 1 multiplies */
+    if(window > 1)
+        chain->multiplies = 1 + (1 << (window - 1)) - 1;
+
+    while(i >= 0)
+    {
+        if(!exp_bit(exponent, len, i))
+        {
+            squares++;
+            i--;
+            continue;
+        }
+
+        /* the longest window, up to 'window' bits, that ends in a 1 */
+        j = (i - window + 1 > 0) ? (i - window + 1) : 0;
+        while(!exp_bit(exponent, len, j))
+            j++;
+
+        value = 0;
+        for(k = i; k >= j; k--)
+        {
+            value = (value << 1) | exp_bit(exponent, len, k);
+        }
+
+        /* the first window just copies its power, the rest square once per
+         * bit and multiply */
+        if(chain->steps > 0)
+        {
+            squares += i - j + 1;
+            chain->multiplies++;
+        }
+        chain->step[chain->steps].squares = squares;
+        chain->step[chain->steps].power = value;
+        chain->squares += squares;
+        chain->steps++;
+        squares = 0;
+
+        i = j - 1;
+    }
+
+    chain->tail = squares;
+    chain->squares += squares;
+    return 1;
+}
+
+
+/* This writes out the body of a chain, with 'mul' the format of one
+ * multiply: the result, then the two operands.  The table of odd powers is
+ * p[] and the result ends up in t. */
+static void print_steps(FILE * out, const char * mul, const char * copy, const chain_t * chain)
+{
+    int i, j;
+    char a[16], b[16];
+
+    if(chain->window > 1)
+    {
+        fprintf(out, mul, "a2", "p[0]", "p[0]");
+        for(i = 1; i < (1 << (chain->window - 1)); i++)
+        {
+            snprintf(a, sizeof(a), "p[%d]", i);
+            snprintf(b, sizeof(b), "p[%d]", i - 1);
+            fprintf(out, mul, a, b, "a2");
+        }
+    }
+    fprintf(out, "\n");
+
+    for(i = 0; i < chain->steps; i++)
+    {
+        for(j = 0; j < chain->step[i].squares; j++)
+        {
+            fprintf(out, mul, "t", "t", "t");
+        }
+
+        snprintf(a, sizeof(a), "p[%d]", chain->step[i].power >> 1);
+        if(i == 0)
+            fprintf(out, copy, a);
+        else
+            fprintf(out, mul, "t", "t", a);
+    }
+    for(j = 0; j < chain->tail; j++)
+    {
+        fprintf(out, mul, "t", "t", "t");
+    }
+}
+
+
+/* This writes out the generated function for one exponent */
+static void print_chain(FILE * out, const char * name, const char * key, const chain_t * chain)
+{
+    fprintf(out, "/* %s: %d-bit windows, %d squarings and %d multiplies */\n",
+            key, chain->window, chain->squares, chain->multiplies);
+    fprintf(out, "void %s(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a)\n", name);
+    fprintf(out, "{\n");
+    fprintf(out, "    lynx_limbs_t t;\n");
+    if(chain->window > 1)
+        fprintf(out, "    lynx_limbs_t a2;\n");
+    fprintf(out, "    lynx_limbs_t p[%d];\n\n", 1 << (chain->window - 1));
+
+    /* the odd powers */
+    fprintf(out, "    lynx_mont_to(mont, p[0], a);\n");
+    print_steps(out, "    lynx_mont_mul(mont, %s, %s, %s);\n", "    memcpy(t, %s, sizeof(t));\n", chain);
+
+    fprintf(out, "\n    lynx_mont_from(mont, r, t);\n");
+    fprintf(out, "}\n\n");
+}
+
+
+/* This writes out the kernel version of a chain.  a and t are already in
+ * the Montgomery domain, the kernel takes care of getting in and out. */
+static void print_mb_chain(FILE * out, const char * name, const char * key, const chain_t * chain)
+{
+    fprintf(out, "/* %s: %d-bit windows, %d squarings and %d multiplies */\n",
+            key, chain->window, chain->squares, chain->multiplies);
+    fprintf(out, "static void MB_FN(%s)(MB_VEC * t, const MB_VEC * a, const MB_VEC * n, const MB_VEC n0)\n", name);
+    fprintf(out, "{\n");
+    if(chain->window > 1)
+        fprintf(out, "    MB_VEC a2[MB_LIMBS];\n");
+    fprintf(out, "    MB_VEC p[%d][MB_LIMBS];\n\n", 1 << (chain->window - 1));
+
+    fprintf(out, "    memcpy(p[0], a, sizeof(p[0]));\n");
+    print_steps(out, "    MB_FN(mul)(%s, %s, %s, n, n0);\n", "    memcpy(t, %s, sizeof(p[0]));\n", chain);
+
+    fprintf(out, "}\n\n");
+}
+
+
+/* the modular multiplies a chain does, with one more on the way into the
+ * Montgomery domain and one on the way out */
+static int chain_mulmods(const chain_t * chain)
+{
+    return chain->squares + chain->multiplies + 2;
+}
+
+
+/* This writes out a big endian exponent as a byte array */
+static void print_exponent(FILE * out, const char * name, const unsigned char * exponent, int len)
+{
+    int i;
+
+    fprintf(out, "static const unsigned char %s[%d] =\n{", name, len);
+    for(i = 0; i < len; i++)
+    {
+        fprintf(out, "%s0x%02x%s", (i % 8) ? " " : "\n    ", exponent[i], (i < len - 1) ? "," : "");
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+
+/* This picks the window size with the fewest multiplies and squarings */
+static int best_chain(chain_t * chain, const unsigned char * exponent, int len)
+{
+    int w;
+    chain_t * tmp = malloc(sizeof(chain_t));
+
+    if(!tmp || !make_chain(chain, exponent, len, 1))
+    {
+        free(tmp);
+        return 0;
+    }
+
+    for(w = 2; w <= MAX_WINDOW; w++)
+    {
+        make_chain(tmp, exponent, len, w);
+        if((tmp->squares + tmp->multiplies) < (chain->squares + chain->multiplies))
+            memcpy(chain, tmp, sizeof(chain_t));
+    }
+
+    free(tmp);
+    return 1;
+}
+
+
+/* This recovers dp and dq the same way factor_modulus in lynxcrypt.c does,
+ * with p the larger prime.  They are big endian, and it returns 0 if the
+ * modulus can't be factored. */
+static int crt_exponents(unsigned char * dp, int * dp_len, unsigned char * dq, int * dq_len)
+{
+    int i, s;
+    BN_ULONG g;
+    int found = 0;
+    BN_CTX * bn = BN_CTX_new();
+    BIGNUM *t, *x, *y, *nm1, *bg, *n, *d, *p, *q;
+
+    if(!bn)
+        return 0;
+
+    BN_CTX_start(bn);
+    t = BN_CTX_get(bn);
+    x = BN_CTX_get(bn);
+    y = BN_CTX_get(bn);
+    nm1 = BN_CTX_get(bn);
+    bg = BN_CTX_get(bn);
+    n = BN_CTX_get(bn);
+    d = BN_CTX_get(bn);
+    p = BN_CTX_get(bn);
+    q = BN_CTX_get(bn);
+    if(!q)
+        goto done;
+
+    BN_bin2bn(lynx_public_mod, LYNX_RSA_KEY_SIZE, n);
+    BN_bin2bn(lynx_private_exp, LYNX_RSA_KEY_SIZE, d);
+    BN_bin2bn(lynx_public_exp, LYNX_RSA_KEY_SIZE, x);
+
+    /* t = e * d - 1 = 2**s * t */
+    BN_mul(t, x, d, bn);
+    BN_sub_word(t, 1);
+    if(BN_is_zero(t))
+        goto done;
+    for(s = 0; !BN_is_odd(t); s++)
+        BN_rshift1(t, t);
+
+    BN_copy(nm1, n);
+    BN_sub_word(nm1, 1);
+
+    for(g = 2; (g < 100) && !found; g++)
+    {
+        BN_set_word(bg, g);
+        BN_mod_exp(x, bg, t, n, bn);
+        if(BN_is_one(x) || (BN_cmp(x, nm1) == 0))
+            continue;
+
+        for(i = 0; i < s; i++)
+        {
+            BN_mod_sqr(y, x, n, bn);
+            if(BN_is_one(y))
+            {
+                BN_sub_word(x, 1);
+                BN_gcd(p, x, n, bn);
+                BN_div(q, y, n, p, bn);
+                found = BN_is_zero(y) && !BN_is_one(p) && !BN_is_one(q);
+                break;
+            }
+            if(BN_cmp(y, nm1) == 0)
+                break;
+            BN_copy(x, y);
+        }
+    }
+
+    if(!found)
+        goto done;
+
+    if(BN_cmp(p, q) < 0)
+        BN_swap(p, q);
+
+    BN_sub_word(p, 1);
+    BN_mod(x, d, p, bn);
+    (*dp_len) = BN_bn2bin(x, dp);
+    BN_sub_word(q, 1);
+    BN_mod(x, d, q, bn);
+    (*dq_len) = BN_bn2bin(x, dq);
+    found = ((*dp_len) > 0) && ((*dq_len) > 0);
+
+done:
+    BN_CTX_end(bn);
+    BN_CTX_free(bn);
+    return found;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static chain_t chain;
+    static chain_t dp_chain;
+    static chain_t dq_chain;
+    unsigned char dp[LYNX_RSA_KEY_SIZE];
+    unsigned char dq[LYNX_RSA_KEY_SIZE];
+    int dp_len, dq_len;
+    int kernel = (argc > 1) && (strcmp(argv[1], "-k") == 0);
+
+    if(!best_chain(&chain, lynx_private_exp, LYNX_RSA_KEY_SIZE))
+    {
+        fprintf(stderr, "lynxchain: the private exponent is 0\n");
+        return EXIT_FAILURE;
+    }
+
+    if(!crt_exponents(dp, &dp_len, dq, &dq_len) ||
+       !best_chain(&dp_chain, dp, dp_len) ||
+       !best_chain(&dq_chain, dq, dq_len))
+    {
+        fprintf(stderr, "lynxchain: failed to factor the modulus\n");
+        return EXIT_FAILURE;
+    }
+
+    if(kernel)
+    {
+        printf("/* This file is generated by lynxchain -k from keys.h, do not edit it.\n");
+        printf(" * lynxmbk.h includes it in each of its 8 limb kernels. */\n\n");
+        print_mb_chain(stdout, "chain_dp", "dp", &dp_chain);
+        print_mb_chain(stdout, "chain_dq", "dq", &dq_chain);
+        return EXIT_SUCCESS;
+    }
+
+    printf("/* This file is generated by lynxchain from keys.h, do not edit it. */\n\n");
+    printf("#include <string.h>\n");
+    printf("#include \"lynxchains.h\"\n\n");
+    print_chain(stdout, "lynx_chain_private_exp", "lynx_private_exp", &chain);
+    printf("const int lynx_chain_private_mulmods = %d;\n\n", chain_mulmods(&chain));
+
+    print_exponent(stdout, "chain_dp", dp, dp_len);
+    print_exponent(stdout, "chain_dq", dq, dq_len);
+    printf("const lynx_chain_exp_t lynx_chain_crt[2] =\n{\n");
+    printf("    { chain_dp, %d, %d },\n", dp_len, chain_mulmods(&dp_chain));
+    printf("    { chain_dq, %d, %d }\n", dq_len, chain_mulmods(&dq_chain));
+    printf("};\n");
+
+    return EXIT_SUCCESS;
+}
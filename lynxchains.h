@@ -0,0 +1,58 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The exponentiations for the fixed keys in keys.h, unrolled into straight
+ * line code by lynxchain at build time (see lynxchain.c).
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXCHAINS_H_
+#define _LYNXCHAINS_H_
+
+#include "lynxmont.h"
+
+/* r = a**lynx_private_exp mod n, the same as lynx_mont_exp with that
+ * exponent */
+void lynx_chain_private_exp(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a);
+
+/* the modular multiplies lynx_chain_private_exp does, the conversions into
+ * and out of the Montgomery domain included */
+extern const int lynx_chain_private_mulmods;
+
+/* the CRT halves of lynx_private_exp, d mod p - 1 and d mod q - 1 with p
+ * the larger prime, big endian.  lynx_mb_exp_chain has them unrolled in the
+ * multi-buffer kernels. */
+#define LYNX_CHAIN_DP               (0)
+#define LYNX_CHAIN_DQ               (1)
+
+typedef struct lynx_chain_exp_s
+{
+    const unsigned char * exponent;
+    int len;
+    int mulmods;        /* what its chain does, the same way as above */
+} lynx_chain_exp_t;
+
+extern const lynx_chain_exp_t lynx_chain_crt[2];
+
+#endif /* _LYNXCHAINS_H_ */
@@ -0,0 +1,1536 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This software is original software written completely by me, but there are
+ * pieces of data (e.g. the keys.h and loaders.h files) that I got from the
+ * Atari Age Lynx Programming forum and from people in the Lynx community,
+ * namely Karri Kaksonen.  Without their help, this would have never been
+ * possible.  I was standing on the shoulders of giants.
+ *
+ * This is the RSA half of the library.  It holds the encode/encrypt and
+ * decrypt/decode steps that used to live in lynxenc.c and lynxdec.c along
+ * with the config file parser.  The encrypted loader format is:
+ *
+ * Each frame starts with a single byte that specifies how many blocks are
+ * in the frame.  The frames are packed together without any padding between
+ * them.  The block count byte has the value 256 - block count.  The
+ * unencrypted data is processed in 50 byte chunks.  Each chunk is padded out
+ * to 51 bytes before being encrypted using the private exponent and public
+ * modulus.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <openssl/bn.h>
+#include "lynxcrypt.h"
+#include "lynxmont.h"
+#include "lynxmb.h"
+#include "lynxchains.h"
+#include "lynxprobes.h"
+#include "keys.h"
+
+/* how many blocks the batch calls run through the lanes at a time */
+#define MAX_BATCH_BLOCKS        (8 * LYNX_BATCH_BLOCKS)
+
+/* the modular multiplies one block takes on each of the paths, for --stats */
+typedef struct lynx_mulmods_s
+{
+    int mont;               /* the limb engine, lynx_mont_exp or a chain */
+    int bn;                 /* OpenSSL with the whole exponent */
+    int crt;                /* OpenSSL with dp and dq */
+    int mb;                 /* the multi-buffer kernels, whole exponent */
+    int mb_crt;             /* the multi-buffer kernels, dp and dq */
+} lynx_mulmods_t;
+
+
+struct lynx_ctx_s
+{
+    int engine;
+    int verbose;
+
+    /* where --stats goes, 0 when nobody asked, and the multiplies each
+     * path takes per block with each key */
+    lynx_stats_t * stats;
+    lynx_mulmods_t private_mulmods;
+    lynx_mulmods_t public_mulmods;
+
+    /* the block cache, if any, and this key's ID in it */
+    lynx_cache_t * cache;
+    uint64_t cache_key;
+
+    /* key material for the native engine */
+    unsigned char private_key[LYNX_RSA_KEY_SIZE];
+    unsigned char public_key[LYNX_RSA_KEY_SIZE];
+    lynx_mont_t mont;
+
+    /* set when the private exponent is the one in keys.h, which has its
+     * exponentiation unrolled at build time */
+    int private_chain;
+
+    /* key material for OpenSSL */
+    BIGNUM * private_exp;
+    BIGNUM * public_exp;
+    BIGNUM * modulus;
+    BN_CTX * bn_ctx;
+    BN_MONT_CTX * mont_ctx;
+
+    /* scratch space so the per-block path never allocates */
+    BIGNUM * block;
+    BIGNUM * result;
+
+    /* set when the public exponent is 3 so decrypting is just a cube */
+    int public_cube;
+
+    /* CRT key recovered from the modulus and both exponents.  crt is 0 until
+     * the first encryption tries to recover it, 1 when it is ready and -1
+     * when it is turned off or the modulus could not be factored. */
+    int crt;
+    BIGNUM * p;
+    BIGNUM * q;
+    BIGNUM * dp;
+    BIGNUM * dq;
+    BIGNUM * qinv;
+    BN_MONT_CTX * mont_p;
+    BN_MONT_CTX * mont_q;
+
+    /* the multi-buffer engine used by the batch calls, for the modulus and
+     * for the CRT primes with their big endian exponents */
+    lynx_mb_t mb;
+    lynx_mb_t mb_p;
+    lynx_mb_t mb_q;
+    unsigned char dp_key[LYNX_RSA_KEY_SIZE];
+    unsigned char dq_key[LYNX_RSA_KEY_SIZE];
+    int dp_len;
+    int dq_len;
+
+    /* set when dp and dq are the ones lynxchain unrolled for the keys.h key */
+    int crt_chain;
+};
+
+
+#define min(x,y) ((x < y) ? x : y)
+
+
+/* This counts the modular multiplies, squarings included, that a left to
+ * right sliding window exponentiation takes for a big endian exponent: the
+ * table of odd powers, the squarings and a multiply for every window after
+ * the first.  It works the windows out the same way lynxchain does, and a
+ * window of 1 bit is plain square and multiply. */
+static int window_mulmods(const unsigned char * exponent, int len, int window)
+{
+    int i, j;
+    int windows = 0;
+    int squares = 0;
+
+#define EXP_BIT(i)  ((exponent[(len - 1) - ((i) / 8)] >> ((i) % 8)) & 1)
+
+    for(i = (8 * len) - 1; (i >= 0) && !EXP_BIT(i); i--);
+    if(i < 0)
+        return 0;
+
+    while(i >= 0)
+    {
+        if(!EXP_BIT(i))
+        {
+            squares++;
+            i--;
+            continue;
+        }
+
+        /* the longest window, up to 'window' bits, that ends in a 1 */
+        j = (i - window + 1 > 0) ? (i - window + 1) : 0;
+        while(!EXP_BIT(j))
+            j++;
+
+        if(windows++)
+            squares += i - j + 1;
+        i = j - 1;
+    }
+
+#undef EXP_BIT
+
+    return ((window > 1) ? (1 << (window - 1)) : 0) + squares + (windows - 1);
+}
+
+
+/* The same for OpenSSL's BN_mod_exp_mont, which picks its window from the
+ * size of the exponent.  On top of the windows it converts the base in,
+ * makes its 1 in the Montgomery domain, multiplies that 1 by the first
+ * window and converts the result back out. */
+static int bn_mulmods(const unsigned char * exponent, int len)
+{
+    int bits;
+    int window;
+
+    for(; (len > 0) && !exponent[0]; exponent++, len--);
+    if(!len)
+        return 0;
+
+    for(bits = 8 * len; !(exponent[0] & (1 << ((bits - 1) % 8))); bits--);
+    window = (bits > 671) ? 6 : (bits > 239) ? 5 : (bits > 79) ? 4 : (bits > 23) ? 3 : 1;
+
+    return window_mulmods(exponent, len, window) + 4;
+}
+
+
+/* This works out the multiplies each path takes for one key.  lynx_mont_exp
+ * converts its 1 and the base in, starts with a multiply by the base and
+ * converts back out.  The kernels start from the base with one conversion
+ * in and one out, but without lanes they fall back on lynx_mont_exp.  A
+ * cube is three multiplies everywhere. */
+static void key_mulmods(lynx_mulmods_t * mulmods, const unsigned char * exponent, int cube)
+{
+    int square_multiply = window_mulmods(exponent, LYNX_RSA_KEY_SIZE, 1);
+
+    memset(mulmods, 0, sizeof(lynx_mulmods_t));
+    if(cube)
+    {
+        mulmods->mont = mulmods->bn = mulmods->mb = 3;
+        return;
+    }
+
+    mulmods->mont = square_multiply + 4;
+    mulmods->bn = bn_mulmods(exponent, LYNX_RSA_KEY_SIZE);
+    mulmods->mb = square_multiply + ((lynx_mb_lanes() > 1) ? 2 : 4);
+}
+
+
+void lynx_print_data(const unsigned char * data, int size)
+{
+    int i = 0;
+    int j, count;
+
+    while(i < size)
+    {
+        count = min(8, (size - i));
+
+        printf("    ");
+        for(j = 0; j < count; j++)
+        {
+            printf("0x%02x, ", data[i + j]);
+        }
+        printf("\n");
+        i += count;
+    }
+}
+
+
+/* This function prints the --version output for the tools: the name of the
+ * tool and which of the big number kernels were picked for this CPU */
+void lynx_print_version(const char * name)
+{
+    printf("%s\n", name);
+    printf("    montgomery kernel:   %s\n", lynx_mont_kernel());
+    printf("    multi-buffer kernel: %s (%d lanes)\n", lynx_mb_kernel(), lynx_mb_lanes());
+}
+
+
+/* This function creates a context for the well known Lynx keys */
+lynx_ctx_t * lynx_ctx_new(void)
+{
+    return lynx_ctx_new_key(lynx_private_exp, lynx_public_exp, lynx_public_mod);
+}
+
+
+/* This function creates a context for an arbitrary key.  All of the key
+ * material is big endian and LYNX_RSA_KEY_SIZE bytes long. */
+lynx_ctx_t * lynx_ctx_new_key(const unsigned char * private_exp,
+                              const unsigned char * public_exp,
+                              const unsigned char * public_mod)
+{
+    lynx_ctx_t * ctx = calloc(1, sizeof(lynx_ctx_t));
+
+    if(!ctx)
+        return 0;
+
+    /* set up the native engine */
+    memcpy(ctx->private_key, private_exp, LYNX_RSA_KEY_SIZE);
+    memcpy(ctx->public_key, public_exp, LYNX_RSA_KEY_SIZE);
+    if(!lynx_mont_init(&ctx->mont, public_mod, LYNX_RSA_KEY_SIZE) ||
+       !lynx_mb_init(&ctx->mb, public_mod, LYNX_RSA_KEY_SIZE))
+    {
+        free(ctx);
+        return 0;
+    }
+
+    /* set up the bignum variables */
+    ctx->private_exp = BN_bin2bn(private_exp, LYNX_RSA_KEY_SIZE, 0);
+    ctx->public_exp = BN_bin2bn(public_exp, LYNX_RSA_KEY_SIZE, 0);
+    ctx->modulus = BN_bin2bn(public_mod, LYNX_RSA_KEY_SIZE, 0);
+    ctx->bn_ctx = BN_CTX_new();
+    ctx->mont_ctx = BN_MONT_CTX_new();
+    ctx->block = BN_new();
+    ctx->result = BN_new();
+
+    if(!ctx->private_exp || !ctx->public_exp || !ctx->modulus ||
+       !ctx->bn_ctx || !ctx->mont_ctx || !ctx->block || !ctx->result ||
+       !BN_MONT_CTX_set(ctx->mont_ctx, ctx->modulus, ctx->bn_ctx))
+    {
+        lynx_ctx_free(ctx);
+        return 0;
+    }
+
+    ctx->private_chain = (memcmp(private_exp, lynx_private_exp, LYNX_RSA_KEY_SIZE) == 0);
+
+    /* the Lynx public exponent is 3, see the note in keys.h */
+    ctx->public_cube = BN_is_word(ctx->public_exp, 3);
+
+    key_mulmods(&ctx->private_mulmods, private_exp, 0);
+    key_mulmods(&ctx->public_mulmods, public_exp, ctx->public_cube);
+    if(ctx->private_chain)
+        ctx->private_mulmods.mont = lynx_chain_private_mulmods;
+
+    ctx->cache_key = lynx_cache_key_id(private_exp, public_mod);
+
+    return ctx;
+}
+
+
+void lynx_ctx_free(lynx_ctx_t * ctx)
+{
+    if(!ctx)
+        return;
+
+    /* free the bignum variables */
+    BN_free(ctx->block);
+    BN_free(ctx->result);
+    BN_free(ctx->modulus);
+    BN_free(ctx->public_exp);
+    BN_free(ctx->private_exp);
+    BN_MONT_CTX_free(ctx->mont_ctx);
+    BN_MONT_CTX_free(ctx->mont_p);
+    BN_MONT_CTX_free(ctx->mont_q);
+    BN_free(ctx->p);
+    BN_free(ctx->q);
+    BN_free(ctx->dp);
+    BN_free(ctx->dq);
+    BN_free(ctx->qinv);
+    BN_CTX_free(ctx->bn_ctx);
+    free(ctx);
+}
+
+
+/* When verbose is set the encoded and encrypted blocks are dumped to stdout */
+void lynx_ctx_set_verbose(lynx_ctx_t * ctx, int verbose)
+{
+    ctx->verbose = verbose;
+}
+
+
+/* This hands the context somewhere to add up its stage times and counts.
+ * The stats can be shared by any number of contexts, 0 turns it off. */
+void lynx_ctx_set_stats(lynx_ctx_t * ctx, lynx_stats_t * stats)
+{
+    ctx->stats = stats;
+}
+
+
+/* This hands the context a block cache.  Like the stats, one cache can be
+ * shared by any number of contexts, 0 turns it off. */
+void lynx_ctx_set_cache(lynx_ctx_t * ctx, lynx_cache_t * cache)
+{
+    ctx->cache = cache;
+}
+
+
+/* This selects the engine used for the RSA step, LYNX_ENGINE_BN or
+ * LYNX_ENGINE_MONT64.  Both give identical results. */
+int lynx_ctx_set_engine(lynx_ctx_t * ctx, int engine)
+{
+    if((engine != LYNX_ENGINE_BN) && (engine != LYNX_ENGINE_MONT64))
+        return 0;
+
+    ctx->engine = engine;
+    return 1;
+}
+
+
+/* This turns the CRT signing mode on or off.  It is on by default and is
+ * only used when the modulus can be factored from the key. */
+void lynx_ctx_set_crt(lynx_ctx_t * ctx, int crt)
+{
+    if(!crt)
+        ctx->crt = -1;
+    else if(ctx->crt < 0)
+        ctx->crt = 0;
+}
+
+
+/* This function recovers the two primes of the modulus.  Knowing both
+ * exponents, e * d - 1 is a multiple of phi(n) = (p - 1) * (q - 1), so
+ * writing it as 2**s * t, some g**(t * 2**i) is a square root of 1 other
+ * than +/-1 and gcd(that - 1, n) is one of the primes. */
+static int factor_modulus(lynx_ctx_t * ctx)
+{
+    int i, s;
+    BN_ULONG g;
+    int found = 0;
+    BIGNUM *t, *x, *y, *nm1, *bg;
+    BN_CTX * bn = ctx->bn_ctx;
+    unsigned char buf[LYNX_RSA_KEY_SIZE];
+
+    BN_CTX_start(bn);
+    t = BN_CTX_get(bn);
+    x = BN_CTX_get(bn);
+    y = BN_CTX_get(bn);
+    nm1 = BN_CTX_get(bn);
+    bg = BN_CTX_get(bn);
+    if(!bg)
+        goto done;
+
+    /* t = e * d - 1 = 2**s * t */
+    BN_mul(t, ctx->public_exp, ctx->private_exp, bn);
+    BN_sub_word(t, 1);
+    if(BN_is_zero(t))
+        goto done;
+    for(s = 0; !BN_is_odd(t); s++)
+        BN_rshift1(t, t);
+
+    BN_copy(nm1, ctx->modulus);
+    BN_sub_word(nm1, 1);
+
+    /* the first few small bases are always enough in practice */
+    for(g = 2; (g < 100) && !found; g++)
+    {
+        BN_set_word(bg, g);
+        BN_mod_exp_mont(x, bg, t, ctx->modulus, bn, ctx->mont_ctx);
+        if(BN_is_one(x) || (BN_cmp(x, nm1) == 0))
+            continue;
+
+        for(i = 0; i < s; i++)
+        {
+            BN_mod_sqr(y, x, ctx->modulus, bn);
+            if(BN_is_one(y))
+            {
+                /* x is a non-trivial square root of 1 */
+                BN_sub_word(x, 1);
+                ctx->p = BN_new();
+                ctx->q = BN_new();
+                BN_gcd(ctx->p, x, ctx->modulus, bn);
+                BN_div(ctx->q, y, ctx->modulus, ctx->p, bn);
+                found = BN_is_zero(y) && !BN_is_one(ctx->p) && !BN_is_one(ctx->q);
+                break;
+            }
+            if(BN_cmp(y, nm1) == 0)
+                break;
+            BN_copy(x, y);
+        }
+    }
+
+    if(!found)
+        goto done;
+
+    /* keep p as the larger prime so qinv = 1/q mod p */
+    if(BN_cmp(ctx->p, ctx->q) < 0)
+        BN_swap(ctx->p, ctx->q);
+
+    ctx->dp = BN_new();
+    ctx->dq = BN_new();
+    ctx->qinv = BN_new();
+    ctx->mont_p = BN_MONT_CTX_new();
+    ctx->mont_q = BN_MONT_CTX_new();
+
+    BN_copy(x, ctx->p);
+    BN_sub_word(x, 1);
+    BN_mod(ctx->dp, ctx->private_exp, x, bn);
+    BN_copy(x, ctx->q);
+    BN_sub_word(x, 1);
+    BN_mod(ctx->dq, ctx->private_exp, x, bn);
+
+    found = (BN_mod_inverse(ctx->qinv, ctx->q, ctx->p, bn) != 0) &&
+            BN_MONT_CTX_set(ctx->mont_p, ctx->p, bn) &&
+            BN_MONT_CTX_set(ctx->mont_q, ctx->q, bn);
+
+    /* the same key for the multi-buffer engine */
+    if(found)
+    {
+        found = lynx_mb_init(&ctx->mb_p, buf, BN_bn2bin(ctx->p, buf)) &&
+                lynx_mb_init(&ctx->mb_q, buf, BN_bn2bin(ctx->q, buf));
+        ctx->dp_len = BN_bn2bin(ctx->dp, ctx->dp_key);
+        ctx->dq_len = BN_bn2bin(ctx->dq, ctx->dq_key);
+        ctx->crt_chain = (ctx->dp_len == lynx_chain_crt[LYNX_CHAIN_DP].len) &&
+                         (ctx->dq_len == lynx_chain_crt[LYNX_CHAIN_DQ].len) &&
+                         (memcmp(ctx->dp_key, lynx_chain_crt[LYNX_CHAIN_DP].exponent, ctx->dp_len) == 0) &&
+                         (memcmp(ctx->dq_key, lynx_chain_crt[LYNX_CHAIN_DQ].exponent, ctx->dq_len) == 0);
+
+        /* both halves and the multiply that puts them back together */
+        ctx->private_mulmods.crt = bn_mulmods(ctx->dp_key, ctx->dp_len) +
+                                   bn_mulmods(ctx->dq_key, ctx->dq_len) + 1;
+        if(ctx->crt_chain)
+            ctx->private_mulmods.mb_crt = lynx_chain_crt[LYNX_CHAIN_DP].mulmods +
+                                          lynx_chain_crt[LYNX_CHAIN_DQ].mulmods + 1;
+        else
+            ctx->private_mulmods.mb_crt = (window_mulmods(ctx->dp_key, ctx->dp_len, 1) + 2) +
+                                          (window_mulmods(ctx->dq_key, ctx->dq_len, 1) + 2) + 1;
+    }
+
+done:
+    BN_CTX_end(bn);
+    return found;
+}
+
+
+/* result = m2 + q * (qinv * (m1 - m2) mod p), which puts the two halves of a
+ * CRT signature back together.  m1 is overwritten. */
+static void crt_combine(lynx_ctx_t * ctx, BIGNUM * result, BIGNUM * m1, BIGNUM * m2)
+{
+    BN_mod_sub(m1, m1, m2, ctx->p, ctx->bn_ctx);
+    BN_mod_mul(m1, m1, ctx->qinv, ctx->p, ctx->bn_ctx);
+    BN_mul(m1, m1, ctx->q, ctx->bn_ctx);
+    BN_add(result, m2, m1);
+}
+
+
+/* result = block**d mod n, using two half width exponentiations when the CRT
+ * key is available:
+ *   m1 = block**dp mod p, m2 = block**dq mod q
+ *   result = m2 + q * (qinv * (m1 - m2) mod p) */
+static void sign_block(lynx_ctx_t * ctx, BIGNUM * result, BIGNUM * block)
+{
+    BIGNUM *m1, *m2;
+    BN_CTX * bn = ctx->bn_ctx;
+
+    if(ctx->crt == 0)
+        ctx->crt = factor_modulus(ctx) ? 1 : -1;
+
+    if(ctx->crt < 0)
+    {
+        BN_mod_exp_mont(result, block, ctx->private_exp, ctx->modulus, bn,
+                        ctx->mont_ctx);
+        return;
+    }
+
+    BN_CTX_start(bn);
+    m1 = BN_CTX_get(bn);
+    m2 = BN_CTX_get(bn);
+
+    BN_mod(m1, block, ctx->p, bn);
+    BN_mod_exp_mont(m1, m1, ctx->dp, ctx->p, bn, ctx->mont_p);
+    BN_mod(m2, block, ctx->q, bn);
+    BN_mod_exp_mont(m2, m2, ctx->dq, ctx->q, bn, ctx->mont_q);
+
+    crt_combine(ctx, result, m1, m2);
+
+    BN_CTX_end(bn);
+}
+
+
+/* This function pads/encodes a single block of plaintext out to
+ * ENCRYPTED_BLOCK_SIZE.  The encoded block is big endian, ready for the RSA
+ * step, and only depends on the plaintext and the accumulator. */
+void lynx_encode_block(unsigned char * encoded,
+                       const unsigned char * plaintext,
+                       const int accumulator)
+{
+    int i, tmp;
+    unsigned char * p = encoded;
+
+    /* clear out the encoded buffer */
+    memset(encoded, 0, ENCRYPTED_BLOCK_SIZE);
+
+    /* pad/encode the plaintext out to ENCRYPTED_BLOCK_SIZE */
+    *p = 0x15;
+    p++;
+    for(i = PLAINTEXT_BLOCK_SIZE - 1; i > 0; i--)
+    {
+        if(plaintext[i] < plaintext[i - 1])
+        {
+            tmp = (0x100 + plaintext[i]) - plaintext[i - 1];
+            *p = (unsigned char)(tmp & 0xFF);
+        }
+        else
+        {
+            *p = plaintext[i] - plaintext[i - 1];
+        }
+
+        p++;
+    }
+
+    /* calculate last byte */
+    if(plaintext[0] < accumulator)
+    {
+        tmp = (0x100 + plaintext[0]) - accumulator;
+        *p = (unsigned char)(tmp & 0xff);
+    }
+    else
+    {
+        (*p) = plaintext[0] - accumulator;
+    }
+}
+
+
+/* This function looks an encoded block up in the context's block cache.  A
+ * hit is only taken after decrypting it again with the public key gives
+ * back the encoded block, which is cheap with e = 3, so a damaged cache
+ * file can cost time but never a wrong block. */
+static int cache_hit(lynx_ctx_t * ctx,
+                     unsigned char * encrypted,
+                     const unsigned char * encoded)
+{
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+    unsigned char check[ENCRYPTED_BLOCK_SIZE];
+    lynx_limbs_t x;
+
+    if(!ctx->cache || !lynx_cache_lookup(ctx->cache, ctx->cache_key, encoded, buf))
+        return 0;
+
+    /* the cached block is in frame order, least significant byte first */
+    lynx_mont_load_le(x, buf, ENCRYPTED_BLOCK_SIZE);
+    if(ctx->public_cube)
+        lynx_mont_cube(&ctx->mont, x, x);
+    else
+        lynx_mont_exp(&ctx->mont, x, x, ctx->public_key, LYNX_RSA_KEY_SIZE);
+    lynx_mont_store_be(check, x, ENCRYPTED_BLOCK_SIZE);
+    if(memcmp(check, encoded, ENCRYPTED_BLOCK_SIZE) != 0)
+        return 0;
+
+    memcpy(encrypted, buf, ENCRYPTED_BLOCK_SIZE);
+    lynx_stats_count(ctx->stats, LYNX_COUNT_CACHE_HITS, 1);
+    return 1;
+}
+
+
+/* This function does the RSA step on an encoded block and stores it
+ * reversed, the way it goes into the encrypted frame. */
+void lynx_encrypt_encoded(lynx_ctx_t * ctx,
+                          unsigned char * encrypted,
+                          const unsigned char * encoded)
+{
+    int i;
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+    lynx_limbs_t x;
+    lynx_timer_t timer;
+
+    if(cache_hit(ctx, encrypted, encoded))
+        return;
+
+    lynx_stats_start(ctx->stats, &timer);
+    if(ctx->engine == LYNX_ENGINE_MONT64)
+    {
+        /* do the RSA step straight on the limbs */
+        lynx_mont_load_be(x, encoded, ENCRYPTED_BLOCK_SIZE);
+        if(ctx->private_chain)
+            lynx_chain_private_exp(&ctx->mont, x, x);
+        else
+            lynx_mont_exp(&ctx->mont, x, x, ctx->private_key, LYNX_RSA_KEY_SIZE);
+        lynx_mont_store_be(buf, x, ENCRYPTED_BLOCK_SIZE);
+    }
+    else
+    {
+        /* load the encoded plaintext into the context's scratch bignum */
+        BN_bin2bn(encoded, ENCRYPTED_BLOCK_SIZE, ctx->block);
+
+        /* do the RSA step */
+        sign_block(ctx, ctx->result, ctx->block);
+
+        /* get the encrypted data out, right aligned in the buffer */
+        BN_bn2binpad(ctx->result, buf, ENCRYPTED_BLOCK_SIZE);
+    }
+    lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_MODEXP);
+    lynx_stats_count(ctx->stats, LYNX_COUNT_BLOCKS, 1);
+    lynx_stats_count(ctx->stats, LYNX_COUNT_MULMODS,
+                     (ctx->engine == LYNX_ENGINE_MONT64) ? ctx->private_mulmods.mont :
+                     (ctx->crt > 0) ? ctx->private_mulmods.crt : ctx->private_mulmods.bn);
+
+    if(ctx->verbose)
+    {
+        printf("enc:\n");
+        lynx_print_data(buf, 51);
+    }
+
+    /* reverse the data as we copy it into the encrypted frame */
+    lynx_stats_start(ctx->stats, &timer);
+    for(i = 0; i < ENCRYPTED_BLOCK_SIZE; i++)
+    {
+        encrypted[i] = buf[(ENCRYPTED_BLOCK_SIZE - 1) - i];
+    }
+    lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_REVERSE);
+
+    if(ctx->cache)
+        lynx_cache_store(ctx->cache, ctx->cache_key, encoded, encrypted);
+}
+
+
+/* This does the RSA steps of lynx_encrypt_jobs.  The blocks go through the
+ * multi-buffer engine when the CPU has SIMD lanes for it, with the CRT key
+ * when there is one: each block is split into its halves mod p and mod q
+ * here, both halves go through the lanes and the halves are put back
+ * together again one block at a time. */
+static void encrypt_jobs(lynx_ctx_t * ctx,
+                         lynx_block_job_t * jobs,
+                         const int count)
+{
+    int i, j, n;
+    BIGNUM *m1, *m2;
+    BN_CTX * bn = ctx->bn_ctx;
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+    unsigned char half_p[MAX_BATCH_BLOCKS][ENCRYPTED_BLOCK_SIZE];
+    unsigned char half_q[MAX_BATCH_BLOCKS][ENCRYPTED_BLOCK_SIZE];
+    unsigned char * p[MAX_BATCH_BLOCKS];
+    unsigned char * q[MAX_BATCH_BLOCKS];
+    lynx_timer_t timer;
+
+    /* without lanes the scalar engines are faster, and they do their own
+     * cache lookups */
+    if(lynx_mb_lanes() == 1)
+    {
+        for(i = 0; i < count; i++)
+        {
+            LYNX_PROBE4(encrypt_block_start, ctx, jobs[i].frame, jobs[i].block, ENCRYPTED_BLOCK_SIZE);
+            lynx_encrypt_encoded(ctx, jobs[i].encrypted, jobs[i].encoded);
+            LYNX_PROBE4(encrypt_block_done, ctx, jobs[i].frame, jobs[i].block, ENCRYPTED_BLOCK_SIZE);
+        }
+        return;
+    }
+
+    if(ctx->crt == 0)
+        ctx->crt = factor_modulus(ctx) ? 1 : -1;
+
+    for(i = 0; i < MAX_BATCH_BLOCKS; i++)
+    {
+        p[i] = half_p[i];
+        q[i] = half_q[i];
+    }
+
+    BN_CTX_start(bn);
+    m1 = BN_CTX_get(bn);
+    m2 = BN_CTX_get(bn);
+
+    for(i = 0; i < count; i += n)
+    {
+        n = min(MAX_BATCH_BLOCKS, count - i);
+
+        /* the blocks in the lanes all start and finish together */
+        for(j = 0; j < n; j++)
+        {
+            LYNX_PROBE4(encrypt_block_start, ctx, jobs[i + j].frame, jobs[i + j].block, ENCRYPTED_BLOCK_SIZE);
+        }
+
+        /* the results come out little endian, already in frame order, so
+         * there is no reversal stage */
+        lynx_stats_start(ctx->stats, &timer);
+        if(ctx->crt < 0)
+        {
+            /* the whole exponent, the results are already in the frame's
+             * little endian order */
+            for(j = 0; j < n; j++)
+            {
+                BN_bin2bn(jobs[i + j].encoded, ENCRYPTED_BLOCK_SIZE, ctx->block);
+                BN_bn2lebinpad(ctx->block, p[j], ENCRYPTED_BLOCK_SIZE);
+            }
+            lynx_mb_exp(&ctx->mb, p, p, n, ENCRYPTED_BLOCK_SIZE,
+                        ctx->private_key, LYNX_RSA_KEY_SIZE);
+        }
+        else
+        {
+            for(j = 0; j < n; j++)
+            {
+                BN_bin2bn(jobs[i + j].encoded, ENCRYPTED_BLOCK_SIZE, ctx->block);
+                BN_mod(m1, ctx->block, ctx->p, bn);
+                BN_mod(m2, ctx->block, ctx->q, bn);
+                BN_bn2lebinpad(m1, p[j], ENCRYPTED_BLOCK_SIZE);
+                BN_bn2lebinpad(m2, q[j], ENCRYPTED_BLOCK_SIZE);
+            }
+
+            /* the keys.h key has its halves unrolled */
+            if(ctx->crt_chain)
+            {
+                lynx_mb_exp_chain(&ctx->mb_p, p, p, n, ENCRYPTED_BLOCK_SIZE, LYNX_CHAIN_DP);
+                lynx_mb_exp_chain(&ctx->mb_q, q, q, n, ENCRYPTED_BLOCK_SIZE, LYNX_CHAIN_DQ);
+            }
+            else
+            {
+                lynx_mb_exp(&ctx->mb_p, p, p, n, ENCRYPTED_BLOCK_SIZE, ctx->dp_key, ctx->dp_len);
+                lynx_mb_exp(&ctx->mb_q, q, q, n, ENCRYPTED_BLOCK_SIZE, ctx->dq_key, ctx->dq_len);
+            }
+
+            for(j = 0; j < n; j++)
+            {
+                BN_lebin2bn(p[j], ENCRYPTED_BLOCK_SIZE, m1);
+                BN_lebin2bn(q[j], ENCRYPTED_BLOCK_SIZE, m2);
+                crt_combine(ctx, ctx->result, m1, m2);
+                BN_bn2lebinpad(ctx->result, p[j], ENCRYPTED_BLOCK_SIZE);
+            }
+        }
+        lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_MODEXP);
+        lynx_stats_count(ctx->stats, LYNX_COUNT_BLOCKS, n);
+        lynx_stats_count(ctx->stats, LYNX_COUNT_MULMODS,
+                         n * ((ctx->crt < 0) ? ctx->private_mulmods.mb : ctx->private_mulmods.mb_crt));
+
+        for(j = 0; j < n; j++)
+        {
+            memcpy(jobs[i + j].encrypted, p[j], ENCRYPTED_BLOCK_SIZE);
+            LYNX_PROBE4(encrypt_block_done, ctx, jobs[i + j].frame, jobs[i + j].block, ENCRYPTED_BLOCK_SIZE);
+
+            if(ctx->verbose)
+            {
+                BN_lebin2bn(p[j], ENCRYPTED_BLOCK_SIZE, ctx->result);
+                BN_bn2binpad(ctx->result, buf, ENCRYPTED_BLOCK_SIZE);
+                printf("enc:\n");
+                lynx_print_data(buf, 51);
+            }
+        }
+    }
+
+    BN_CTX_end(bn);
+}
+
+
+/* This function does the RSA steps for a batch of encoded blocks, the same
+ * as calling lynx_encrypt_encoded on each job.  With a block cache only the
+ * blocks that aren't in it are run through the lanes, together. */
+void lynx_encrypt_jobs(lynx_ctx_t * ctx,
+                       lynx_block_job_t * jobs,
+                       const int count)
+{
+    int i, j, n = 0;
+    lynx_block_job_t misses[MAX_BATCH_BLOCKS];
+
+    LYNX_PROBE3(encrypt_jobs_start, ctx, jobs, count);
+
+    if(!ctx->cache || (lynx_mb_lanes() == 1))
+    {
+        encrypt_jobs(ctx, jobs, count);
+        LYNX_PROBE3(encrypt_jobs_done, ctx, jobs, count);
+        return;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(!cache_hit(ctx, jobs[i].encrypted, jobs[i].encoded))
+            misses[n++] = jobs[i];
+
+        if((n == MAX_BATCH_BLOCKS) || ((i == count - 1) && (n > 0)))
+        {
+            encrypt_jobs(ctx, misses, n);
+            for(j = 0; j < n; j++)
+            {
+                lynx_cache_store(ctx->cache, ctx->cache_key, misses[j].encoded, misses[j].encrypted);
+            }
+            n = 0;
+        }
+    }
+
+    LYNX_PROBE3(encrypt_jobs_done, ctx, jobs, count);
+}
+
+
+/* This function pads and encrypts a single block of plaintext.  frame and
+ * block say where it is in the image, they are only for the tracepoints. */
+static void encrypt_block(lynx_ctx_t * ctx,
+                          unsigned char * encrypted,
+                          const unsigned char * plaintext,
+                          const int accumulator,
+                          const int frame,
+                          const int block)
+{
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+    lynx_timer_t timer;
+
+    LYNX_PROBE4(encrypt_block_start, ctx, frame, block, ENCRYPTED_BLOCK_SIZE);
+
+    lynx_stats_start(ctx->stats, &timer);
+    lynx_encode_block(buf, plaintext, accumulator);
+    lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_CODEC);
+
+    if(ctx->verbose)
+    {
+        printf("buf:\n");
+        lynx_print_data(buf, 51);
+    }
+
+    lynx_encrypt_encoded(ctx, encrypted, buf);
+
+    LYNX_PROBE4(encrypt_block_done, ctx, frame, block, ENCRYPTED_BLOCK_SIZE);
+}
+
+
+/* This function pads and encrypts a single block of plaintext */
+void lynx_encrypt_block(lynx_ctx_t * ctx,
+                        unsigned char * encrypted,
+                        const unsigned char * plaintext,
+                        const int accumulator)
+{
+    encrypt_block(ctx, encrypted, plaintext, accumulator, -1, -1);
+}
+
+
+/* This function raises the block to the 3rd power with one square and one
+ * multiply instead of a generic exponentiation.  Once the block is in the
+ * Montgomery domain (xR), multiplying it by the plain block gives x*x and
+ * multiplying that by xR again gives x*x*x, already out of the domain. */
+static void cube_block(lynx_ctx_t * ctx, BIGNUM * result, BIGNUM * block)
+{
+    BIGNUM * xr;
+
+    BN_CTX_start(ctx->bn_ctx);
+    xr = BN_CTX_get(ctx->bn_ctx);
+
+    /* the Montgomery multiply wants operands below the modulus */
+    if(BN_ucmp(block, ctx->modulus) >= 0)
+        BN_nnmod(block, block, ctx->modulus, ctx->bn_ctx);
+
+    BN_to_montgomery(xr, block, ctx->mont_ctx, ctx->bn_ctx);
+    BN_mod_mul_montgomery(result, xr, block, ctx->mont_ctx, ctx->bn_ctx);
+    BN_mod_mul_montgomery(result, result, xr, ctx->mont_ctx, ctx->bn_ctx);
+
+    BN_CTX_end(ctx->bn_ctx);
+}
+
+
+/* This function un-obfuscates/un-pads a decrypted block.  The decrypted
+ * block is least significant byte first, the way it was encrypted.
+ *
+ * NOTE: we only take 50 bytes of output, not 51, the most significant byte
+ * (index 50 here) is carry cruft. */
+static int decode_block(unsigned char * plaintext,
+                        const unsigned char * decrypted,
+                        const int accumulator)
+{
+    int i;
+    int acc = accumulator;
+
+    for(i = 0; i < PLAINTEXT_BLOCK_SIZE; i++)
+    {
+        acc += decrypted[i];
+        acc &= 0xFF;
+        plaintext[i] = (unsigned char)(acc);
+    }
+
+    return acc;
+}
+
+
+/* This function does the public RSA step on a block as it is stored in the
+ * frame.  The result is least significant byte first, like the block. */
+static void public_step(lynx_ctx_t * ctx,
+                        unsigned char * buf,
+                        const unsigned char * encrypted)
+{
+    lynx_limbs_t x;
+    lynx_timer_t timer;
+
+    lynx_stats_start(ctx->stats, &timer);
+    if(ctx->engine == LYNX_ENGINE_MONT64)
+    {
+        /* the block is least significant byte first, which is exactly the
+         * limb order, so no reversed copy is needed */
+        lynx_mont_load_le(x, encrypted, ENCRYPTED_BLOCK_SIZE);
+        if(ctx->public_cube)
+            lynx_mont_cube(&ctx->mont, x, x);
+        else
+            lynx_mont_exp(&ctx->mont, x, x, ctx->public_key, LYNX_RSA_KEY_SIZE);
+        lynx_mont_store_le(buf, x, ENCRYPTED_BLOCK_SIZE);
+    }
+    else
+    {
+        /* the block is least significant byte first, so load it as a
+         * little endian number instead of making a reversed copy */
+        BN_lebin2bn(encrypted, ENCRYPTED_BLOCK_SIZE, ctx->block);
+
+        /* do the RSA step */
+        if(ctx->public_cube)
+            cube_block(ctx, ctx->result, ctx->block);
+        else
+            BN_mod_exp_mont(ctx->result, ctx->block, ctx->public_exp,
+                            ctx->modulus, ctx->bn_ctx, ctx->mont_ctx);
+
+        BN_bn2lebinpad(ctx->result, buf, ENCRYPTED_BLOCK_SIZE);
+    }
+    lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_MODEXP);
+    lynx_stats_count(ctx->stats, LYNX_COUNT_BLOCKS, 1);
+    lynx_stats_count(ctx->stats, LYNX_COUNT_MULMODS,
+                     (ctx->engine == LYNX_ENGINE_MONT64) ? ctx->public_mulmods.mont : ctx->public_mulmods.bn);
+}
+
+
+/* This function undoes lynx_encrypt_encoded, leaving the block encoded and
+ * big endian, so the 0x15 the ROM looks for is encoded[0]. */
+void lynx_decrypt_encoded(lynx_ctx_t * ctx,
+                          unsigned char * encoded,
+                          const unsigned char * encrypted)
+{
+    int i;
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+
+    public_step(ctx, buf, encrypted);
+
+    for(i = 0; i < ENCRYPTED_BLOCK_SIZE; i++)
+    {
+        encoded[i] = buf[(ENCRYPTED_BLOCK_SIZE - 1) - i];
+    }
+}
+
+
+/* This function decrypts and decodes a single block of encrypted data.
+ * frame and block are only for the tracepoints. */
+static int decrypt_block(lynx_ctx_t * ctx,
+                         unsigned char * plaintext,
+                         const unsigned char * encrypted,
+                         const int accumulator,
+                         const int frame,
+                         const int block)
+{
+    int acc;
+    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
+    lynx_timer_t timer;
+
+    LYNX_PROBE4(decrypt_block_start, ctx, frame, block, ENCRYPTED_BLOCK_SIZE);
+
+    public_step(ctx, buf, encrypted);
+
+    lynx_stats_start(ctx->stats, &timer);
+    acc = decode_block(plaintext, buf, accumulator);
+    lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_CODEC);
+
+    LYNX_PROBE4(decrypt_block_done, ctx, frame, block, ENCRYPTED_BLOCK_SIZE);
+
+    return acc;
+}
+
+
+/* This function decrypts and decodes a single block of encrypted data. */
+int lynx_decrypt_block(lynx_ctx_t * ctx,
+                       unsigned char * plaintext,
+                       const unsigned char * encrypted,
+                       const int accumulator)
+{
+    return decrypt_block(ctx, plaintext, encrypted, accumulator, -1, -1);
+}
+
+
+/* This function encodes and encrypts a frame of plaintext data.  The
+ * plaintext must hold blocks * PLAINTEXT_BLOCK_SIZE bytes and the encrypted
+ * buffer receives blocks * ENCRYPTED_BLOCK_SIZE bytes.  index is the
+ * frame's place in the image, it is only for the tracepoints. */
+int lynx_encrypt_frame(lynx_ctx_t * ctx,
+                       unsigned char * encrypted,
+                       const unsigned char * plaintext,
+                       const int blocks,
+                       const int index)
+{
+    int i;
+    int accumulator;
+
+    LYNX_PROBE4(encrypt_frame_start, ctx, index, blocks, ENCRYPTED_FRAME_SIZE(blocks));
+
+    /* pad and encrypt the blocks in the frame */
+    for(i = blocks - 1; i >= 0; i--)
+    {
+        if(i > 0)
+            accumulator = plaintext[(i * PLAINTEXT_BLOCK_SIZE) - 1];
+        else
+            accumulator = 0;
+
+        /* encrypt the block */
+        encrypt_block(ctx,
+                      &encrypted[i * ENCRYPTED_BLOCK_SIZE],
+                      &plaintext[i * PLAINTEXT_BLOCK_SIZE],
+                      accumulator, index, i);
+    }
+
+    LYNX_PROBE4(encrypt_frame_done, ctx, index, blocks, ENCRYPTED_FRAME_SIZE(blocks));
+
+    return blocks;
+}
+
+
+/* This function decrypts an entire frame of encrypted data.  index is only
+ * for the tracepoints. */
+int lynx_decrypt_frame(lynx_ctx_t * ctx,
+                       unsigned char * plaintext,
+                       const unsigned char * encrypted,
+                       const int blocks,
+                       const int index)
+{
+    int i;
+    int accumulator = 0;
+
+    LYNX_PROBE4(decrypt_frame_start, ctx, index, blocks, ENCRYPTED_FRAME_SIZE(blocks));
+
+    /* decrypt the blocks in the frame */
+    for(i = 0; i < blocks; i++)
+    {
+        accumulator = decrypt_block(ctx,
+                                    &plaintext[i * PLAINTEXT_BLOCK_SIZE],
+                                    &encrypted[i * ENCRYPTED_BLOCK_SIZE],
+                                    accumulator, index, i);
+    }
+
+    LYNX_PROBE4(decrypt_frame_done, ctx, index, blocks, ENCRYPTED_FRAME_SIZE(blocks));
+
+    return blocks;
+}
+
+
+/* This function calculates the size of the encrypted image described by the
+ * frame definitions, or 0 if one of the frames is invalid. */
+size_t lynx_encrypted_size(const lynx_frame_def_t * frames,
+                           const int frame_count)
+{
+    int i;
+    size_t size = 0;
+
+    for(i = 0; i < frame_count; i++)
+    {
+        if((frames[i].blocks <= 0) || (frames[i].blocks > MAX_BLOCKS_PER_FRAME))
+            return 0;
+
+        size += 1 + ENCRYPTED_FRAME_SIZE(frames[i].blocks);
+    }
+
+    return size;
+}
+
+
+/* This function encrypts all of the frames described by the frame definitions
+ * into a complete encrypted loader.  The frames are encoded a few at a time
+ * and their blocks encrypted as one batch.  It returns the number of bytes
+ * written to the encrypted buffer, or 0 on failure. */
+size_t lynx_encrypt_image(lynx_ctx_t * ctx,
+                          unsigned char * encrypted,
+                          const size_t encrypted_size,
+                          const unsigned char * plaintext,
+                          const size_t plaintext_size,
+                          const lynx_frame_def_t * frames,
+                          const int frame_count)
+{
+    int i, j, n, k;
+    size_t size = lynx_encrypted_size(frames, frame_count);
+    unsigned char * e = encrypted;
+    lynx_block_job_t jobs[MAX_BATCH_BLOCKS];
+    lynx_timer_t timer;
+
+    if((size == 0) || (size > encrypted_size))
+        return 0;
+
+    LYNX_PROBE3(encrypt_image_start, ctx, frame_count, size);
+
+    for(i = 0; i < frame_count; i += k)
+    {
+        k = min(MAX_BATCH_BLOCKS / MAX_BLOCKS_PER_FRAME, frame_count - i);
+
+        for(j = 0; j < k; j++)
+        {
+            LYNX_PROBE4(encrypt_frame_start, ctx, i + j, frames[i + j].blocks, ENCRYPTED_FRAME_SIZE(frames[i + j].blocks));
+        }
+
+        lynx_stats_start(ctx->stats, &timer);
+        n = lynx_encode_image(jobs, e, size - (e - encrypted),
+                              plaintext, plaintext_size, &frames[i], k);
+        lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_CODEC);
+        if(n == 0)
+            return 0;
+
+        /* the jobs count their frames from the start of this batch */
+        for(j = 0; j < n; j++)
+        {
+            jobs[j].frame += i;
+        }
+
+        lynx_encrypt_jobs(ctx, jobs, n);
+        e += lynx_encrypted_size(&frames[i], k);
+
+        for(j = 0; j < k; j++)
+        {
+            LYNX_PROBE4(encrypt_frame_done, ctx, i + j, frames[i + j].blocks, ENCRYPTED_FRAME_SIZE(frames[i + j].blocks));
+        }
+    }
+
+    LYNX_PROBE3(encrypt_image_done, ctx, frame_count, size);
+
+    return size;
+}
+
+
+/* This function does everything lynx_encrypt_image does except the RSA
+ * steps.  The block count bytes are written to the encrypted buffer and each
+ * block is encoded into a job that records where its encrypted form goes, so
+ * the RSA steps can be run later in any order (or on any thread) with
+ * lynx_encrypt_encoded.  The jobs array must have room for
+ * frame_count * MAX_BLOCKS_PER_FRAME jobs.  It returns the number of jobs,
+ * or 0 on failure. */
+int lynx_encode_image(lynx_block_job_t * jobs,
+                      unsigned char * encrypted,
+                      const size_t encrypted_size,
+                      const unsigned char * plaintext,
+                      const size_t plaintext_size,
+                      const lynx_frame_def_t * frames,
+                      const int frame_count)
+{
+    int i, j;
+    int count = 0;
+    int accumulator;
+    size_t len;
+    size_t size = lynx_encrypted_size(frames, frame_count);
+    unsigned char * e = encrypted;
+    const unsigned char * frame;
+    unsigned char pad[MAX_PLAINTEXT_FRAME_SIZE];
+
+    if((size == 0) || (size > encrypted_size))
+        return 0;
+
+    LYNX_PROBE3(encode_image_start, jobs, frame_count, size);
+
+    for(i = 0; i < frame_count; i++)
+    {
+        if((frames[i].offset < 0) || ((size_t)frames[i].offset >= plaintext_size))
+            return 0;
+
+        /* the blocks are encoded straight from the plaintext, only a frame
+         * that runs off the end is copied out and padded with 0 */
+        len = plaintext_size - frames[i].offset;
+        if(len >= PLAINTEXT_FRAME_SIZE(frames[i].blocks))
+            frame = &plaintext[frames[i].offset];
+        else
+        {
+            memset(pad, 0, MAX_PLAINTEXT_FRAME_SIZE);
+            memcpy(pad, &plaintext[frames[i].offset], len);
+            frame = pad;
+        }
+
+        /* write the encrypted frame block count */
+        *e = (unsigned char)(256 - frames[i].blocks);
+        e++;
+
+        /* encode the blocks in the same order as lynx_encrypt_frame */
+        for(j = frames[i].blocks - 1; j >= 0; j--)
+        {
+            if(j > 0)
+                accumulator = frame[(j * PLAINTEXT_BLOCK_SIZE) - 1];
+            else
+                accumulator = 0;
+
+            lynx_encode_block(jobs[count].encoded,
+                              &frame[j * PLAINTEXT_BLOCK_SIZE],
+                              accumulator);
+            jobs[count].encrypted = &e[j * ENCRYPTED_BLOCK_SIZE];
+            jobs[count].frame = i;
+            jobs[count].block = j;
+            count++;
+        }
+        e += ENCRYPTED_FRAME_SIZE(frames[i].blocks);
+    }
+
+    LYNX_PROBE3(encode_image_done, jobs, frame_count, count);
+
+    return count;
+}
+
+
+/* This function decrypts a complete encrypted loader.  Each frame is written
+ * out as MAX_PLAINTEXT_FRAME_SIZE bytes of plaintext.  Only the decoding
+ * depends on the other blocks in a frame, so the RSA steps for a run of
+ * whole frames are done first as one batch and then the frames are decoded.
+ * It returns the number of bytes written to the plaintext buffer, or 0 on
+ * failure. */
+size_t lynx_decrypt_image(lynx_ctx_t * ctx,
+                          unsigned char * plaintext,
+                          const size_t plaintext_size,
+                          const unsigned char * encrypted,
+                          const size_t encrypted_size)
+{
+    int i, j, n, frames;
+    int first = 0;
+    int accumulator;
+    int blocks[MAX_BATCH_BLOCKS];
+    size_t in = 0;
+    size_t out = 0;
+    unsigned char decrypted[MAX_BATCH_BLOCKS][ENCRYPTED_BLOCK_SIZE];
+    unsigned char * a[MAX_BATCH_BLOCKS];
+    unsigned char * r[MAX_BATCH_BLOCKS];
+    lynx_timer_t timer;
+
+    for(i = 0; i < MAX_BATCH_BLOCKS; i++)
+    {
+        r[i] = decrypted[i];
+    }
+
+    LYNX_PROBE3(decrypt_image_start, ctx, encrypted_size, plaintext_size);
+
+    while(in < encrypted_size)
+    {
+        /* gather up whole frames while there is room in the batch */
+        n = 0;
+        for(frames = 0; (in < encrypted_size) && (n + MAX_BLOCKS_PER_FRAME <= MAX_BATCH_BLOCKS); frames++)
+        {
+            /* decode the block count */
+            blocks[frames] = 256 - encrypted[in];
+            in++;
+
+            if((blocks[frames] > MAX_BLOCKS_PER_FRAME) ||
+               ((encrypted_size - in) < ENCRYPTED_FRAME_SIZE(blocks[frames])) ||
+               ((plaintext_size - out) / MAX_PLAINTEXT_FRAME_SIZE <= (size_t)frames))
+                return 0;
+
+            LYNX_PROBE4(decrypt_frame_start, ctx, first + frames, blocks[frames], ENCRYPTED_FRAME_SIZE(blocks[frames]));
+            for(j = 0; j < blocks[frames]; j++)
+            {
+                LYNX_PROBE4(decrypt_block_start, ctx, first + frames, j, ENCRYPTED_BLOCK_SIZE);
+                a[n++] = (unsigned char *)&encrypted[in + (j * ENCRYPTED_BLOCK_SIZE)];
+            }
+            in += ENCRYPTED_FRAME_SIZE(blocks[frames]);
+        }
+
+        /* do the RSA steps */
+        lynx_stats_start(ctx->stats, &timer);
+        if(ctx->public_cube)
+            lynx_mb_cube(&ctx->mb, r, a, n, ENCRYPTED_BLOCK_SIZE);
+        else
+            lynx_mb_exp(&ctx->mb, r, a, n, ENCRYPTED_BLOCK_SIZE,
+                        ctx->public_key, LYNX_RSA_KEY_SIZE);
+        lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_MODEXP);
+        lynx_stats_count(ctx->stats, LYNX_COUNT_BLOCKS, n);
+        lynx_stats_count(ctx->stats, LYNX_COUNT_MULMODS, n * ctx->public_mulmods.mb);
+
+        /* and decode the frames */
+        lynx_stats_start(ctx->stats, &timer);
+        n = 0;
+        for(i = 0; i < frames; i++)
+        {
+            memset(&plaintext[out], 0, MAX_PLAINTEXT_FRAME_SIZE);
+            accumulator = 0;
+            for(j = 0; j < blocks[i]; j++)
+            {
+                accumulator = decode_block(&plaintext[out + (j * PLAINTEXT_BLOCK_SIZE)],
+                                           r[n++], accumulator);
+                LYNX_PROBE4(decrypt_block_done, ctx, first + i, j, ENCRYPTED_BLOCK_SIZE);
+            }
+            LYNX_PROBE4(decrypt_frame_done, ctx, first + i, blocks[i], ENCRYPTED_FRAME_SIZE(blocks[i]));
+            out += MAX_PLAINTEXT_FRAME_SIZE;
+        }
+        lynx_stats_stop(ctx->stats, &timer, LYNX_STAGE_CODEC);
+        first += frames;
+    }
+
+    LYNX_PROBE3(decrypt_image_done, ctx, encrypted_size, out);
+
+    return out;
+}
+
+
+/* This function reads one "offset, blocks" line from a loader config file */
+int lynx_read_frame_config(FILE * cfg, lynx_frame_def_t * frame, int line)
+{
+    long offset = 0;
+    int blocks = 0;
+    int state = 0;
+    int started = 0;
+    char c;
+
+    while(fread(&c, 1, 1, cfg) == 1)
+    {
+        switch(state)
+        {
+            case 0:
+            {
+                /* we're reading the offset */
+                if(isdigit(c))
+                {
+                    if(!started)
+                        started = 1;
+
+                    offset *= 10;
+                    offset += (c - '0');
+                }
+                else if(c == '\n')
+                {
+                    if(started)
+                    {
+                        /* error, looking for a comma */
+                        fprintf(stderr,
+                            "syntax error: expecting ',' after offset on line %d\n", line);
+                    }
+                    return 0;
+                }
+                else if(c == ',')
+                {
+                    /* switch to blocks state */
+                    started = 0;
+                    state = 1;
+                }
+                else
+                {
+                    fprintf(stderr,
+                            "syntax error: expecting offset number on line %d\n", line);
+                    return 0;
+                }
+                break;
+            }
+            case 1:
+            {
+                /* we're reading the blocks number */
+                if((c == ' ') || (c == '\t'))
+                {
+                    /* eat whitespace */
+                }
+                else if(isdigit(c))
+                {
+                    blocks *= 10;
+                    blocks += (c - '0');
+                }
+                else if(c == '\n')
+                {
+                    frame->offset = offset;
+                    frame->blocks = blocks;
+                    return 1;
+                }
+                else
+                {
+                    fprintf(stderr,
+                            "syntax error: expecting block number on line %d\n", line);
+                    return 0;
+                }
+                break;
+            }
+        }
+    }
+
+    fprintf(stderr,
+            "syntax error: reached EOF with incomplete frame definition, line %d\n", line);
+    return 0;
+}
+
+
+/* This function reads all of the frame definitions from a loader config
+ * file.  The caller owns the returned array. */
+int lynx_read_config_file(FILE * cfg, lynx_frame_def_t ** frames)
+{
+    int line = 1;
+    int frame_count = 0;
+    lynx_frame_def_t frame_def;
+
+    memset(&frame_def, 0, sizeof(lynx_frame_def_t));
+
+    while(lynx_read_frame_config(cfg, &frame_def, line))
+    {
+        /* make room for this new frame */
+        (*frames) = realloc((*frames), (frame_count + 1) * sizeof(lynx_frame_def_t));
+
+        /* copy the new frame into place */
+        memcpy(&((*frames)[frame_count]), &frame_def, sizeof(lynx_frame_def_t));
+
+        /* increment the line number */
+        line++;
+
+        /* increment the total frame count */
+        frame_count++;
+    }
+
+    return frame_count;
+}
+
+
+/* This function works out the smallest frame layout for a plaintext loader,
+ * the one lynxenc --plan writes out as a config file.  The caller owns the
+ * returned array.
+ *
+ * Each frame decrypts into its own 256 byte page, so frame i has to start at
+ * offset 256 * i and the frames can't skip a page.  A frame needs enough
+ * blocks to cover the last non-zero byte of its page, plus one more byte,
+ * because the ROM checks that the accumulator ends a frame at 0 and the
+ * accumulator is the last plaintext byte.  Trailing pages of zero padding
+ * get no frame at all, a zero page before the end still gets one block.
+ *
+ * Fewer blocks is both a smaller image and less for the ROM to decrypt at
+ * boot, so the fewest blocks that cover the data is the best layout there
+ * is.  It returns 0 if a page has data too close to its end to fit. */
+int lynx_plan_frames(const unsigned char * plaintext,
+                     const size_t size,
+                     lynx_frame_def_t ** frames)
+{
+    int frame_count;
+    int i;
+    size_t j, page, used, last = 0;
+
+    /* the last page with any data in it */
+    for(j = 0; j < size; j++)
+    {
+        if(plaintext[j] != 0)
+            last = j + 1;
+    }
+    frame_count = (int)((last + (MAX_PLAINTEXT_FRAME_SIZE - 1)) / MAX_PLAINTEXT_FRAME_SIZE);
+    if(frame_count == 0)
+    {
+        fprintf(stderr, "the plaintext loader is all zeros, there is nothing to encrypt\n");
+        return 0;
+    }
+
+    (*frames) = calloc(frame_count, sizeof(lynx_frame_def_t));
+    if(!(*frames))
+        return 0;
+
+    for(i = 0; i < frame_count; i++)
+    {
+        page = (size_t)i * MAX_PLAINTEXT_FRAME_SIZE;
+
+        /* how much of this page is used, up to its last non-zero byte */
+        used = 0;
+        for(j = 0; (j < MAX_PLAINTEXT_FRAME_SIZE) && (page + j < size); j++)
+        {
+            if(plaintext[page + j] != 0)
+                used = j + 1;
+        }
+
+        /* room for a zero after the data, and at least one block */
+        (*frames)[i].offset = (long)page;
+        (*frames)[i].blocks = (int)((used + PLAINTEXT_BLOCK_SIZE) / PLAINTEXT_BLOCK_SIZE);
+        if((*frames)[i].blocks > MAX_BLOCKS_PER_FRAME)
+        {
+            fprintf(stderr, "frame %d: data at offset 0x%lx, only the first %d bytes of a page fit in a frame\n",
+                    i, (unsigned long)(page + used - 1),
+                    (MAX_BLOCKS_PER_FRAME * PLAINTEXT_BLOCK_SIZE) - 1);
+            free(*frames);
+            (*frames) = 0;
+            return 0;
+        }
+    }
+
+    return frame_count;
+}
+
+
+/* This function writes frame definitions out as a loader config file, with
+ * the blank line at the end that lynx_read_frame_config expects */
+int lynx_write_config_file(FILE * cfg,
+                           const lynx_frame_def_t * frames,
+                           const int frame_count)
+{
+    int i;
+
+    for(i = 0; i < frame_count; i++)
+    {
+        if(fprintf(cfg, "%ld, %d\n", frames[i].offset, frames[i].blocks) < 0)
+            return 0;
+    }
+
+    if(fprintf(cfg, "\n") < 0)
+        return 0;
+
+    return 1;
+}
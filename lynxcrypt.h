@@ -0,0 +1,267 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is the shared core of lynxenc, lynxdec and lynxverify.  Everything
+ * works on caller provided buffers and all of the state lives in either a
+ * lynx_ctx_t (for the RSA steps) or a lynx_rom_t (for the ROM-faithful
+ * verifier), so any number of them can be used at the same time.  A single
+ * context must not be shared between threads; create one per thread.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXCRYPT_H_
+#define _LYNXCRYPT_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include "sizes.h"
+#include "lynxstats.h"
+#include "lynxcache.h"
+
+/* the key material from keys.h, defined once inside the library */
+extern const unsigned char lynx_public_mod[LYNX_RSA_KEY_SIZE];
+extern const unsigned char lynx_public_exp[LYNX_RSA_KEY_SIZE];
+extern const unsigned char lynx_private_exp[LYNX_RSA_KEY_SIZE];
+
+/* one line of a loader config file: encrypt 'blocks' blocks of plaintext
+ * starting at 'offset' in the plaintext binary */
+typedef struct lynx_frame_def_s
+{
+    long offset;
+    int blocks;
+} lynx_frame_def_t;
+
+/* one encoded block of an image and where its encrypted form goes.  frame
+ * and block are its place in the image, for the tracepoints. */
+typedef struct lynx_block_job_s
+{
+    unsigned char encoded[ENCRYPTED_BLOCK_SIZE];
+    unsigned char * encrypted;
+    int frame;
+    int block;
+} lynx_block_job_t;
+
+/* the per-key crypto state, opaque to the callers */
+typedef struct lynx_ctx_s lynx_ctx_t;
+
+/* how many times each of the ROM routines ran, for lynx_rom_cycles */
+typedef struct lynx_rom_cost_s
+{
+    unsigned long blocks;
+    unsigned long doubles;      /* B = 2*B, once per exponent bit */
+    unsigned long adds;         /* B = B + E */
+    unsigned long adjusts;      /* B - N worked out into scratch */
+    unsigned long copies;       /* adjusts that went through, B = B - N */
+} lynx_rom_cost_t;
+
+/* the ROM-faithful decryption state.  this mirrors the scratch memory the
+ * Lynx ROM uses at boot time.  the ROM routines add to cost but never clear
+ * it, so clear it first when the counts are wanted. */
+typedef struct lynx_rom_s
+{
+    unsigned char B[LYNX_RSA_KEY_SIZE];
+    unsigned char E[LYNX_RSA_KEY_SIZE];
+    unsigned char F[LYNX_RSA_KEY_SIZE];
+    int carry;
+    lynx_rom_cost_t cost;
+} lynx_rom_t;
+
+/* the Lynx 65SC02 runs at 16 MHz / 4 */
+#define LYNX_ROM_CPU_HZ             (4000000UL)
+
+/* everything lynx_mod_exp needs that only depends on the modulus, least
+ * significant byte first.  R = 256**m. */
+typedef struct lynx_mod_key_s
+{
+    unsigned char modulus[LYNX_RSA_KEY_SIZE];
+    unsigned char R[LYNX_RSA_KEY_SIZE];     /* R mod modulus */
+    unsigned char RR[LYNX_RSA_KEY_SIZE];    /* R**2 mod modulus */
+    unsigned char v;                        /* -1/modulus mod 256 */
+    int m;
+} lynx_mod_key_t;
+
+/* the batch calls keep every SIMD lane busy when they are given a multiple
+ * of this many blocks */
+#define LYNX_BATCH_BLOCKS           (8)
+
+/* the engines that can do the RSA step */
+#define LYNX_ENGINE_BN              (0)     /* OpenSSL BN_mod_exp */
+#define LYNX_ENGINE_MONT64          (1)     /* 64-bit limbs, lynxmont.c */
+
+/* error bits reported by the ROM-faithful verifier */
+#define LYNX_VERIFY_OK              (0x00)
+#define LYNX_VERIFY_ZERO_LEAD       (0x01)  /* first three bytes are 0 */
+#define LYNX_VERIFY_RANGE           (0x02)  /* t1 > t2 */
+#define LYNX_VERIFY_MARKER          (0x04)  /* B[0] != 0x15 */
+#define LYNX_VERIFY_ACCUMULATOR     (0x08)  /* Actr != 0 */
+#define LYNX_VERIFY_TRUNCATED       (0x10)  /* frame runs past the input */
+#define LYNX_VERIFY_COUNT           (0x20)  /* more than 5 blocks in a frame */
+
+
+/* context management */
+lynx_ctx_t * lynx_ctx_new(void);
+lynx_ctx_t * lynx_ctx_new_key(const unsigned char * private_exp,
+                              const unsigned char * public_exp,
+                              const unsigned char * public_mod);
+void lynx_ctx_free(lynx_ctx_t * ctx);
+void lynx_ctx_set_verbose(lynx_ctx_t * ctx, int verbose);
+int lynx_ctx_set_engine(lynx_ctx_t * ctx, int engine);
+void lynx_ctx_set_crt(lynx_ctx_t * ctx, int crt);
+void lynx_ctx_set_stats(lynx_ctx_t * ctx, lynx_stats_t * stats);
+
+/* look blocks up in a block cache before encrypting them, and add the ones
+ * that weren't there.  0 turns it off. */
+void lynx_ctx_set_cache(lynx_ctx_t * ctx, lynx_cache_t * cache);
+
+/* block level operations.  encrypting a block is encoding it and then doing
+ * the RSA step on the encoded block. */
+void lynx_encode_block(unsigned char * encoded,
+                       const unsigned char * plaintext,
+                       const int accumulator);
+void lynx_encrypt_encoded(lynx_ctx_t * ctx,
+                          unsigned char * encrypted,
+                          const unsigned char * encoded);
+void lynx_encrypt_block(lynx_ctx_t * ctx,
+                        unsigned char * encrypted,
+                        const unsigned char * plaintext,
+                        const int accumulator);
+int lynx_decrypt_block(lynx_ctx_t * ctx,
+                       unsigned char * plaintext,
+                       const unsigned char * encrypted,
+                       const int accumulator);
+void lynx_decrypt_encoded(lynx_ctx_t * ctx,
+                          unsigned char * encoded,
+                          const unsigned char * encrypted);
+
+/* batch operation.  this does the RSA steps for many encoded blocks at once,
+ * side by side in SIMD lanes when the CPU has them. */
+void lynx_encrypt_jobs(lynx_ctx_t * ctx,
+                       lynx_block_job_t * jobs,
+                       const int count);
+
+/* frame level operations, these work on the frame data without the block
+ * count byte.  index is the frame's place in the image, which only goes to
+ * the tracepoints. */
+int lynx_encrypt_frame(lynx_ctx_t * ctx,
+                       unsigned char * encrypted,
+                       const unsigned char * plaintext,
+                       const int blocks,
+                       const int index);
+int lynx_decrypt_frame(lynx_ctx_t * ctx,
+                       unsigned char * plaintext,
+                       const unsigned char * encrypted,
+                       const int blocks,
+                       const int index);
+
+/* image level operations */
+size_t lynx_encrypted_size(const lynx_frame_def_t * frames,
+                           const int frame_count);
+size_t lynx_encrypt_image(lynx_ctx_t * ctx,
+                          unsigned char * encrypted,
+                          const size_t encrypted_size,
+                          const unsigned char * plaintext,
+                          const size_t plaintext_size,
+                          const lynx_frame_def_t * frames,
+                          const int frame_count);
+int lynx_encode_image(lynx_block_job_t * jobs,
+                      unsigned char * encrypted,
+                      const size_t encrypted_size,
+                      const unsigned char * plaintext,
+                      const size_t plaintext_size,
+                      const lynx_frame_def_t * frames,
+                      const int frame_count);
+size_t lynx_decrypt_image(lynx_ctx_t * ctx,
+                          unsigned char * plaintext,
+                          const size_t plaintext_size,
+                          const unsigned char * encrypted,
+                          const size_t encrypted_size);
+
+/* ROM-faithful verification.  lynx_check_block is only the cheap checks
+ * convert_it makes on a block before it decrypts it.
+ *
+ * lynx_verify_frame reads the frame from the block count byte on, at most
+ * size bytes of it, and writes 50 bytes of plaintext per block, so the
+ * plaintext buffer must hold MAX_PLAINTEXT_FRAME_SIZE bytes.  A count byte
+ * for more than MAX_BLOCKS_PER_FRAME blocks is LYNX_VERIFY_COUNT and
+ * nothing is written.  consumed, if it isn't 0, gets the number of bytes
+ * of the frame that were read.
+ *
+ * lynx_verify_image does every frame of an image, MAX_PLAINTEXT_FRAME_SIZE
+ * bytes of plaintext for each one, and stops at the first frame that
+ * doesn't fit in plaintext_size or whose end can't be found. */
+int lynx_check_block(const unsigned char * encrypted);
+int lynx_verify_frame(lynx_rom_t * rom,
+                      unsigned char * plaintext,
+                      const unsigned char * encrypted,
+                      const size_t size,
+                      size_t * consumed);
+int lynx_verify_image(lynx_rom_t * rom,
+                      unsigned char * plaintext,
+                      const size_t plaintext_size,
+                      const unsigned char * encrypted,
+                      const size_t encrypted_size,
+                      int * frames);
+
+/* the estimated 65C02 cycle count of the ROM routines that ran */
+unsigned long lynx_rom_cycles(const lynx_rom_cost_t * cost);
+
+/* byte-wise Montgomery modular exponentiation, least significant byte first.
+ * A = B**exponent mod modulus */
+void lynx_mod_exp(unsigned char * A,
+                  const unsigned char * B,
+                  const unsigned char * exponent,
+                  const unsigned char * modulus,
+                  const int m);
+
+/* the same with the per-modulus constants worked out up front.  the one for
+ * lynx_public_mod is built once and shared, lynx_mod_exp uses it when it is
+ * given that modulus. */
+int lynx_mod_key_init(lynx_mod_key_t * key,
+                      const unsigned char * modulus,
+                      const int m);
+const lynx_mod_key_t * lynx_public_mod_key(void);
+void lynx_mod_key_exp(unsigned char * A,
+                      const unsigned char * B,
+                      const unsigned char * exponent,
+                      const lynx_mod_key_t * key);
+
+/* loader config files */
+int lynx_read_frame_config(FILE * cfg, lynx_frame_def_t * frame, int line);
+int lynx_read_config_file(FILE * cfg, lynx_frame_def_t ** frames);
+int lynx_write_config_file(FILE * cfg,
+                           const lynx_frame_def_t * frames,
+                           const int frame_count);
+
+/* the smallest frame layout that covers a plaintext loader */
+int lynx_plan_frames(const unsigned char * plaintext,
+                     const size_t size,
+                     lynx_frame_def_t ** frames);
+
+/* helper function for dumping out blocks of data in a human readable form */
+void lynx_print_data(const unsigned char * data, int size);
+
+/* the --version output of the tools, with the kernels picked for this CPU */
+void lynx_print_version(const char * name);
+
+#endif /* _LYNXCRYPT_H_ */
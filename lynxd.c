@@ -0,0 +1,477 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * lynxd keeps the crypto contexts loaded and serves encrypt, decrypt and
+ * verify requests on a Unix socket, so a build that encrypts loaders over
+ * and over only pays for setting up the keys (and factoring the modulus for
+ * CRT) once.  lynxc is the client, see lynxd.h for the protocol.
+ *
+ * Every client gets its own thread.  The requests on one connection are
+ * answered one after another in the order they came in, a client that wants
+ * them done in parallel opens more connections.  A thread takes a context
+ * off the free list for each request and puts it back after, so there are
+ * only ever as many contexts as requests running at the same time.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "lynxcrypt.h"
+#include "lynxd.h"
+
+
+/* a context that isn't in use */
+typedef struct free_ctx_s
+{
+    struct free_ctx_s * next;
+    lynx_ctx_t * ctx;
+} free_ctx_t;
+
+static pthread_mutex_t ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static free_ctx_t * free_ctxs = 0;
+static lynx_cache_t * cache = 0;
+static volatile sig_atomic_t stopping = 0;
+
+
+/* This sets up a context and encrypts a block with it, so the modulus is
+ * factored for CRT before the first request needs it */
+static lynx_ctx_t * warm_ctx_new(void)
+{
+    lynx_ctx_t * ctx = lynx_ctx_new();
+    unsigned char plaintext[PLAINTEXT_BLOCK_SIZE];
+    unsigned char encrypted[ENCRYPTED_BLOCK_SIZE];
+
+    if(!ctx)
+        return 0;
+
+    memset(plaintext, 0, sizeof(plaintext));
+    lynx_encrypt_block(ctx, encrypted, plaintext, 0);
+    lynx_ctx_set_cache(ctx, cache);
+
+    return ctx;
+}
+
+
+static lynx_ctx_t * ctx_get(void)
+{
+    free_ctx_t * f;
+    lynx_ctx_t * ctx;
+
+    pthread_mutex_lock(&ctx_lock);
+    f = free_ctxs;
+    if(f)
+        free_ctxs = f->next;
+    pthread_mutex_unlock(&ctx_lock);
+
+    if(!f)
+        return warm_ctx_new();
+
+    ctx = f->ctx;
+    free(f);
+    return ctx;
+}
+
+
+static void ctx_put(lynx_ctx_t * ctx)
+{
+    free_ctx_t * f = malloc(sizeof(free_ctx_t));
+
+    if(!f)
+    {
+        lynx_ctx_free(ctx);
+        return;
+    }
+
+    f->ctx = ctx;
+    pthread_mutex_lock(&ctx_lock);
+    f->next = free_ctxs;
+    free_ctxs = f;
+    pthread_mutex_unlock(&ctx_lock);
+}
+
+
+/* This works out the config file at the front of an encrypt request and
+ * encrypts the plaintext after it */
+static int do_encrypt(lynx_ctx_t * ctx,
+                      const unsigned char * payload,
+                      const size_t length,
+                      unsigned char ** out,
+                      size_t * out_size,
+                      const char ** error)
+{
+    FILE * cfg;
+    uint32_t cfg_len;
+    int frame_count;
+    lynx_frame_def_t * frames = 0;
+
+    if(length < sizeof(cfg_len))
+    {
+        (*error) = "short encrypt request";
+        return 0;
+    }
+    memcpy(&cfg_len, payload, sizeof(cfg_len));
+    if((cfg_len == 0) || (cfg_len > length - sizeof(cfg_len)))
+    {
+        (*error) = "bad config file length";
+        return 0;
+    }
+
+    if(!(cfg = fmemopen((void *)&payload[sizeof(cfg_len)], cfg_len, "r")))
+    {
+        (*error) = "out of memory";
+        return 0;
+    }
+    frame_count = lynx_read_config_file(cfg, &frames);
+    fclose(cfg);
+    if(frame_count <= 0)
+    {
+        (*error) = "failed to read config file";
+        return 0;
+    }
+
+    (*out_size) = lynx_encrypted_size(frames, frame_count);
+    if(((*out_size) == 0) || !((*out) = malloc(*out_size)))
+    {
+        free(frames);
+        (*error) = "bad frame layout";
+        return 0;
+    }
+
+    payload += sizeof(cfg_len) + cfg_len;
+    if(!lynx_encrypt_image(ctx, (*out), (*out_size), payload,
+                           length - sizeof(cfg_len) - cfg_len,
+                           frames, frame_count))
+    {
+        free(frames);
+        (*error) = "failed to encrypt the frames";
+        return 0;
+    }
+
+    free(frames);
+    return 1;
+}
+
+
+/* every frame has a block count byte and at least one block, so this many
+ * plaintext frames is always enough */
+static size_t plaintext_size(const size_t encrypted_size)
+{
+    return ((encrypted_size / (1 + ENCRYPTED_BLOCK_SIZE)) + 1) * MAX_PLAINTEXT_FRAME_SIZE;
+}
+
+
+static int do_decrypt(lynx_ctx_t * ctx,
+                      const unsigned char * payload,
+                      const size_t length,
+                      unsigned char ** out,
+                      size_t * out_size,
+                      const char ** error)
+{
+    if(!((*out) = malloc(plaintext_size(length))))
+    {
+        (*error) = "out of memory";
+        return 0;
+    }
+
+    if(!((*out_size) = lynx_decrypt_image(ctx, (*out), plaintext_size(length),
+                                          payload, length)))
+    {
+        (*error) = "failed to decrypt the frames";
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* the response has the error bits and the frame count in front of the
+ * plaintext, a loader the ROM would reject is still a good answer */
+static int do_verify(const unsigned char * payload,
+                     const size_t length,
+                     unsigned char ** out,
+                     size_t * out_size,
+                     const char ** error)
+{
+    int frames = 0;
+    uint32_t header[2];
+    lynx_rom_t rom;
+
+    if(!((*out) = malloc((2 * sizeof(uint32_t)) + plaintext_size(length))))
+    {
+        (*error) = "out of memory";
+        return 0;
+    }
+
+    memset(&rom, 0, sizeof(rom));
+    header[0] = lynx_verify_image(&rom, (*out) + sizeof(header),
+                                  plaintext_size(length), payload, length,
+                                  &frames);
+    header[1] = frames;
+    memcpy((*out), header, sizeof(header));
+    (*out_size) = sizeof(header) + (frames * MAX_PLAINTEXT_FRAME_SIZE);
+
+    return 1;
+}
+
+
+/* This answers the requests on one connection until the client hangs up */
+static void * serve_client(void * arg)
+{
+    int fd = (int)(intptr_t)arg;
+    int ok;
+    size_t out_size;
+    unsigned char * payload;
+    unsigned char * out;
+    const char * error;
+    lynxd_header_t header;
+    lynx_ctx_t * ctx;
+
+    while(lynxd_recv(fd, &header, &payload))
+    {
+        out = 0;
+        out_size = 0;
+        error = "no such request";
+        ok = 0;
+
+        switch(header.code)
+        {
+            case LYNXD_OP_ENCRYPT:
+            case LYNXD_OP_DECRYPT:
+                if(!(ctx = ctx_get()))
+                {
+                    error = "failed to set up the crypto context";
+                    break;
+                }
+                if(header.code == LYNXD_OP_ENCRYPT)
+                    ok = do_encrypt(ctx, payload, header.length, &out, &out_size, &error);
+                else
+                    ok = do_decrypt(ctx, payload, header.length, &out, &out_size, &error);
+                ctx_put(ctx);
+                break;
+            case LYNXD_OP_VERIFY:
+                ok = do_verify(payload, header.length, &out, &out_size, &error);
+                break;
+        }
+        free(payload);
+
+        if(ok)
+            ok = lynxd_send(fd, LYNXD_STATUS_OK, header.id, out, out_size);
+        else
+            ok = lynxd_send(fd, LYNXD_STATUS_ERROR, header.id, error, strlen(error));
+        free(out);
+
+        if(!ok)
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
+
+
+/* This binds the socket.  A socket file nobody answers on was left behind
+ * by a daemon that died and is replaced, one that answers is left alone.
+ * Anything at the path that isn't a socket is never touched. */
+static int listen_on(const char * path)
+{
+    int fd;
+    struct stat st;
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    if((fd = lynxd_connect(path)) >= 0)
+    {
+        close(fd);
+        fprintf(stderr, "lynxd is already running on %s\n", path);
+        return -1;
+    }
+    if(lstat(path, &st) == 0)
+    {
+        if(!S_ISSOCK(st.st_mode))
+        {
+            fprintf(stderr, "%s is in the way and isn't a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if(((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ||
+       (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+       (listen(fd, 64) != 0))
+    {
+        fprintf(stderr, "failed to listen on %s: %s\n", path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+
+void print_help(char * name)
+{
+    printf("usage: %s [-s <socket>] [--cache <file>]\n", name);
+    printf("       %s --version\n\n", name);
+    printf("    -s, --socket <socket>  listen on socket instead of $%s or %s\n",
+           LYNXD_SOCKET_ENV, LYNXD_DEFAULT_SOCKET);
+    printf("    --cache <file>         keep the encrypted blocks in file, see lynxenc\n\n");
+}
+
+/* the long options, each of them maps onto a short one */
+static struct option long_options[] =
+{
+    { "help",       no_argument,        0, 'h' },
+    { "version",    no_argument,        0, 'V' },
+    { "socket",     required_argument,  0, 's' },
+    { "cache",      required_argument,  0, 'C' },
+    { 0, 0, 0, 0 }
+};
+
+int main(int argc, char ** argv)
+{
+    int opt;
+    int fd;
+    int client;
+    int status = EXIT_SUCCESS;
+    const char * path = 0;
+    lynx_ctx_t * ctx;
+    free_ctx_t * f;
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct sigaction sa;
+
+    /* parse the command line options */
+    while((opt = getopt_long(argc, argv, "hs:", long_options, 0)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                print_help(argv[0]);
+                return EXIT_SUCCESS;
+            case 'V':
+                lynx_print_version("lynxd");
+                return EXIT_SUCCESS;
+            case 's':
+                path = optarg;
+                break;
+            case 'C':
+                if(!cache && !(cache = lynx_cache_open(optarg)))
+                    return EXIT_FAILURE;
+                break;
+            default:
+                print_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    path = lynxd_socket_path(path);
+
+    /* load the keys once, before there is anybody to wait for it */
+    if(!(ctx = warm_ctx_new()))
+    {
+        fprintf(stderr, "failed to set up the crypto context\n");
+        lynx_cache_close(cache);
+        return EXIT_FAILURE;
+    }
+    ctx_put(ctx);
+
+    if((fd = listen_on(path)) < 0)
+    {
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+
+    /* a client that goes away shows up as a failed write, not a signal.
+     * SIGINT and SIGTERM interrupt accept so the socket gets cleaned up. */
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while(!stopping)
+    {
+        if((client = accept(fd, 0, 0)) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        if(pthread_create(&thread, &attr, serve_client, (void *)(intptr_t)client) != 0)
+        {
+            fprintf(stderr, "failed to start a client thread\n");
+            close(client);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(fd);
+    unlink(path);
+
+cleanup:
+    /* the client threads and the cache they may still be using are left to
+     * the exit, only the idle contexts are cleaned up */
+    pthread_mutex_lock(&ctx_lock);
+    while((f = free_ctxs))
+    {
+        free_ctxs = f->next;
+        lynx_ctx_free(f->ctx);
+        free(f);
+    }
+    pthread_mutex_unlock(&ctx_lock);
+
+    return status;
+}
@@ -0,0 +1,93 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The protocol lynxd speaks on its Unix socket, shared with the lynxc
+ * client.  Every request is a header and a payload, and every request gets a
+ * response, also a header and a payload, in the order the requests were
+ * sent.  A client can send as many requests as it likes before reading the
+ * responses, the id it picks comes back in the response to match them up.
+ *
+ * The headers are in the byte order of the machine, both ends are always on
+ * the same one.
+ *
+ *   LYNXD_OP_ENCRYPT   payload: uint32_t length of the config file text, the
+ *                      config file text, then the plaintext binary.
+ *                      response: the encrypted loader.
+ *   LYNXD_OP_DECRYPT   payload: an encrypted loader.
+ *                      response: the plaintext, MAX_PLAINTEXT_FRAME_SIZE
+ *                      bytes per frame, the way lynxdec writes it.
+ *   LYNXD_OP_VERIFY    payload: an encrypted loader.
+ *                      response: uint32_t ROM error bits, uint32_t frame
+ *                      count, then the plaintext as the ROM decrypts it.
+ *
+ * A response with a non-zero status has an error message as its payload.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXD_H_
+#define _LYNXD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* where the socket is when neither -s nor the environment says */
+#define LYNXD_SOCKET_ENV            "LYNXD_SOCKET"
+#define LYNXD_DEFAULT_SOCKET        "/tmp/lynxd.sock"
+
+#define LYNXD_MAGIC                 (0x584e594cU)   /* "LYNX" */
+#define LYNXD_MAX_PAYLOAD           (64 * 1024 * 1024)
+
+#define LYNXD_OP_ENCRYPT            (1)
+#define LYNXD_OP_DECRYPT            (2)
+#define LYNXD_OP_VERIFY             (3)
+
+#define LYNXD_STATUS_OK             (0)
+#define LYNXD_STATUS_ERROR          (1)
+
+typedef struct lynxd_header_s
+{
+    uint32_t magic;
+    uint32_t code;          /* the op in a request, the status in a response */
+    uint32_t id;
+    uint32_t length;        /* of the payload that follows */
+} lynxd_header_t;
+
+/* the socket path to use: path if it is set, else $LYNXD_SOCKET, else the
+ * default */
+const char * lynxd_socket_path(const char * path);
+
+/* connect to the daemon, returns the socket or -1 */
+int lynxd_connect(const char * path);
+
+/* read exactly len bytes, 0 on EOF or an error */
+int lynxd_read_full(int fd, void * buf, size_t len);
+
+/* send a header and its payload with one writev, 0 on an error */
+int lynxd_send(int fd, uint32_t code, uint32_t id, const void * payload, size_t length);
+
+/* read a header and its payload.  the payload is malloc'd, the caller frees
+ * it.  returns 0 on EOF or a bad header. */
+int lynxd_recv(int fd, lynxd_header_t * header, unsigned char ** payload);
+
+#endif /* _LYNXD_H_ */
@@ -63,224 +63,236 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <openssl/bn.h>
-#include "sizes.h"
-#include "keys.h"
-
-
-typedef struct encrypted_frame_s
+#include <getopt.h>
+#include "lynxcrypt.h"
+#include "lynxprobes.h"
+#include "lynxmap.h"
+
+
+/* This function finds an entire encrypted frame in the mapped loader by
+ * first decoding the block count and then checking that many blocks of
+ * encrypted data follow it.  The blocks are used where they are in the
+ * mapping.  The index of the frame is only for the tracepoints. */
+const unsigned char * read_encrypted_frame(const lynx_map_t * in,
+                                           int * blocks,
+                                           const int index,
+                                           const long offset)
 {
-    int blocks;
-    unsigned char data[MAX_ENCRYPTED_FRAME_SIZE];
-} encrypted_frame_t;
-
-typedef struct plaintext_frame_s
-{
-    int blocks;
-    unsigned char data[MAX_PLAINTEXT_FRAME_SIZE];
-} plaintext_frame_t;
-
-
-#define min(x,y) ((x < y) ? x : y)
-void print_data(const unsigned char * data, int size)
-{
-    int i = 0;
-    int j, count;
-    int left = size;
-
-    while(i < size)
-    {
-        count = min(8, (size - i));
+    LYNX_PROBE2(read_frame_start, index, offset);
 
-        printf("    ");
-        for(j = 0; j < count; j++)
-        {
-            printf("0x%02x, ", data[i + j]);
-        }
-        printf("\n");
-        i += count;
-    }
-}
+    /* read the block count */
+    if((size_t)offset >= in->size)
+        return 0;
 
+    /* decode the block count */
+    (*blocks) = 256 - in->data[offset];
+    if((*blocks) > MAX_BLOCKS_PER_FRAME)
+        return 0;
 
-/* This function reverses the block of data and loads it into a bignum. */
-BIGNUM* load_reverse(const unsigned char* buf, const int length)
-{
-    BIGNUM* bn;
-    int i;
-    const unsigned char* ptr = buf;
-    unsigned char* tmp = calloc(1, length);
+    /* the encrypted frame has to be all there */
+    if(in->size - (offset + 1) < (size_t)ENCRYPTED_FRAME_SIZE((*blocks)))
+        return 0;
 
-    for(i = length - 1; i >= 0; i--)
-    {
-        tmp[i] = *ptr;
-        ptr++;
-    }
+    LYNX_PROBE3(read_frame_done, index, offset, (*blocks));
 
-    bn = BN_bin2bn(tmp, length, 0);
-    free(tmp);
-    return bn;
+    return &in->data[offset + 1];
 }
 
 
-/* This function decrypts and decodes a single block of encrypted data. */
-int decrypt_block(unsigned char * plaintext,
-                  const unsigned char * encrypted,
-                  const int accumulator,
-                  BIGNUM * exponent,
-                  BIGNUM * modulus,
-                  BN_CTX * ctx)
+/* This is read_encrypted_frame for a pipe.  The frame is read into frame as
+ * soon as its block count and blocks have arrived, nothing after it is read
+ * yet. */
+const unsigned char * read_streamed_frame(const int fd,
+                                          unsigned char * frame,
+                                          int * blocks,
+                                          const int index,
+                                          const long offset)
 {
-    int i;
-    int acc = accumulator;
-    unsigned char buf[ENCRYPTED_BLOCK_SIZE];
-    unsigned char * d = plaintext;
-
-    /* set up some bignums to work with */
-    BIGNUM * result = BN_new();
-    BIGNUM * block = load_reverse(encrypted, ENCRYPTED_BLOCK_SIZE);
+    unsigned char count;
 
-    /* clear out the temporary buffer */
-    memset(buf, 0, ENCRYPTED_BLOCK_SIZE);
+    LYNX_PROBE2(read_frame_start, index, offset);
 
-    /* clear out the decrypted buffer */
-    memset(plaintext, 0, PLAINTEXT_BLOCK_SIZE);
-
-    /* do the RSA step */
-    BN_mod_exp(result, block, exponent, modulus, ctx);
+    /* read the block count */
+    if(lynx_read_full(fd, &count, 1) != 1)
+        return 0;
 
-    /* unreverse the data out, and un-obfuscate/un-pad it */
-    /* NOTE: we only take 50 bytes of output, not 51, the
-     * byte as index 0 of the buffer is carry cruft. */
-    BN_bn2bin(result, buf);
+    /* decode the block count */
+    (*blocks) = 256 - count;
+    if((*blocks) > MAX_BLOCKS_PER_FRAME)
+        return 0;
 
-    for(i = PLAINTEXT_BLOCK_SIZE; i > 0; i--)
-    {
-        acc += buf[i];
-        acc &= 0xFF;
-        (*d) = (unsigned char)(acc);
-        d++;
-    }
+    /* read in the encrypted frame */
+    if(lynx_read_full(fd, frame, ENCRYPTED_FRAME_SIZE((*blocks))) != (size_t)ENCRYPTED_FRAME_SIZE((*blocks)))
+        return 0;
 
-    /* free the result */
-    BN_free(result);
+    LYNX_PROBE3(read_frame_done, index, offset, (*blocks));
 
-    return acc;
+    return frame;
 }
 
 
-/* This function decrypts an entire frame of encrypted data */
-void decrypt_frame(plaintext_frame_t * plaintext,
-                   encrypted_frame_t * encrypted,
-                   const unsigned char * public_exp,
-                   const unsigned char * public_mod)
+/* the long options, each of them maps onto a short one */
+static struct option long_options[] =
 {
-    int i;
-    int accumulator = 0;
-    unsigned char *d;
-    unsigned char *e;
-
-    /* set up the bignum variables */
-    BIGNUM *exponent = BN_bin2bn(public_exp, LYNX_RSA_KEY_SIZE, 0);
-    BIGNUM *modulus = BN_bin2bn(public_mod, LYNX_RSA_KEY_SIZE, 0);
-    BN_CTX *ctx = BN_CTX_new();
-
-    /* initialize the state */
-    d = plaintext->data;
-    e = encrypted->data;
-
-    /* decrypt the blocks in the frame */
-    for(i = 0; i < encrypted->blocks; i++)
-    {
-        /* decrypt a block */
-        accumulator = decrypt_block(d, e, accumulator, exponent, modulus, ctx);
-
-        /* move the pointers */
-        d += PLAINTEXT_BLOCK_SIZE;
-        e += ENCRYPTED_BLOCK_SIZE;
-
-        /* store the block count */
-        plaintext->blocks++;
-    }
-
-    /* free the bignum variables */
-    BN_free(modulus);
-    BN_free(exponent);
-    BN_CTX_free(ctx);
-}
+    { "help",       no_argument,        0, 'h' },
+    { "version",    no_argument,        0, 'V' },
+    { "stats",      optional_argument,  0, 'S' },
+    { 0, 0, 0, 0 }
+};
 
-
-/* This function loads an entire encrypted frame by first reading in the block 
- * count followed by that number of blocks of encrypted data. */
-int read_encrypted_frame(FILE * const in,
-                          encrypted_frame_t * frame)
+void print_help(char * name)
 {
-    unsigned char blocks = 0;
-
-    /* clear out the frame struct */
-    memset(frame, 0, sizeof(encrypted_frame_t));
-
-    /* read the block count */
-    if(fread(&blocks, sizeof(unsigned char), 1, in) != 1)
-        return 0;
-
-    /* decode the block count */
-    frame->blocks = 256 - blocks;
-
-    /* read in the encrypted frame */
-    if(fread(&frame->data, ENCRYPTED_BLOCK_SIZE, frame->blocks, in) != frame->blocks)
-        return 0;
-
-    return frame->blocks;
+    printf("usage: %s [--stats[=json]] <encrypted.bin> <plaintext.bin>\n", name);
+    printf("       %s --version\n\n", name);
+    printf("either file can be - for stdin or stdout.  from a pipe every frame is\n");
+    printf("decrypted and written out as soon as it has arrived.\n\n");
+    printf("    --stats[=json]   print the time spent in each stage to stderr\n\n");
 }
 
 
 int main (int argc, char ** argv) 
 {
-    FILE *in = 0;
+    lynx_map_t in;
     FILE *out = 0;
+    int opt;
+    int stream;
+    int json = 0;
     int blocks = 0;
-    encrypted_frame_t encrypted_frame;
-    plaintext_frame_t plaintext_frame;
+    int index = 0;
+    long offset = 0;
+    size_t size = 0;
+    lynx_ctx_t * ctx = 0;
+    lynx_stats_t * stats = 0;
+    lynx_stats_t run_stats;
+    lynx_timer_t timer;
+    const unsigned char * encrypted;
+    unsigned char * plaintext;
+    unsigned char frame[MAX_ENCRYPTED_FRAME_SIZE];
+
+    /* parse the command line options */
+    while((opt = getopt_long(argc, argv, "h", long_options, 0)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                print_help(argv[0]);
+                return EXIT_SUCCESS;
+            case 'V':
+                lynx_print_version("lynxdec");
+                return EXIT_SUCCESS;
+            case 'S':
+                if(optarg && strcmp(optarg, "json"))
+                {
+                    fprintf(stderr, "error: unknown stats format: %s\n\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                json = (optarg != 0);
+                lynx_stats_init(&run_stats);
+                stats = &run_stats;
+                break;
+            default:
+                print_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
 
-    if(argc < 3)
+    if(argc - optind < 2)
     {
-        printf("usage: %s <encrypted.bin> <plaintext.bin>\n", argv[0]);
+        print_help(argv[0]);
         return EXIT_FAILURE;
     }
 
     /* open the binary encrypted loader */
-    in = fopen(argv[1], "rb");
-    out = fopen(argv[2], "wb+");
+    lynx_stats_start(stats, &timer);
+    if(!lynx_map_open(&in, argv[optind]))
+    {
+        fprintf(stderr, "failed to open encrypted loader file: %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
+    if(strcmp(argv[optind + 1], "-") == 0)
+        out = stdout;
+    else
+        out = fopen(argv[optind + 1], "wb+");
 
     /* check for successful opens */
-    if(!in)
+    if(!out)
     {
-        fprintf(stderr, "failed to open encrypted loader file: %s\n", argv[1]);
+        fprintf(stderr, "failed to open plaintext loader file for writing: %s\n", argv[optind + 1]);
         return EXIT_FAILURE;
     }
-    if(!out)
+
+    /* set up the crypto context */
+    if(!(ctx = lynx_ctx_new()))
     {
-        fprintf(stderr, "failed to open plaintext loader file for writing: %s\n", argv[2]);
+        fprintf(stderr, "failed to set up the crypto context\n");
         return EXIT_FAILURE;
     }
+    lynx_ctx_set_stats(ctx, stats);
 
-    /* clear out the decrypted frame buffer */
-    memset(plaintext_frame.data, 0, sizeof(plaintext_frame_t));
+    /* every frame is at least a block count and a block, so this is room
+     * for all of the plaintext.  in a pipeline each frame goes out as soon
+     * as it is done, so only one is held at a time. */
+    stream = (in.fd >= 0) || lynx_is_stream(fileno(out));
+    if(!(plaintext = calloc(stream ? 1 : ((in.size / (1 + ENCRYPTED_BLOCK_SIZE)) + 1), MAX_PLAINTEXT_FRAME_SIZE)))
+    {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
 
-    /* read in the next encrypted frame of data */
-    while(read_encrypted_frame(in, &encrypted_frame))
+    /* find the next encrypted frame of data */
+    lynx_stats_start(stats, &timer);
+    while((encrypted = (in.fd >= 0) ? read_streamed_frame(in.fd, frame, &blocks, index, offset)
+                                    : read_encrypted_frame(&in, &blocks, index, offset)))
     {
-        /* decrypt a single frame of the encrypted loader */
-        decrypt_frame(&plaintext_frame, &encrypted_frame, lynx_public_exp, lynx_public_mod);
+        lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
+        lynx_stats_count(stats, LYNX_COUNT_FRAMES, 1);
+        lynx_stats_count(stats, LYNX_COUNT_BYTES_IN, 1 + ENCRYPTED_FRAME_SIZE(blocks));
+
+        /* decrypt a single frame of the encrypted loader, straight out of
+         * the mapping and into its page of the plaintext */
+        memset(&plaintext[size], 0, MAX_PLAINTEXT_FRAME_SIZE);
+        lynx_decrypt_frame(ctx, &plaintext[size], encrypted, blocks, index);
+        size += MAX_PLAINTEXT_FRAME_SIZE;
+        lynx_stats_count(stats, LYNX_COUNT_BYTES_OUT, MAX_PLAINTEXT_FRAME_SIZE);
+
+        if(stream)
+        {
+            lynx_stats_start(stats, &timer);
+            if(!lynx_write_all(fileno(out), plaintext, size))
+            {
+                fprintf(stderr, "failed to write plaintext loader file: %s\n", argv[optind + 1]);
+                return EXIT_FAILURE;
+            }
+            lynx_stats_stop(stats, &timer, LYNX_STAGE_WRITE);
+            size = 0;
+        }
+
+        index++;
+        offset += 1 + ENCRYPTED_FRAME_SIZE(blocks);
 
-        /* write the decrypted frame */
-        fwrite(plaintext_frame.data, MAX_PLAINTEXT_FRAME_SIZE, 1, out);
+        lynx_stats_start(stats, &timer);
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
+
+    /* write the decrypted frames in one go */
+    lynx_stats_start(stats, &timer);
+    if(!lynx_write_all(fileno(out), plaintext, size))
+    {
+        fprintf(stderr, "failed to write plaintext loader file: %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
     }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_WRITE);
 
     /* close the files */
-    fclose(in);
-    fclose(out);
+    lynx_unmap(&in);
+    if(out != stdout)
+        fclose(out);
+    free(plaintext);
+    lynx_ctx_free(ctx);
+
+    if(stats)
+        lynx_stats_print(stderr, stats, json);
 
     return EXIT_SUCCESS;
 }
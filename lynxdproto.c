@@ -0,0 +1,160 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The socket plumbing both ends of the lynxd protocol need.  This is built
+ * into lynxd and lynxc and not the library, so the client doesn't pull in
+ * OpenSSL.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "lynxd.h"
+
+
+const char * lynxd_socket_path(const char * path)
+{
+    if(path)
+        return path;
+    if((path = getenv(LYNXD_SOCKET_ENV)) && *path)
+        return path;
+    return LYNXD_DEFAULT_SOCKET;
+}
+
+
+int lynxd_connect(const char * path)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int lynxd_read_full(int fd, void * buf, size_t len)
+{
+    ssize_t n;
+    unsigned char * p = buf;
+
+    while(len > 0)
+    {
+        n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return 0;
+        p += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+
+int lynxd_send(int fd, uint32_t code, uint32_t id, const void * payload, size_t length)
+{
+    ssize_t n;
+    lynxd_header_t header;
+    struct iovec iov[2];
+    int count = 2;
+    struct iovec * v = iov;
+
+    header.magic = LYNXD_MAGIC;
+    header.code = code;
+    header.id = id;
+    header.length = (uint32_t)length;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+
+    /* one system call unless the socket buffer is full */
+    while(count > 0)
+    {
+        n = writev(fd, v, count);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return 0;
+
+        while((count > 0) && ((size_t)n >= v->iov_len))
+        {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if(count > 0)
+        {
+            v->iov_base = (unsigned char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+
+    return 1;
+}
+
+
+int lynxd_recv(int fd, lynxd_header_t * header, unsigned char ** payload)
+{
+    (*payload) = 0;
+
+    if(!lynxd_read_full(fd, header, sizeof(lynxd_header_t)) ||
+       (header->magic != LYNXD_MAGIC) || (header->length > LYNXD_MAX_PAYLOAD))
+        return 0;
+
+    /* one extra byte so error messages can be printed as strings */
+    if(!((*payload) = malloc(header->length + 1)))
+        return 0;
+    (*payload)[header->length] = 0;
+
+    if(!lynxd_read_full(fd, (*payload), header->length))
+    {
+        free(*payload);
+        (*payload) = 0;
+        return 0;
+    }
+
+    return 1;
+}
@@ -64,11 +64,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <unistd.h>
-#include <openssl/bn.h>
-#include "sizes.h"
-#include "keys.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lynxcrypt.h"
+#include "lynxpool.h"
+#include "lynxprobes.h"
+#include "lynxmap.h"
+#include "lynxlnx.h"
 
 
 typedef struct encrypted_frame_s
@@ -83,342 +87,912 @@ typedef struct plaintext_frame_s
     unsigned char data[MAX_PLAINTEXT_FRAME_SIZE];
 } plaintext_frame_t;
 
-typedef struct frame_def_s
+/* the shared list of blocks the worker threads pull from */
+typedef struct job_queue_s
 {
-    long offset;
-    int blocks;
-} frame_def_t;
+    pthread_mutex_t lock;
+    lynx_block_job_t * jobs;
+    int count;
+    int next;
+    int failed;
+
+    /* with --verify, whoever encrypts the last block of a frame hands the
+     * frame to the verifier */
+    struct verify_job_s * checks;
+    const lynx_map_t * in;
+    const lynx_frame_def_t * frames;
+    const unsigned char * encrypted;
+    size_t * frame_at;              /* where each frame is in encrypted */
+    int * remaining;                /* blocks of each frame still to do */
+} job_queue_t;
+
+/* the images whose blocks are all encrypted, waiting to be written out */
+typedef struct batch_s
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    struct batch_item_s * done_list;
+} batch_t;
+
+/* a run of up to LYNX_BATCH_BLOCKS blocks of one image, a task for the
+ * pool */
+typedef struct batch_task_s
+{
+    batch_t * batch;
+    struct batch_item_s * item;
+    lynx_block_job_t * jobs;
+    int count;
+} batch_task_t;
+
+/* one line of a batch manifest and the state of its image while it is in
+ * flight */
+typedef struct batch_item_s
+{
+    char * cfg_file;
+    char * plaintext_file;
+    char * encrypted_file;
+    int line;
+    int failed;
+    char error[128];
+    unsigned char * encrypted;
+    size_t encrypted_size;
+    lynx_block_job_t * jobs;
+    batch_task_t * tasks;
+    int remaining;
+    struct batch_item_s * next_done;
+} batch_item_t;
+
+/* how many images per thread can be in memory at once in batch mode */
+#define BATCH_IMAGES_PER_THREAD     (4)
 
 #define min(x,y) ((x < y) ? x : y)
-void print_data(const unsigned char * data, int size)
+#define max(x,y) ((x > y) ? x : y)
+
+/* --stats, --cache and --quiet.  the stats and the block cache are shared by
+ * every crypto context */
+static lynx_stats_t * stats = 0;
+static lynx_cache_t * cache = 0;
+static int quiet = 0;
+
+/* --lnx, the cartridge image the loader is spliced into */
+static lynx_lnx_t * cart = 0;
+
+/* --verify.  each frame is run through the ROM decryptor on these threads
+ * as soon as it is encrypted, while the frames after it are encrypted. */
+static lynx_pool_t * verifier = 0;
+
+/* a frame for the verifier, with the plaintext it has to come back as */
+typedef struct verify_job_s
+{
+    int blocks;
+    long offset;
+    int err;
+    int mismatch;
+    unsigned char encrypted[1 + MAX_ENCRYPTED_FRAME_SIZE];
+    unsigned char plaintext[MAX_PLAINTEXT_FRAME_SIZE];
+} verify_job_t;
+
+
+/* This points at the plaintext of a frame, straight in the input file
+ * unless the frame runs off the end of it.  That one is copied into pad and
+ * filled out with 0.  It returns 0 for an offset outside the file. */
+const unsigned char * frame_plaintext(const lynx_map_t * in,
+                                      const lynx_frame_def_t * frame,
+                                      plaintext_frame_t * pad)
 {
-    int i = 0;
-    int j, count;
-    int left = size;
+    size_t len;
 
-    while(i < size)
+    if((frame->offset < 0) || ((size_t)frame->offset >= in->size))
+        return 0;
+
+    len = in->size - frame->offset;
+    if(len >= MAX_PLAINTEXT_FRAME_SIZE)
+        return &in->data[frame->offset];
+
+    memset(pad, 0, sizeof(plaintext_frame_t));
+    memcpy(pad->data, &in->data[frame->offset], len);
+    return pad->data;
+}
+
+
+/* This encrypts one frame into out, the block count byte and then the
+ * blocks.  It returns the number of bytes it put there, 0 on failure. */
+size_t process_frame(lynx_ctx_t * ctx, lynx_map_t * in, unsigned char * out, lynx_frame_def_t * frame, int index)
+{
+    const unsigned char * plaintext;
+    plaintext_frame_t pad;
+    lynx_timer_t timer;
+ 
+    LYNX_PROBE3(process_frame_start, index, frame->offset, frame->blocks);
+
+    /* find the frame in the plaintext, reading up to it from a stream */
+    lynx_stats_start(stats, &timer);
+    if(!lynx_map_fill(in, frame->offset + MAX_PLAINTEXT_FRAME_SIZE))
     {
-        count = min(8, (size - i));
+        fprintf(stderr, "error: failed to read plaintext block\n");
+        return 0;
+    }
+    if(!(plaintext = frame_plaintext(in, frame, &pad)))
+    {
+        fprintf(stderr, "error: invalid frame offset %li\n", frame->offset);
+        return 0;
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
 
-        printf("    ");
-        for(j = 0; j < count; j++)
-        {
-            printf("0x%02x, ", data[i + j]);
-        }
-        printf("\n");
-        i += count;
+    /* check the number of blocks to encrypt */
+    if((frame->blocks <= 0) || (frame->blocks > MAX_BLOCKS_PER_FRAME))
+    {
+        fprintf(stderr, "error: invalid block count %d\n", frame->blocks);
+        return 0;
     }
+
+    /* encrypt a single frame of the encrypted loader behind its block
+     * count */
+    if(!quiet)
+        printf("Encrypting %d blocks of plaintext from offset 0x%08x\n", frame->blocks, (unsigned int)frame->offset);
+    out[0] = 256 - frame->blocks;
+    lynx_encrypt_frame(ctx, &out[1], plaintext, frame->blocks, index);
+
+    lynx_stats_count(stats, LYNX_COUNT_FRAMES, 1);
+    lynx_stats_count(stats, LYNX_COUNT_BYTES_IN, frame->blocks * PLAINTEXT_BLOCK_SIZE);
+    lynx_stats_count(stats, LYNX_COUNT_BYTES_OUT, 1 + ENCRYPTED_FRAME_SIZE(frame->blocks));
+
+    LYNX_PROBE3(process_frame_done, index, frame->offset, 1 + ENCRYPTED_FRAME_SIZE(frame->blocks));
+
+    return 1 + ENCRYPTED_FRAME_SIZE(frame->blocks);
 }
 
 
-/* This function pads and encrypts a single block of plaintext */
-void encrypt_block(unsigned char * encrypted,
-                  const unsigned char * plaintext,
-                  const int accumulator,
-                  BIGNUM * exponent,
-                  BIGNUM * modulus,
-                  BN_CTX * ctx)
+/* This writes a finished image to the output file in one go, or with --lnx
+ * the cartridge image with it at the start of bank 0 */
+int write_image(FILE * out, const unsigned char * encrypted, const size_t size)
 {
-    int i, tmp;
-    int acc;
+    lynx_timer_t timer;
+    int status;
+
+    lynx_stats_start(stats, &timer);
+    if(cart)
+        status = lynx_lnx_splice(cart, fileno(out), encrypted, size);
+    else
+        status = lynx_write_all(fileno(out), encrypted, size);
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_WRITE);
+
+    return status;
+}
+
+/* the verifier threads each get their own ROM scratch memory */
+static void * verify_rom_new(void)
+{
+    return calloc(1, sizeof(lynx_rom_t));
+}
+
+static void verify_rom_free(void * state)
+{
+    free(state);
+}
+
+
+/* This decrypts a frame the way the boot ROM does, checking everything the
+ * ROM checks and that the plaintext comes out the same as it went in */
+static void verify_task(void * state, void * arg)
+{
+    verify_job_t * job = (verify_job_t *)arg;
+    unsigned char decrypted[MAX_PLAINTEXT_FRAME_SIZE];
+
+    memset(decrypted, 0, sizeof(decrypted));
+    job->err = lynx_verify_frame((lynx_rom_t *)state, decrypted, job->encrypted,
+                                 1 + ENCRYPTED_FRAME_SIZE(job->blocks), 0);
+    job->mismatch = (memcmp(decrypted, job->plaintext, PLAINTEXT_FRAME_SIZE(job->blocks)) != 0);
+}
+
+
+/* This hands a finished frame, block count byte first, to the verifier.
+ * Both buffers are copied so the caller can reuse them straight away. */
+void verify_frame(verify_job_t * job,
+                  const lynx_frame_def_t * frame,
+                  const unsigned char * encrypted,
+                  const unsigned char * plaintext)
+{
+    job->blocks = frame->blocks;
+    job->offset = frame->offset;
+    memcpy(job->encrypted, encrypted, 1 + ENCRYPTED_FRAME_SIZE(frame->blocks));
+    memcpy(job->plaintext, plaintext, PLAINTEXT_FRAME_SIZE(frame->blocks));
+
+    while(!lynx_pool_submit(verifier, verify_task, job))
+        lynx_pool_wait(verifier);
+}
+
+
+/* This prints what the ROM checks made of one frame */
+static void print_verify_errors(const int err)
+{
+    if(err & LYNX_VERIFY_ZERO_LEAD)
+        fprintf(stderr, "    the first three bytes of a block are 0\n");
+    if(err & LYNX_VERIFY_RANGE)
+        fprintf(stderr, "    a block is not below the modulus\n");
+    if(err & LYNX_VERIFY_MARKER)
+        fprintf(stderr, "    a block doesn't decrypt to 0x15 first\n");
+    if(err & LYNX_VERIFY_ACCUMULATOR)
+        fprintf(stderr, "    the accumulator isn't 0 at the end of the frame\n");
+    if(err & LYNX_VERIFY_TRUNCATED)
+        fprintf(stderr, "    the frame is cut short\n");
+    if(err & LYNX_VERIFY_COUNT)
+        fprintf(stderr, "    the frame has more than 5 blocks\n");
+}
+
+
+/* This waits for the verifier to catch up and reports on every frame that
+ * failed.  It returns the number of those. */
+int verify_report(verify_job_t * jobs, const int count)
+{
+    int i;
+    int failed = 0;
+
+    lynx_pool_wait(verifier);
+
+    for(i = 0; i < count; i++)
+    {
+        if(!jobs[i].err && !jobs[i].mismatch)
+            continue;
+
+        fprintf(stderr, "verify: frame %d from offset 0x%08x fails:\n", i, (unsigned int)jobs[i].offset);
+        print_verify_errors(jobs[i].err);
+        if(jobs[i].mismatch)
+            fprintf(stderr, "    the plaintext doesn't decrypt back to what it was\n");
+        failed++;
+    }
+    fprintf(stderr, "verify: %d of %d frames pass the boot ROM checks\n", count - failed, count);
+
+    return failed;
+}
+
+/* This counts off a run of encrypted blocks against their frames and hands
+ * every frame that is now complete to the verifier */
+static void verify_finished(job_queue_t * queue, const lynx_block_job_t * jobs, const int count)
+{
+    int i, f;
+    plaintext_frame_t pad;
+
+    for(i = 0; i < count; i++)
+    {
+        f = jobs[i].frame;
+        if(__atomic_sub_fetch(&queue->remaining[f], 1, __ATOMIC_ACQ_REL) == 0)
+            verify_frame(&queue->checks[f], &queue->frames[f], &queue->encrypted[queue->frame_at[f]],
+                         frame_plaintext(queue->in, &queue->frames[f], &pad));
+    }
+}
+
+
+/* This is the worker thread for -j.  Each worker has its own crypto context
+ * and does RSA steps until the queue is empty. */
+static void * encrypt_worker(void * arg)
+{
+    job_queue_t * queue = (job_queue_t *)arg;
+    lynx_ctx_t * ctx = lynx_ctx_new();
+    int i;
+
+    if(!ctx)
+    {
+        pthread_mutex_lock(&queue->lock);
+        queue->failed = 1;
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    lynx_ctx_set_stats(ctx, stats);
+    lynx_ctx_set_cache(ctx, cache);
+
+    while(1)
+    {
+        /* grab the next run of blocks, enough to fill the SIMD lanes */
+        pthread_mutex_lock(&queue->lock);
+        i = queue->next;
+        queue->next += LYNX_BATCH_BLOCKS;
+        pthread_mutex_unlock(&queue->lock);
+
+        if(i >= queue->count)
+            break;
+
+        lynx_encrypt_jobs(ctx, &queue->jobs[i], min(LYNX_BATCH_BLOCKS, queue->count - i));
+        if(queue->checks)
+            verify_finished(queue, &queue->jobs[i], min(LYNX_BATCH_BLOCKS, queue->count - i));
+    }
+
+    lynx_ctx_free(ctx);
+    return 0;
+}
+
+
+/* This dumps an encrypted block the way lynx_encrypt_encoded does, which is
+ * before it gets reversed into the frame. */
+static void print_encrypted(const unsigned char * encrypted)
+{
+    int i;
     unsigned char buf[ENCRYPTED_BLOCK_SIZE];
-    unsigned char * p = buf;
-    BIGNUM * result = BN_new();
-    BIGNUM * block;
 
-    /* clear out the temporary buffer */
-    memset(buf, 0, ENCRYPTED_BLOCK_SIZE);
+    for(i = 0; i < ENCRYPTED_BLOCK_SIZE; i++)
+    {
+        buf[i] = encrypted[(ENCRYPTED_BLOCK_SIZE - 1) - i];
+    }
+
+    printf("enc:\n");
+    lynx_print_data(buf, ENCRYPTED_BLOCK_SIZE);
+}
+
 
-    /* clear out the result buffer */
-    memset(encrypted, 0, ENCRYPTED_BLOCK_SIZE);
+/* This is the -j version of the process_frame loop.  Every block of every
+ * frame is encoded up front, since the accumulator for a block is just the
+ * last plaintext byte of the block before it.  The RSA steps are then spread
+ * over the worker threads, each one putting its blocks straight into their
+ * place in the image, and the image is written out in one go, so the output
+ * is identical to the serial path.  With --verify each frame goes to the
+ * verifier as soon as its last block is done. */
+int process_frames_parallel(lynx_map_t * in, FILE * out,
+                            lynx_frame_def_t * frames, int frame_count,
+                            int threads, verify_job_t * checks)
+{
+    int i, j, n;
+    int status = 0;
+    long last = 0;
+    size_t at;
+    size_t size = lynx_encrypted_size(frames, frame_count);
+    unsigned char * encrypted = 0;
+    pthread_t * workers = 0;
+    job_queue_t queue;
+    lynx_timer_t timer;
+
+    memset(&queue, 0, sizeof(job_queue_t));
+    pthread_mutex_init(&queue.lock, 0);
+
+    /* from a stream, only read as far as the last frame */
+    for(i = 0; i < frame_count; i++)
+    {
+        last = max(last, frames[i].offset);
+    }
+    lynx_stats_start(stats, &timer);
+    if(!lynx_map_fill(in, last + MAX_PLAINTEXT_FRAME_SIZE))
+    {
+        fprintf(stderr, "error: failed to read plaintext block\n");
+        goto cleanup;
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
 
-    /* pad/encode the plaintext out to ENCRYPTED_BLOCK_SIZE */
-    *p = 0x15;
-    p++;
-    for(i = PLAINTEXT_BLOCK_SIZE - 1; i > 0; i--)
+    /* check the frames first, so the errors say which part is wrong */
+    for(i = 0; i < frame_count; i++)
     {
-        if(plaintext[i] < plaintext[i - 1])
+        if((frames[i].offset < 0) || ((size_t)frames[i].offset >= in->size))
         {
-            tmp = (0x100 + plaintext[i]) - plaintext[i - 1];
-            *p = (unsigned char)(tmp & 0xFF);
+            fprintf(stderr, "error: invalid frame offset %li\n", frames[i].offset);
+            goto cleanup;
         }
-        else
+        if((frames[i].blocks <= 0) || (frames[i].blocks > MAX_BLOCKS_PER_FRAME))
         {
-            *p = plaintext[i] - plaintext[i - 1];
+            fprintf(stderr, "error: invalid block count %d\n", frames[i].blocks);
+            goto cleanup;
         }
+    }
+
+    encrypted = malloc(size);
+    queue.jobs = calloc(frame_count * MAX_BLOCKS_PER_FRAME, sizeof(lynx_block_job_t));
+    workers = calloc(threads, sizeof(pthread_t));
+    if(checks)
+    {
+        queue.frame_at = malloc(frame_count * sizeof(size_t));
+        queue.remaining = malloc(frame_count * sizeof(int));
+    }
+    if(!encrypted || !queue.jobs || !workers ||
+       (checks && (!queue.frame_at || !queue.remaining)))
+    {
+        fprintf(stderr, "error: out of memory\n");
+        goto cleanup;
+    }
 
-        p++;
+    if(checks)
+    {
+        for(i = 0, at = 0; i < frame_count; i++)
+        {
+            queue.frame_at[i] = at;
+            queue.remaining[i] = frames[i].blocks;
+            at += 1 + ENCRYPTED_FRAME_SIZE(frames[i].blocks);
+        }
+        queue.checks = checks;
+        queue.in = in;
+        queue.frames = frames;
+        queue.encrypted = encrypted;
     }
 
-    /* calculate last byte */
-    if(plaintext[0] < accumulator)
+    /* encode all of the blocks, straight from the input file */
+    lynx_stats_start(stats, &timer);
+    queue.count = lynx_encode_image(queue.jobs, encrypted, size,
+                                    in->data, in->size, frames, frame_count);
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_CODEC);
+
+    /* do the RSA steps */
+    n = min(threads, queue.count);
+    for(i = 0; i < n; i++)
     {
-        tmp = (0x100 + plaintext[0]) - accumulator;
-        *p = (unsigned char)(tmp & 0xff);
+        if(pthread_create(&workers[i], 0, encrypt_worker, &queue) != 0)
+        {
+            pthread_mutex_lock(&queue.lock);
+            queue.failed = 1;
+            queue.next = queue.count;
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
     }
-    else
+    n = i;
+    for(i = 0; i < n; i++)
     {
-        (*p) = plaintext[0] - accumulator;
+        pthread_join(workers[i], 0);
+    }
+
+    if(queue.failed)
+    {
+        fprintf(stderr, "error: failed to start the worker threads\n");
+        goto cleanup;
     }
 
-    /* memcpy(encrypted, buf, ENCRYPTED_BLOCK_SIZE); */
+    /* dump the blocks in frame order */
+    n = 0;
+    for(i = 0; i < frame_count; i++)
+    {
+        if(!quiet)
+        {
+            printf("Encrypting %d blocks of plaintext from offset 0x%08x\n", frames[i].blocks, (unsigned int)frames[i].offset);
+            for(j = 0; j < frames[i].blocks; j++, n++)
+            {
+                printf("buf:\n");
+                lynx_print_data(queue.jobs[n].encoded, ENCRYPTED_BLOCK_SIZE);
+                print_encrypted(queue.jobs[n].encrypted);
+            }
+        }
 
-    printf("buf:\n");
-    print_data(buf, 51);
+        lynx_stats_count(stats, LYNX_COUNT_FRAMES, 1);
+        lynx_stats_count(stats, LYNX_COUNT_BYTES_IN, frames[i].blocks * PLAINTEXT_BLOCK_SIZE);
+    }
 
-    /* load the encoded plaintext */
-    block = BN_bin2bn(buf, ENCRYPTED_BLOCK_SIZE, 0);
-    
-    /* do the RSA step */
-    BN_mod_exp(result, block, exponent, modulus, ctx);
+    if(!write_image(out, encrypted, size))
+    {
+        fprintf(stderr, "error: failed to write encrypted loader file\n");
+        goto cleanup;
+    }
+    lynx_stats_count(stats, LYNX_COUNT_BYTES_OUT, size);
 
-    /* clear out temporary buffer */
-    memset(buf, 0, ENCRYPTED_BLOCK_SIZE);
+    status = 1;
 
-    /* get the encrypted data out */
-    BN_bn2bin(result, buf);
+cleanup:
+    pthread_mutex_destroy(&queue.lock);
+    free(encrypted);
+    free(queue.jobs);
+    free(queue.frame_at);
+    free(queue.remaining);
+    free(workers);
+    return status;
+}
 
-    printf("enc:\n");
-    print_data(buf, 51);
+/* the pool workers each get their own crypto context */
+static void * batch_ctx_new(void)
+{
+    lynx_ctx_t * ctx = lynx_ctx_new();
 
-    /* reverse the data as we copy it into the encrypted frame */
-    for(i = 0; i < ENCRYPTED_BLOCK_SIZE; i++)
+    if(ctx)
     {
-        encrypted[i] = buf[(ENCRYPTED_BLOCK_SIZE - 1) - i];
+        lynx_ctx_set_stats(ctx, stats);
+        lynx_ctx_set_cache(ctx, cache);
     }
+    return ctx;
+}
+
+static void batch_ctx_free(void * state)
+{
+    lynx_ctx_free((lynx_ctx_t *)state);
+}
+
+
+/* This does the RSA steps for a run of blocks of a batch image.  Whoever
+ * finishes the last blocks of an image hands it back to the main thread. */
+static void batch_task(void * state, void * arg)
+{
+    batch_task_t * task = (batch_task_t *)arg;
+    batch_item_t * item = task->item;
+
+    lynx_encrypt_jobs((lynx_ctx_t *)state, task->jobs, task->count);
 
-    /* free the result */
-    BN_free(result);
+    if(__atomic_sub_fetch(&item->remaining, task->count, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&task->batch->lock);
+        item->next_done = task->batch->done_list;
+        task->batch->done_list = item;
+        pthread_cond_signal(&task->batch->done);
+        pthread_mutex_unlock(&task->batch->lock);
+    }
 }
 
 
-/* This function encodes and encrypts a single block of plaintext data. */
-void encrypt_frame(encrypted_frame_t * encrypted,
-                   plaintext_frame_t * plaintext,
-                   const unsigned char * private_exp,
-                   const unsigned char * public_mod)
+void free_manifest(batch_item_t * items, int count)
 {
     int i;
-    int accumulator;
 
-    /* set up the bignum variables */
-    BIGNUM *exponent = BN_bin2bn(private_exp, LYNX_RSA_KEY_SIZE, 0);
-    BIGNUM *modulus = BN_bin2bn(public_mod, LYNX_RSA_KEY_SIZE, 0);
-    BN_CTX *ctx = BN_CTX_new();
+    for(i = 0; i < count; i++)
+    {
+        free(items[i].cfg_file);
+        free(items[i].plaintext_file);
+        free(items[i].encrypted_file);
+    }
+    free(items);
+}
+
 
-    /* pad and encrypt the blocks in the frame */
-    for(i = plaintext->blocks - 1; i >= 0; i--)
+/* This reads a manifest of "<config> <plaintext> <encrypted>" lines.  Blank
+ * lines and lines starting with '#' are skipped. */
+int read_manifest(FILE * manifest, batch_item_t ** items)
+{
+    int count = 0;
+    int line = 0;
+    char buf[3 * 1024];
+    char * fields[3];
+    char * p;
+    int n;
+
+    while(fgets(buf, sizeof(buf), manifest))
     {
-        if(i > 0)
-            accumulator = plaintext->data[(i * PLAINTEXT_BLOCK_SIZE) - 1];
-        else
-            accumulator = 0;
+        line++;
 
-        /* encrypte the block */
-        encrypt_block(&encrypted->data[i * ENCRYPTED_BLOCK_SIZE], 
-                      &plaintext->data[i * PLAINTEXT_BLOCK_SIZE], 
-                      accumulator, exponent, modulus, ctx);
+        n = 0;
+        p = strtok(buf, " \t\r\n");
+        if(!p || (*p == '#'))
+            continue;
+        while(p && (n < 3))
+        {
+            fields[n++] = p;
+            p = strtok(0, " \t\r\n");
+        }
+
+        if((n != 3) || p)
+        {
+            fprintf(stderr, "syntax error: expecting <config> <plaintext> <encrypted> on line %d\n", line);
+            free_manifest((*items), count);
+            (*items) = 0;
+            return -1;
+        }
 
-        /* store the block count */
-        encrypted->blocks++;
+        (*items) = realloc((*items), (count + 1) * sizeof(batch_item_t));
+        memset(&(*items)[count], 0, sizeof(batch_item_t));
+        (*items)[count].cfg_file = strdup(fields[0]);
+        (*items)[count].plaintext_file = strdup(fields[1]);
+        (*items)[count].encrypted_file = strdup(fields[2]);
+        (*items)[count].line = line;
+        count++;
     }
 
-    /* free the bignum variables */
-    BN_free(modulus);
-    BN_free(exponent);
-    BN_CTX_free(ctx);
+    return count;
 }
 
 
-/* This function loads an entire plaintext frame which is just 256 bytes */
-int read_plaintext_frame(FILE * const in,
-                         plaintext_frame_t * frame)
+/* This loads the config and maps the plaintext for a batch item and encodes
+ * all of its blocks.  The plaintext is only needed until the blocks are
+ * encoded. */
+int load_batch_item(batch_item_t * item)
 {
-    int i, j;
+    FILE * cfg = 0;
+    int frame_count;
+    int status = 0;
+    lynx_map_t in = LYNX_MAP_INIT;
+    lynx_frame_def_t * frames = 0;
+    lynx_timer_t timer;
+
+    lynx_stats_start(stats, &timer);
+    if(!(cfg = fopen(item->cfg_file, "r")))
+    {
+        snprintf(item->error, sizeof(item->error), "failed to open config file");
+        goto done;
+    }
+    if((frame_count = lynx_read_config_file(cfg, &frames)) <= 0)
+    {
+        snprintf(item->error, sizeof(item->error), "failed to read config file");
+        goto done;
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_CONFIG);
+    lynx_stats_start(stats, &timer);
+    if(!lynx_map_file(&in, item->plaintext_file) || (in.size == 0))
+    {
+        snprintf(item->error, sizeof(item->error), "failed to open plaintext loader file");
+        goto done;
+    }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
 
-    /* clear out the frame struct */
-    memset(frame, 0, sizeof(plaintext_frame_t));
+    item->encrypted_size = lynx_encrypted_size(frames, frame_count);
+    if(item->encrypted_size == 0)
+    {
+        snprintf(item->error, sizeof(item->error), "invalid block count in config file");
+        goto done;
+    }
+
+    item->encrypted = malloc(item->encrypted_size);
+    item->jobs = calloc(frame_count * MAX_BLOCKS_PER_FRAME, sizeof(lynx_block_job_t));
+    item->tasks = calloc(frame_count * MAX_BLOCKS_PER_FRAME, sizeof(batch_task_t));
+    if(!item->encrypted || !item->jobs || !item->tasks)
+    {
+        snprintf(item->error, sizeof(item->error), "out of memory");
+        goto done;
+    }
+
+    lynx_stats_start(stats, &timer);
+    item->remaining = lynx_encode_image(item->jobs, item->encrypted, item->encrypted_size,
+                                        in.data, in.size, frames, frame_count);
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_CODEC);
+    if(item->remaining == 0)
+    {
+        snprintf(item->error, sizeof(item->error), "invalid frame offset in config file");
+        goto done;
+    }
+    lynx_stats_count(stats, LYNX_COUNT_FRAMES, frame_count);
+    lynx_stats_count(stats, LYNX_COUNT_BYTES_IN, item->remaining * PLAINTEXT_BLOCK_SIZE);
+
+    status = 1;
 
-    /* read the block count */
-    return (fread(frame->data, 1, MAX_PLAINTEXT_FRAME_SIZE, in) > 0);
+done:
+    if(cfg)
+        fclose(cfg);
+    lynx_unmap(&in);
+    free(frames);
+    item->failed = !status;
+    return status;
 }
 
 
-int process_frame(FILE * in, FILE * out, frame_def_t * frame)
+/* This runs a finished batch item through the boot ROM decryptor before it
+ * is written.  It happens on the main thread while the pool gets on with
+ * the blocks of the other images. */
+int verify_batch_item(batch_item_t * item)
 {
-    int detected_blocks = 0;
-    unsigned char tmp = 0;
-    plaintext_frame_t plaintext_frame;
-    encrypted_frame_t encrypted_frame;
- 
-    /* clear out the buffers */
-    memset(&encrypted_frame, 0, sizeof(encrypted_frame_t));
+    int err;
+    size_t size;
+    unsigned char * plaintext;
+    lynx_rom_t rom;
 
-    /* seek to the specified offset */
-    if(fseek(in, frame->offset, SEEK_SET) != 0)
+    if(item->failed)
+        return 0;
+
+    /* no frame is smaller than a block and its count byte */
+    size = (item->encrypted_size / (1 + ENCRYPTED_BLOCK_SIZE) + 1) * MAX_PLAINTEXT_FRAME_SIZE;
+    if(!(plaintext = malloc(size)))
     {
-        fprintf(stderr, "error: invalid frame offset %li\n", frame->offset);
+        snprintf(item->error, sizeof(item->error), "out of memory");
+        item->failed = 1;
         return 0;
     }
 
-    /* read in the next encrypted frame of data */
-    if(!read_plaintext_frame(in, &plaintext_frame))
+    err = lynx_verify_image(&rom, plaintext, size, item->encrypted, item->encrypted_size, 0);
+    free(plaintext);
+    if(err)
     {
-        fprintf(stderr, "error: failed to read plaintext block\n");
+        snprintf(item->error, sizeof(item->error), "fails the boot ROM checks (0x%02x)", err);
+        item->failed = 1;
         return 0;
     }
 
-    /* store the number of blocks to encrypt */
-    plaintext_frame.blocks = frame->blocks;
-
-    /* encrypt a single frame of the encrypted loader */
-    printf("Encrypting %d blocks of plaintext from offset 0x%08x\n", plaintext_frame.blocks, (unsigned int)frame->offset);
-    encrypt_frame(&encrypted_frame, &plaintext_frame, lynx_private_exp, lynx_public_mod);
- 
-    /* write the encrypted frame block count */
-    tmp = 256 - encrypted_frame.blocks;
-    fwrite(&tmp, sizeof(unsigned char), 1, out);
-
-    /* write the encrypted frame of data */
-    fwrite(encrypted_frame.data, (encrypted_frame.blocks * ENCRYPTED_BLOCK_SIZE), 1, out);
-
     return 1;
 }
 
-int read_frame_config(FILE * cfg, frame_def_t * frame, int line)
+
+/* This writes a finished batch item out and releases its buffers */
+void finish_batch_item(batch_item_t * item)
 {
-    long offset = 0;
-    int blocks = 0;
-    int state = 0;
-    int started = 0;
-    char c;
+    FILE * out;
+    lynx_timer_t timer;
 
-    while(fread(&c, 1, 1, cfg) == 1)
+    if(!item->failed)
     {
-        switch(state)
+        lynx_stats_start(stats, &timer);
+        out = fopen(item->encrypted_file, "wb+");
+        if(!out)
         {
-            case 0:
-            {
-                /* we're reading the offset */
-                if(isdigit(c))
-                {
-                    if(!started)
-                        started = 1;
-
-                    offset *= 10;
-                    offset += (c - '0');
-                }
-                else if(c == '\n')
-                {
-                    if(started)
-                    {
-                        /* error, looking for a comma */
-                        fprintf(stderr, 
-                            "syntax error: expecting ',' after offset on line %d\n", line);
-                    }
-                    return 0;
-                }
-                else if(c == ',')
-                {
-                    /* switch to blocks state */
-                    started = 0;
-                    state = 1;
-                }
-                else
-                {
-                    fprintf(stderr,
-                            "syntax error: expecting offset number on line %d\n", line);
-                    return 0;
-                }
-                break;
-            }
-            case 1:
+            snprintf(item->error, sizeof(item->error), "failed to open encrypted loader file for writing");
+            item->failed = 1;
+        }
+        else
+        {
+            if(!lynx_write_all(fileno(out), item->encrypted, item->encrypted_size))
             {
-                /* we're reading the blocks number */
-                if((c == ' ') || (c == '\t'))
-                {
-                    /* eat whitespace */
-                }
-                else if(isdigit(c))
-                {
-                    blocks *= 10;
-                    blocks += (c - '0');
-                }
-                else if(c == '\n')
-                {
-                    frame->offset = offset;
-                    frame->blocks = blocks;
-                    return 1;
-                }
-                else
-                {
-                    fprintf(stderr,
-                            "syntax error: expecting block number on line %d\n", line);
-                    return 0;
-                }
-                break;
+                snprintf(item->error, sizeof(item->error), "failed to write encrypted loader file");
+                item->failed = 1;
             }
+            fclose(out);
+            lynx_stats_stop(stats, &timer, LYNX_STAGE_WRITE);
+            lynx_stats_count(stats, LYNX_COUNT_BYTES_OUT, item->encrypted_size);
         }
     }
 
-    fprintf(stderr, 
-            "syntax error: reached EOF with incomplete frame definition, line %d\n", line);
-    return 0;
+    free(item->encrypted);
+    free(item->jobs);
+    free(item->tasks);
+    item->encrypted = 0;
+    item->jobs = 0;
+    item->tasks = 0;
 }
 
-int read_config_file(FILE * cfg, frame_def_t ** frames)
-{
-    int line = 1;
-    int frame_count = 0;
-    frame_def_t frame_def;
 
-    memset(&frame_def, 0, sizeof(frame_def_t));
+/* This is batch mode.  The key contexts are set up once, one per worker,
+ * and every block of every image in the manifest becomes a task for the
+ * work-stealing pool.  Only a bounded number of images are loaded at a time
+ * and each one is written out as soon as its last block is done, after the
+ * ROM checks with --verify.  It returns the number of items that failed. */
+int process_manifest(batch_item_t * items, int count, int threads, int verify)
+{
+    int i, j, blocks;
+    int next = 0;
+    int inflight = 0;
+    int finished = 0;
+    int failed = 0;
+    int max_inflight = threads * BATCH_IMAGES_PER_THREAD;
+    batch_item_t * item;
+    lynx_pool_t * pool = 0;
+    batch_t batch;
+
+    memset(&batch, 0, sizeof(batch_t));
+    pthread_mutex_init(&batch.lock, 0);
+    pthread_cond_init(&batch.done, 0);
+
+    pool = lynx_pool_new(threads, batch_ctx_new, batch_ctx_free);
+    if(!pool)
+    {
+        fprintf(stderr, "error: failed to start the worker threads\n");
+        failed = count;
+        goto cleanup;
+    }
 
-    while(read_frame_config(cfg, &frame_def, line))
+    while(finished < count)
     {
-        /* make room for this new frame */
-        (*frames) = realloc((*frames), (frame_count + 1) * sizeof(frame_def_t));
+        /* keep the pool fed without going over the in-flight limit */
+        while((inflight < max_inflight) && (next < count))
+        {
+            item = &items[next++];
+            if(!load_batch_item(item))
+            {
+                finish_batch_item(item);
+                finished++;
+                continue;
+            }
 
-        /* copy the new frame into place */
-        memcpy(&((*frames)[frame_count]), &frame_def, sizeof(frame_def_t));
+            /* the workers count remaining down, so it is read first */
+            inflight++;
+            blocks = item->remaining;
+            for(i = 0, j = 0; j < blocks; i++, j += LYNX_BATCH_BLOCKS)
+            {
+                item->tasks[i].batch = &batch;
+                item->tasks[i].item = item;
+                item->tasks[i].jobs = &item->jobs[j];
+                item->tasks[i].count = min(LYNX_BATCH_BLOCKS, blocks - j);
+            }
+            for(j = 0; j < i; j++)
+            {
+                while(!lynx_pool_submit(pool, batch_task, &item->tasks[j]))
+                    lynx_pool_wait(pool);
+            }
+        }
 
-        /* increment the line number */
-        line++;
+        if(inflight == 0)
+            continue;
+
+        /* wait for an image to finish */
+        pthread_mutex_lock(&batch.lock);
+        while(!batch.done_list)
+            pthread_cond_wait(&batch.done, &batch.lock);
+        item = batch.done_list;
+        batch.done_list = item->next_done;
+        pthread_mutex_unlock(&batch.lock);
+
+        if(verify)
+            verify_batch_item(item);
+        finish_batch_item(item);
+        inflight--;
+        finished++;
+    }
 
-        /* increment the total frame count */
-        frame_count++;
+    /* report on every item in manifest order */
+    for(i = 0; i < count; i++)
+    {
+        if(items[i].failed)
+        {
+            printf("FAILED %s (line %d): %s\n", items[i].encrypted_file, items[i].line, items[i].error);
+            failed++;
+        }
+        else
+        {
+            printf("ok     %s\n", items[i].encrypted_file);
+        }
     }
+    printf("%d of %d images encrypted\n", count - failed, count);
 
-    return frame_count;
+cleanup:
+    lynx_pool_free(pool);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.done);
+    return failed;
+}
+
+/* 1 if path is the file fd has open */
+int same_file(int fd, const char * path)
+{
+    struct stat a, b;
+
+    return (fstat(fd, &a) == 0) && (stat(path, &b) == 0) &&
+           (a.st_dev == b.st_dev) && (a.st_ino == b.st_ino);
 }
 
 void print_help(char * name)
 {
-    printf("usage: %s -c <config file> -p <plaintext binary> -e <encrypted binary>\n\n", name);
+    printf("usage: %s -c <config file> -p <plaintext binary> -e <encrypted binary> [-j <threads>] [-q] [--verify] [--stats[=json]] [--cache <file>]\n", name);
+    printf("       %s -c <config file> -p <plaintext binary> --lnx <cartridge> -e <new cartridge> [-j <threads>] [-q]\n", name);
+    printf("       %s --plan -p <plaintext binary> [-c <config file>] [-e <encrypted binary>] [-j <threads>] [-q]\n", name);
+    printf("       %s -m <manifest> [-j <threads>] [-q] [--verify] [--stats[=json]] [--cache <file>]\n", name);
+    printf("       %s --version\n\n", name);
+    printf("a manifest has one \"<config file> <plaintext binary> <encrypted binary>\" per line\n");
+    printf("the plaintext binary can be - for stdin and the encrypted binary - for stdout\n\n");
+    printf("    --plan           work out the smallest frame layout for the plaintext and\n");
+    printf("                     write it to the config file, or stdout without -c\n");
+    printf("    --lnx <cart>     write a copy of the .lnx cartridge image with the encrypted\n");
+    printf("                     loader at the start of bank 0 instead of the bare loader\n");
+    printf("    --verify         run every frame through the boot ROM decryptor as soon\n");
+    printf("                     as it is encrypted and fail if the ROM would reject it\n");
+    printf("    --cache <file>   keep the encrypted blocks in file and only encrypt the\n");
+    printf("                     blocks that aren't already in it\n");
+    printf("    -q, --quiet      don't dump every block\n");
+    printf("    --stats[=json]   print the time spent in each stage to stderr\n\n");
 }
 
+/* the long options, each of them maps onto a short one */
+static struct option long_options[] =
+{
+    { "help",       no_argument,        0, 'h' },
+    { "version",    no_argument,        0, 'V' },
+    { "quiet",      no_argument,        0, 'q' },
+    { "stats",      optional_argument,  0, 'S' },
+    { "plan",       no_argument,        0, 'P' },
+    { "cache",      required_argument,  0, 'C' },
+    { "lnx",        required_argument,  0, 'L' },
+    { "verify",     no_argument,        0, 'v' },
+    { 0, 0, 0, 0 }
+};
+
 int main (int argc, char ** argv) 
 {
-    FILE *in;
-    FILE *out;
-    FILE *cfg;
+    lynx_map_t in = LYNX_MAP_INIT;
+    FILE *out = 0;
+    FILE *cfg = 0;
     int i;
     int opt;
     int status;
     int frame_count = 0;
+    int threads = 1;
+    int plan = 0;
+    int verify = 0;
+    int stream;
+    size_t size = 0;
+    size_t written;
+    unsigned char * encrypted = 0;
     char * cfg_file = 0;
     char * plaintext_file = 0;
     char * encrypted_file = 0;
-    frame_def_t * frames = 0;
-
-    if(argc < 3)
+    char * manifest_file = 0;
+    int item_count = 0;
+    batch_item_t * items = 0;
+    verify_job_t * checks = 0;
+    plaintext_frame_t pad;
+    lynx_frame_def_t * frames = 0;
+    lynx_ctx_t * ctx = 0;
+    lynx_stats_t run_stats;
+    lynx_timer_t timer;
+    int json = 0;
+
+    if(argc < 2)
     {
         print_help(argv[0]);
         return EXIT_FAILURE;
     }
 
     /* parse the command line options */
-    while((opt = getopt(argc, argv, "hc:p:e:")) != -1) 
+    while((opt = getopt_long(argc, argv, "hqc:p:e:j:m:", long_options, 0)) != -1) 
     {
         switch(opt) 
         {
@@ -431,10 +1005,62 @@ int main (int argc, char ** argv)
             case 'e':
                 encrypted_file = strdup(optarg);
                 break;
+            case 'm':
+                manifest_file = strdup(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if(threads < 1)
+                {
+                    fprintf(stderr, "error: invalid thread count: %s\n\n", optarg);
+                    status = EXIT_FAILURE;
+                    goto cleanup;
+                }
+                break;
             case 'h':
                 print_help(argv[0]);
                 status = EXIT_SUCCESS;
                 goto cleanup;
+            case 'V':
+                lynx_print_version("lynxenc");
+                status = EXIT_SUCCESS;
+                goto cleanup;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'P':
+                plan = 1;
+                break;
+            case 'v':
+                verify = 1;
+                break;
+            case 'C':
+                if(!cache && !(cache = lynx_cache_open(optarg)))
+                {
+                    status = EXIT_FAILURE;
+                    goto cleanup;
+                }
+                break;
+            case 'L':
+                if(!cart && (!(cart = malloc(sizeof(lynx_lnx_t))) || !lynx_lnx_open(cart, optarg)))
+                {
+                    free(cart);
+                    cart = 0;
+                    status = EXIT_FAILURE;
+                    goto cleanup;
+                }
+                break;
+            case 'S':
+                if(optarg && strcmp(optarg, "json"))
+                {
+                    fprintf(stderr, "error: unknown stats format: %s\n\n", optarg);
+                    status = EXIT_FAILURE;
+                    goto cleanup;
+                }
+                json = (optarg != 0);
+                lynx_stats_init(&run_stats);
+                stats = &run_stats;
+                break;
             case ':':
                 fprintf(stderr, "error: option `%c' needs a value\n\n", optopt);
                 status = EXIT_FAILURE;
@@ -446,70 +1072,243 @@ int main (int argc, char ** argv)
         }
     }
 
-    if(!cfg_file || !plaintext_file || !encrypted_file)
+    /* batch mode */
+    if(manifest_file && cart)
+    {
+        fprintf(stderr, "error: --lnx doesn't work with a manifest\n\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    if(manifest_file)
+    {
+        if(!(cfg = fopen(manifest_file, "r")))
+        {
+            fprintf(stderr, "failed to open manifest file: %s\n\n", manifest_file);
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        if((item_count = read_manifest(cfg, &items)) <= 0)
+        {
+            fprintf(stderr, "failed to read manifest file\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+
+        status = process_manifest(items, item_count, threads, verify) ? EXIT_FAILURE : EXIT_SUCCESS;
+        goto cleanup;
+    }
+
+    if(!plaintext_file || (!plan && (!cfg_file || !encrypted_file)))
     {
         print_help(argv[0]);
         status = EXIT_FAILURE;
         goto cleanup;
     }
 
-    /* open the files */
-    in = fopen(plaintext_file, "rb");
-    out = fopen(encrypted_file, "wb+");
-    cfg = fopen(cfg_file, "r");
+    /* opening the output would wipe out the cartridge image before it is
+     * copied */
+    if(cart && encrypted_file && same_file(cart->fd, encrypted_file))
+    {
+        fprintf(stderr, "error: the new cartridge image has to be a different file\n\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
 
-    /* check for successful opens */
-    if(!in)
+    /* open the files, with --plan the config file is written instead of
+     * read and the encrypted binary is optional */
+    lynx_stats_start(stats, &timer);
+    if(!lynx_map_open(&in, plaintext_file))
     {
         fprintf(stderr, "failed to open plaintext loader file: %s\n\n", plaintext_file);
         status = EXIT_FAILURE;
         goto cleanup;
     }
-    if(!out)
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_READ);
+    if(encrypted_file && (strcmp(encrypted_file, "-") == 0))
+    {
+        /* the block dumps would end up in the binary */
+        if(plan && !cfg_file)
+        {
+            fprintf(stderr, "the config and the encrypted binary can't both go to stdout\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        out = stdout;
+        quiet = 1;
+    }
+    else if(encrypted_file)
+        out = fopen(encrypted_file, "wb+");
+
+    /* the same goes for a config written to stdout */
+    if(plan && !cfg_file)
+        quiet = 1;
+    if(cfg_file)
+        cfg = fopen(cfg_file, plan ? "w" : "r");
+
+    /* check for successful opens */
+    if(encrypted_file && !out)
     {
         fprintf(stderr, "failed to open encrypted loader file for writing: %s\n\n", encrypted_file);
         status = EXIT_FAILURE;
         goto cleanup;
     }
-    if(!cfg)
+    if(cfg_file && !cfg)
     {
         fprintf(stderr, "failed to open config file: %s\n\n", cfg_file);
         status = EXIT_FAILURE;
         goto cleanup;
     }
 
-    /* read in the frames config file */
-    if((frame_count = read_config_file(cfg, &frames)) <= 0)
+    /* read in the frames config file, or work it out and write it */
+    lynx_stats_start(stats, &timer);
+    if(plan)
+    {
+        /* the layout depends on all of the plaintext */
+        if(!lynx_map_fill(&in, (size_t)-1))
+        {
+            fprintf(stderr, "failed to read plaintext loader file: %s\n\n", plaintext_file);
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        if((in.size == 0) || ((frame_count = lynx_plan_frames(in.data, in.size, &frames)) <= 0))
+        {
+            fprintf(stderr, "failed to plan the frame layout\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+        if(!lynx_write_config_file(cfg ? cfg : stdout, frames, frame_count))
+        {
+            fprintf(stderr, "failed to write config file\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+    }
+    else if((frame_count = lynx_read_config_file(cfg, &frames)) <= 0)
     {
         fprintf(stderr, "failed to read config file\n\n");
         status = EXIT_FAILURE;
         goto cleanup;
     }
+    lynx_stats_stop(stats, &timer, LYNX_STAGE_CONFIG);
+
+    /* --plan on its own only writes the config */
+    if(!out)
+    {
+        lynx_map_drain(&in);
+        status = EXIT_SUCCESS;
+        goto cleanup;
+    }
+
+    /* start the verifier, it gets as many threads as the encryption */
+    if(verify)
+    {
+        checks = calloc(frame_count, sizeof(verify_job_t));
+        verifier = lynx_pool_new(threads, verify_rom_new, verify_rom_free);
+        if(!checks || !verifier)
+        {
+            fprintf(stderr, "failed to start the verifier\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+    }
+
+    /* encrypt the blocks on a pool of threads */
+    if(threads > 1)
+    {
+        if(!process_frames_parallel(&in, out, frames, frame_count, threads, checks))
+        {
+            fprintf(stderr, "failed to process frames\n\n");
+            status = EXIT_FAILURE;
+            goto cleanup;
+        }
+
+        lynx_map_drain(&in);
+        status = (verify && verify_report(checks, frame_count)) ? EXIT_FAILURE : EXIT_SUCCESS;
+        goto cleanup;
+    }
+
+    /* set up the crypto context */
+    if(!(ctx = lynx_ctx_new()))
+    {
+        fprintf(stderr, "failed to set up the crypto context\n\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
+    lynx_ctx_set_verbose(ctx, !quiet);
+    lynx_ctx_set_stats(ctx, stats);
+    lynx_ctx_set_cache(ctx, cache);
+
+    /* the whole image is built up in memory, the block counts aren't
+     * checked yet so there is room for the biggest frames.  in a pipeline
+     * each frame goes out as soon as it is done instead. */
+    stream = !cart && ((in.fd >= 0) || lynx_is_stream(fileno(out)));
+    if(!(encrypted = malloc((stream ? 1 : frame_count) * (1 + MAX_ENCRYPTED_FRAME_SIZE))))
+    {
+        fprintf(stderr, "out of memory\n\n");
+        status = EXIT_FAILURE;
+        goto cleanup;
+    }
 
     /* process the frames */
     for(i = 0; i < frame_count; i++)
     {
-        /* process the first frame of plaintext data */
-        if(!process_frame(in, out, &frames[i]))
+        /* process the next frame of plaintext data */
+        if(!(written = process_frame(ctx, &in, &encrypted[size], &frames[i], i)))
         {
             fprintf(stderr, "failed to process frame %d\n\n", i);
             status = EXIT_FAILURE;
             goto cleanup;
         }
+
+        /* the verifier checks it while the next one is encrypted */
+        if(verify)
+            verify_frame(&checks[i], &frames[i], &encrypted[size], frame_plaintext(&in, &frames[i], &pad));
+        size += written;
+
+        if(stream && !write_image(out, encrypted, size))
+            break;
+        if(stream)
+            size = 0;
+    }
+
+    /* and written out in one go */
+    if((i < frame_count) || !write_image(out, encrypted, size))
+    {
+        fprintf(stderr, "failed to write encrypted loader file: %s\n\n", encrypted_file);
+        status = EXIT_FAILURE;
+        goto cleanup;
     }
 
-    status = EXIT_SUCCESS;
+    lynx_map_drain(&in);
+    status = (verify && verify_report(checks, frame_count)) ? EXIT_FAILURE : EXIT_SUCCESS;
 
 cleanup:
-    fclose(in);
-    fclose(out);
-    fclose(cfg);
+    lynx_pool_free(verifier);
+    free(checks);
+    lynx_unmap(&in);
+    free(encrypted);
+    if(out && (out != stdout))
+        fclose(out);
+    if(cfg)
+        fclose(cfg);
+    if(stats)
+        lynx_stats_print(stderr, stats, json);
+    if(frames)
+        free(frames);
+    lynx_ctx_free(ctx);
+    lynx_cache_close(cache);
+    if(cart)
+        lynx_lnx_close(cart);
+    free(cart);
     if(plaintext_file)
         free(plaintext_file);
     if(encrypted_file)
         free(encrypted_file);
     if(cfg_file)
         free(cfg_file);
+    if(manifest_file)
+        free(manifest_file);
+    free_manifest(items, item_count);
     return status;
 }
 
@@ -0,0 +1,187 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * See lynxlnx.h.  The header and the new loader go out with one writev and
+ * the rest of the ROM with copy_file_range, which on most filesystems is a
+ * reflink or an in-kernel copy.  Where that isn't possible, like writing to
+ * a pipe, sendfile does it, and a plain read and write loop is the last
+ * resort.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "lynxlnx.h"
+#include "lynxmap.h"
+
+
+static size_t get_le16(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+int lynx_lnx_open(lynx_lnx_t * cart, const char * path)
+{
+    struct stat st;
+
+    memset(cart, 0, sizeof(lynx_lnx_t));
+
+    if(((cart->fd = open(path, O_RDONLY)) < 0) || (fstat(cart->fd, &st) != 0))
+    {
+        fprintf(stderr, "failed to open cartridge image: %s\n", path);
+        lynx_lnx_close(cart);
+        return 0;
+    }
+
+    if(!S_ISREG(st.st_mode) ||
+       (pread(cart->fd, cart->header, LYNX_LNX_HEADER_SIZE, 0) != LYNX_LNX_HEADER_SIZE) ||
+       (memcmp(cart->header, "LYNX", 4) != 0))
+    {
+        fprintf(stderr, "not a .lnx cartridge image: %s\n", path);
+        lynx_lnx_close(cart);
+        return 0;
+    }
+
+    cart->size = st.st_size;
+    cart->bank0 = get_le16(&cart->header[4]) * LYNX_LNX_BANK_PAGES;
+    cart->bank1 = get_le16(&cart->header[6]) * LYNX_LNX_BANK_PAGES;
+    if((cart->bank0 == 0) || (cart->size < LYNX_LNX_HEADER_SIZE + cart->bank0))
+    {
+        fprintf(stderr, "bank 0 doesn't fit in the cartridge image: %s\n", path);
+        lynx_lnx_close(cart);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void lynx_lnx_close(lynx_lnx_t * cart)
+{
+    if(cart->fd >= 0)
+        close(cart->fd);
+    cart->fd = -1;
+}
+
+
+/* This copies from the cartridge image at offset to the end, onto the end
+ * of out */
+static int copy_rest(lynx_lnx_t * cart, int out, off_t offset)
+{
+    ssize_t n;
+    size_t left = cart->size - offset;
+    unsigned char buf[65536];
+
+    /* in the kernel, file to file */
+    while(left > 0)
+    {
+        n = copy_file_range(cart->fd, &offset, out, 0, left, 0);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n <= 0)
+            break;
+        left -= n;
+    }
+
+    /* in the kernel, to anything */
+    while(left > 0)
+    {
+        n = sendfile(out, cart->fd, &offset, left);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n <= 0)
+            break;
+        left -= n;
+    }
+
+    /* the long way round */
+    while(left > 0)
+    {
+        n = pread(cart->fd, buf, (left < sizeof(buf)) ? left : sizeof(buf), offset);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if((n <= 0) || !lynx_write_all(out, buf, n))
+            return 0;
+        offset += n;
+        left -= n;
+    }
+
+    return 1;
+}
+
+
+int lynx_lnx_splice(lynx_lnx_t * cart,
+                    int out,
+                    const unsigned char * loader,
+                    const size_t size)
+{
+    ssize_t n;
+    struct iovec iov[2];
+    struct iovec * v = iov;
+    int count = 2;
+
+    if(size > cart->bank0)
+    {
+        fprintf(stderr, "the %lu byte loader doesn't fit in the %lu byte bank 0\n",
+                (unsigned long)size, (unsigned long)cart->bank0);
+        return 0;
+    }
+
+    iov[0].iov_base = cart->header;
+    iov[0].iov_len = LYNX_LNX_HEADER_SIZE;
+    iov[1].iov_base = (void *)loader;
+    iov[1].iov_len = size;
+
+    /* the header and the loader in one go */
+    while(count > 0)
+    {
+        n = writev(out, v, count);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n < 0)
+            return 0;
+
+        while((count > 0) && ((size_t)n >= v->iov_len))
+        {
+            n -= v->iov_len;
+            v++;
+            count--;
+        }
+        if(count > 0)
+        {
+            v->iov_base = (unsigned char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+
+    return copy_rest(cart, out, LYNX_LNX_HEADER_SIZE + size);
+}
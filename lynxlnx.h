@@ -0,0 +1,72 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * .lnx cartridge images.  A .lnx file is the 64 byte header emulators and
+ * flash carts use, followed by the ROM, bank 0 first.  The header, all
+ * numbers little endian:
+ *
+ *   0   "LYNX"
+ *   4   uint16_t bank 0 page size
+ *   6   uint16_t bank 1 page size
+ *   8   uint16_t version
+ *   10  char[32] cartridge name
+ *   42  char[16] manufacturer
+ *   58  uint8_t  rotation
+ *   59  5 spare bytes
+ *
+ * A bank is 256 pages, so its size is 256 times its page size.  The boot
+ * ROM reads the encrypted loader from the very start of bank 0, which is
+ * where lynx_lnx_splice puts a new one.  Everything after it is copied
+ * from the old image by the kernel, without going through user space.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXLNX_H_
+#define _LYNXLNX_H_
+
+#include <stddef.h>
+
+#define LYNX_LNX_HEADER_SIZE        (64)
+#define LYNX_LNX_BANK_PAGES         (256)
+
+typedef struct lynx_lnx_s
+{
+    int fd;
+    size_t size;                                /* of the whole file */
+    size_t bank0;                               /* in bytes */
+    size_t bank1;
+    unsigned char header[LYNX_LNX_HEADER_SIZE]; /* as it is in the file */
+} lynx_lnx_t;
+
+/* open a .lnx image and check its header */
+int lynx_lnx_open(lynx_lnx_t * cart, const char * path);
+void lynx_lnx_close(lynx_lnx_t * cart);
+
+/* write the image to out with loader in place of the start of bank 0 */
+int lynx_lnx_splice(lynx_lnx_t * cart,
+                    int out,
+                    const unsigned char * loader,
+                    const size_t size);
+
+#endif /* _LYNXLNX_H_ */
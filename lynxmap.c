@@ -0,0 +1,232 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * See lynxmap.h.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lynxmap.h"
+
+#define min(x,y) ((x < y) ? x : y)
+
+
+int lynx_is_stream(int fd)
+{
+    struct stat st;
+
+    return (fstat(fd, &st) == 0) && !S_ISREG(st.st_mode);
+}
+
+
+int lynx_map_stream(lynx_map_t * map, int fd)
+{
+    memset(map, 0, sizeof(lynx_map_t));
+    map->fd = fd;
+
+    return 1;
+}
+
+
+int lynx_map_open(lynx_map_t * map, const char * path)
+{
+    int fd = 0;
+    int status;
+
+    memset(map, 0, sizeof(lynx_map_t));
+    map->fd = -1;
+
+    if(strcmp(path, "-") && ((fd = open(path, O_RDONLY)) < 0))
+        return 0;
+
+    if(!lynx_is_stream(fd))
+    {
+        status = lynx_map_fd(map, fd);
+        if(fd != 0)
+            close(fd);
+        return status;
+    }
+
+    lynx_map_stream(map, fd);
+    map->opened = (fd != 0);
+    return 1;
+}
+
+
+/* This reads only as far as it was asked to, so nothing past the end of
+ * what the caller needs is ever held on to */
+int lynx_map_fill(lynx_map_t * map, size_t size)
+{
+    ssize_t n;
+    size_t room;
+    unsigned char * data = (unsigned char *)map->data;
+
+    while((map->fd >= 0) && !map->eof && (map->size < size))
+    {
+        if(map->size == map->room)
+        {
+            room = map->room ? (map->room * 2) : 65536;
+            if(!(data = realloc(data, room)))
+                return 0;
+            map->data = data;
+            map->room = room;
+        }
+
+        n = read(map->fd, data + map->size, min(map->room, size) - map->size);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n < 0)
+            return 0;
+        if(n == 0)
+            map->eof = 1;
+        map->size += n;
+    }
+
+    return 1;
+}
+
+
+void lynx_map_drain(lynx_map_t * map)
+{
+    unsigned char buf[4096];
+
+    while((map->fd >= 0) && !map->eof)
+    {
+        if(lynx_read_full(map->fd, buf, sizeof(buf)) != sizeof(buf))
+            map->eof = 1;
+    }
+}
+
+
+size_t lynx_read_full(int fd, void * data, size_t len)
+{
+    ssize_t n;
+    size_t done = 0;
+
+    while(done < len)
+    {
+        n = read(fd, (unsigned char *)data + done, len - done);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+
+int lynx_map_fd(lynx_map_t * map, int fd)
+{
+    void * data;
+    struct stat st;
+
+    memset(map, 0, sizeof(lynx_map_t));
+    map->fd = -1;
+
+    if(fstat(fd, &st) != 0)
+        return 0;
+
+    /* anything that can't be mapped is streamed in to the end */
+    if(!S_ISREG(st.st_mode) || (st.st_size == 0) ||
+       ((data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+    {
+        lynx_map_stream(map, fd);
+        if(!lynx_map_fill(map, (size_t)-1))
+        {
+            lynx_unmap(map);
+            return 0;
+        }
+        map->fd = -1;
+        return 1;
+    }
+
+    /* the frames are read front to back */
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    map->data = data;
+    map->size = st.st_size;
+    map->mapped = 1;
+    return 1;
+}
+
+
+int lynx_map_file(lynx_map_t * map, const char * path)
+{
+    int fd;
+    int status;
+
+    memset(map, 0, sizeof(lynx_map_t));
+    map->fd = -1;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+
+    /* the mapping stays good after the file is closed */
+    status = lynx_map_fd(map, fd);
+    close(fd);
+
+    return status;
+}
+
+
+void lynx_unmap(lynx_map_t * map)
+{
+    if(map->opened)
+        close(map->fd);
+    if(map->mapped)
+        munmap((void *)map->data, map->size);
+    else
+        free((void *)map->data);
+
+    memset(map, 0, sizeof(lynx_map_t));
+    map->fd = -1;
+}
+
+
+int lynx_write_all(int fd, const void * data, size_t size)
+{
+    ssize_t n;
+    const unsigned char * p = data;
+
+    while(size > 0)
+    {
+        n = write(fd, p, size);
+        if((n < 0) && (errno == EINTR))
+            continue;
+        if(n <= 0)
+            return 0;
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
@@ -0,0 +1,89 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * Whole-file input and output for the tools.  An input file is mapped
+ * read-only so the frames and blocks can be used straight out of the page
+ * cache instead of being copied through stdio a frame at a time.  Anything
+ * that can't be mapped, like a pipe or an empty file, is read into memory
+ * instead, so the callers never have to care which one they got.
+ *
+ * A pipe can also be read a bit at a time with lynx_map_stream.  Then the
+ * map only holds what has been asked for with lynx_map_fill so far, which
+ * lets the tools start work before the rest of the input has arrived and
+ * never hold more of it than they need.
+ *
+ * Output goes the other way: the tools build the whole image in one buffer
+ * and hand it to lynx_write_all, which is a single write unless the kernel
+ * takes less than all of it.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXMAP_H_
+#define _LYNXMAP_H_
+
+#include <stddef.h>
+
+typedef struct lynx_map_s
+{
+    const unsigned char * data;
+    size_t size;
+    int mapped;         /* 1 if data is an mmap, 0 if it was malloc'd */
+    int fd;             /* the stream, -1 if it is all here */
+    int eof;            /* the stream has ended */
+    int opened;         /* fd was opened by lynx_map_open, so it closes it */
+    size_t room;
+} lynx_map_t;
+
+#define LYNX_MAP_INIT               { 0, 0, 0, -1, 0, 0, 0 }
+
+/* map a whole file, or everything readable from fd.  returns 0 on failure. */
+int lynx_map_file(lynx_map_t * map, const char * path);
+int lynx_map_fd(lynx_map_t * map, int fd);
+void lynx_unmap(lynx_map_t * map);
+
+/* 1 if fd is something that has to be streamed, like a pipe */
+int lynx_is_stream(int fd);
+
+/* open path for reading, "-" being stdin.  a file is mapped whole and
+ * anything else is set up to be streamed. */
+int lynx_map_open(lynx_map_t * map, const char * path);
+
+/* start streaming from fd without reading anything yet, then read on until
+ * the map holds at least size bytes or the input ends.  filling a map that
+ * is all there already does nothing.  both return 0 on a read error. */
+int lynx_map_stream(lynx_map_t * map, int fd);
+int lynx_map_fill(lynx_map_t * map, size_t size);
+
+/* read what is left of a stream and throw it away, so whatever is writing
+ * to the pipe doesn't get a SIGPIPE */
+void lynx_map_drain(lynx_map_t * map);
+
+/* read len bytes from fd, less only at the end of the input.  returns how
+ * many it read. */
+size_t lynx_read_full(int fd, void * data, size_t len);
+
+/* write all of data to fd, 0 on failure */
+int lynx_write_all(int fd, const void * data, size_t size);
+
+#endif /* _LYNXMAP_H_ */
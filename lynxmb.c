@@ -0,0 +1,413 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The SIMD kernels are compiled with per-function target options so the
+ * library still runs on any x86-64.  The widest kernel the CPU can run is
+ * picked at run time and everything else falls back to lynxmont.c.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <string.h>
+#include "lynxmb.h"
+#include "lynxchains.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef unsigned __int128 lynx_dlimb_t;
+
+/* one kernel and what it needs, for 16 and 8 limbs */
+typedef void (*mb_exp_fn_t)(const lynx_mb_t * mb, uint64_t * x, const unsigned char * exponent, int len);
+typedef void (*mb_cube_fn_t)(const lynx_mb_t * mb, uint64_t * x);
+typedef void (*mb_chain_fn_t)(const lynx_mb_t * mb, uint64_t * x, int chain);
+typedef struct mb_kernel_s
+{
+    const char * name;
+    int lanes;
+    mb_exp_fn_t exp16;
+    mb_cube_fn_t cube16;
+    mb_exp_fn_t exp8;
+    mb_cube_fn_t cube8;
+    mb_chain_fn_t chain8;       /* the CRT exponents, see lynxchains.h */
+} mb_kernel_t;
+
+#if defined(__x86_64__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define MB_VEC              __m256i
+#define MB_LANES            (4)
+#define MB_SET1(x)          _mm256_set1_epi64x(x)
+#define MB_ZERO()           _mm256_setzero_si256()
+#define MB_ADD(x,y)         _mm256_add_epi64(x, y)
+#define MB_MUL(x,y)         _mm256_mul_epu32(x, y)
+#define MB_AND(x,y)         _mm256_and_si256(x, y)
+#define MB_SRLI(x,n)        _mm256_srli_epi64(x, n)
+#define MB_LOAD(p)          _mm256_load_si256((const __m256i *)(p))
+#define MB_STORE(p,x)       _mm256_store_si256((__m256i *)(p), x)
+#define MB_LIMBS            (16)
+#define MB_FN(x)            mb_##x##_avx2_16
+#include "lynxmbk.h"
+#undef MB_LIMBS
+#undef MB_FN
+#define MB_LIMBS            (8)
+#define MB_FN(x)            mb_##x##_avx2_8
+#include "lynxmbk.h"
+#undef MB_LIMBS
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_SET1
+#undef MB_ZERO
+#undef MB_ADD
+#undef MB_MUL
+#undef MB_AND
+#undef MB_SRLI
+#undef MB_LOAD
+#undef MB_STORE
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define MB_VEC              __m512i
+#define MB_LANES            (8)
+#define MB_SET1(x)          _mm512_set1_epi64(x)
+#define MB_ZERO()           _mm512_setzero_si512()
+#define MB_ADD(x,y)         _mm512_add_epi64(x, y)
+#define MB_MUL(x,y)         _mm512_mul_epu32(x, y)
+#define MB_AND(x,y)         _mm512_and_si512(x, y)
+#define MB_SRLI(x,n)        _mm512_srli_epi64(x, n)
+#define MB_LOAD(p)          _mm512_load_si512((const void *)(p))
+#define MB_STORE(p,x)       _mm512_store_si512((void *)(p), x)
+#define MB_LIMBS            (16)
+#define MB_FN(x)            mb_##x##_avx512_16
+#include "lynxmbk.h"
+#undef MB_LIMBS
+#undef MB_FN
+#define MB_LIMBS            (8)
+#define MB_FN(x)            mb_##x##_avx512_8
+#include "lynxmbk.h"
+#undef MB_LIMBS
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_SET1
+#undef MB_ZERO
+#undef MB_ADD
+#undef MB_MUL
+#undef MB_AND
+#undef MB_SRLI
+#undef MB_LOAD
+#undef MB_STORE
+#pragma GCC pop_options
+
+static const mb_kernel_t mb_avx512 = { "avx512", 8,
+                                       mb_exp_avx512_16, mb_cube_avx512_16,
+                                       mb_exp_avx512_8, mb_cube_avx512_8,
+                                       mb_exp_chain_avx512_8 };
+static const mb_kernel_t mb_avx2 = { "avx2", 4,
+                                     mb_exp_avx2_16, mb_cube_avx2_16,
+                                     mb_exp_avx2_8, mb_cube_avx2_8,
+                                     mb_exp_chain_avx2_8 };
+
+#endif
+
+static const mb_kernel_t mb_scalar = { "scalar", 1, 0, 0, 0, 0, 0 };
+
+
+/* pick the widest kernel this CPU can run */
+static const mb_kernel_t * mb_pick(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return &mb_avx512;
+    if(__builtin_cpu_supports("avx2"))
+        return &mb_avx2;
+#endif
+    return &mb_scalar;
+}
+
+
+int lynx_mb_lanes(void)
+{
+    return mb_pick()->lanes;
+}
+
+
+const char * lynx_mb_kernel(void)
+{
+    return mb_pick()->name;
+}
+
+
+/* split 64-bit limbs into 29-bit limbs for one lane */
+static void mb_split(uint64_t * x, int limbs, int lanes, const uint64_t * a)
+{
+    int j, w, off;
+    uint64_t v;
+
+    for(j = 0; j < limbs; j++)
+    {
+        w = (j * LYNX_MB_LIMB_BITS) / 64;
+        off = (j * LYNX_MB_LIMB_BITS) % 64;
+
+        v = a[w] >> off;
+        if((off > 64 - LYNX_MB_LIMB_BITS) && (w + 1 < LYNX_MONT_LIMBS))
+            v |= a[w + 1] << (64 - off);
+
+        x[j * lanes] = v & LYNX_MB_LIMB_MASK;
+    }
+}
+
+
+/* join 29-bit limbs of one lane back into 64-bit limbs */
+static void mb_join(uint64_t * r, const uint64_t * x, int limbs, int lanes)
+{
+    int j, w, off;
+    uint64_t v;
+
+    memset(r, 0, sizeof(lynx_limbs_t));
+    for(j = 0; j < limbs; j++)
+    {
+        w = (j * LYNX_MB_LIMB_BITS) / 64;
+        off = (j * LYNX_MB_LIMB_BITS) % 64;
+        v = x[j * lanes];
+
+        r[w] |= v << off;
+        if((off > 64 - LYNX_MB_LIMB_BITS) && (w + 1 < LYNX_MONT_LIMBS))
+            r[w + 1] |= v >> (64 - off);
+    }
+}
+
+
+/* r = r - n if r >= n, the kernels leave their results below 2n */
+static void mb_reduce(const lynx_mb_t * mb, uint64_t * r)
+{
+    int i;
+    uint64_t d[LYNX_MONT_LIMBS];
+    uint64_t borrow = 0;
+    uint64_t mask;
+    lynx_dlimb_t x;
+
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        x = (lynx_dlimb_t)r[i] - mb->mont.n[i] - borrow;
+        d[i] = (uint64_t)x;
+        borrow = (uint64_t)(x >> 64) & 1;
+    }
+
+    mask = borrow - 1;
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        r[i] = (d[i] & mask) | (r[i] & ~mask);
+    }
+}
+
+
+int lynx_mb_init(lynx_mb_t * mb, const unsigned char * modulus, int len)
+{
+    int i, k;
+    uint32_t inv;
+    uint64_t x[LYNX_MB_LIMBS];
+    lynx_limbs_t t;
+
+    memset(mb, 0, sizeof(lynx_mb_t));
+
+    /* the same limits as the scalar engine, which also gives us the modulus
+     * and its R**2 = 2**896 in 64-bit limbs to work from */
+    if(!lynx_mont_init(&mb->mont, modulus, len))
+        return 0;
+
+    /* 8 limbs will do when the modulus is under 2**230 */
+    mb->limbs = LYNX_MB_LIMBS;
+    if((mb->mont.n[3] >> 38) == 0)
+    {
+        for(i = 4; (i < LYNX_MONT_LIMBS) && (mb->mont.n[i] == 0); i++);
+        if(i == LYNX_MONT_LIMBS)
+            mb->limbs = LYNX_MB_LIMBS / 2;
+    }
+
+    mb_split(x, mb->limbs, 1, mb->mont.n);
+    for(i = 0; i < mb->limbs; i++)
+    {
+        mb->n[i] = (uint32_t)x[i];
+    }
+
+    /* inv = 1/n mod 2**32 by Newton's method, see lynx_mont_init */
+    inv = mb->n[0];
+    for(i = 0; i < 4; i++)
+    {
+        inv *= 2 - (mb->n[0] * inv);
+    }
+    mb->n0 = (0 - inv) & LYNX_MB_LIMB_MASK;
+
+    /* R**2 mod n from the scalar engine's 2**896.  Its multiply by y gives
+     * y * 2**896 / 2**448, so one multiply by a small power of 2 gets
+     * 2**464 for 8 limbs and squaring first gets 2**928 for 16 */
+    k = 2 * LYNX_MB_LIMB_BITS * mb->limbs;
+    if(k >= 2 * 448)
+    {
+        lynx_mont_mul(&mb->mont, t, mb->mont.rr, mb->mont.rr);
+        k -= 2 * 448;
+    }
+    else
+    {
+        memcpy(t, mb->mont.rr, sizeof(t));
+        k -= 448;
+    }
+    memset(x, 0, sizeof(x));
+    x[0] = (uint64_t)1 << k;
+    lynx_mont_mul(&mb->mont, t, t, x);
+
+    mb_split(x, mb->limbs, 1, t);
+    for(i = 0; i < mb->limbs; i++)
+    {
+        mb->rr[i] = (uint32_t)x[i];
+    }
+
+    return 1;
+}
+
+
+/* This runs the blocks through a kernel one group of lanes at a time.  A
+ * short last group just has some idle lanes.  The kernel is the chain when
+ * there is one, then the exponent, then the cube. */
+static void mb_run(const lynx_mb_t * mb,
+                   const mb_kernel_t * k,
+                   unsigned char ** r,
+                   unsigned char ** a,
+                   int count,
+                   int size,
+                   const unsigned char * exponent,
+                   int len,
+                   int chain)
+{
+    int i, l, lanes;
+    lynx_limbs_t t;
+    uint64_t x[LYNX_MB_LIMBS * LYNX_MB_LANES_MAX] __attribute__((aligned(64)));
+    mb_exp_fn_t exp = (mb->limbs == LYNX_MB_LIMBS) ? k->exp16 : k->exp8;
+    mb_cube_fn_t cube = (mb->limbs == LYNX_MB_LIMBS) ? k->cube16 : k->cube8;
+
+    for(i = 0; i < count; i += k->lanes)
+    {
+        lanes = count - i;
+        if(lanes > k->lanes)
+            lanes = k->lanes;
+
+        memset(x, 0, sizeof(x));
+        for(l = 0; l < lanes; l++)
+        {
+            lynx_mont_load_le(t, a[i + l], size);
+            mb_split(&x[l], mb->limbs, k->lanes, t);
+        }
+
+        if(chain >= 0)
+            k->chain8(mb, x, chain);
+        else if(exponent)
+            exp(mb, x, exponent, len);
+        else
+            cube(mb, x);
+
+        for(l = 0; l < lanes; l++)
+        {
+            mb_join(t, &x[l], mb->limbs, k->lanes);
+            mb_reduce(mb, t);
+            lynx_mont_store_le(r[i + l], t, size);
+        }
+    }
+}
+
+
+void lynx_mb_exp(const lynx_mb_t * mb,
+                 unsigned char ** r,
+                 unsigned char ** a,
+                 int count,
+                 int size,
+                 const unsigned char * exponent,
+                 int len)
+{
+    int i;
+    lynx_limbs_t x;
+    const mb_kernel_t * k = mb_pick();
+
+    if(k->exp16)
+    {
+        mb_run(mb, k, r, a, count, size, exponent, len, -1);
+        return;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        lynx_mont_load_le(x, a[i], size);
+        lynx_mont_exp(&mb->mont, x, x, exponent, len);
+        lynx_mont_store_le(r[i], x, size);
+    }
+}
+
+
+void lynx_mb_cube(const lynx_mb_t * mb,
+                  unsigned char ** r,
+                  unsigned char ** a,
+                  int count,
+                  int size)
+{
+    int i;
+    lynx_limbs_t x;
+    const mb_kernel_t * k = mb_pick();
+
+    if(k->cube16)
+    {
+        mb_run(mb, k, r, a, count, size, 0, 0, -1);
+        return;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        lynx_mont_load_le(x, a[i], size);
+        lynx_mont_cube(&mb->mont, x, x);
+        lynx_mont_store_le(r[i], x, size);
+    }
+}
+
+
+void lynx_mb_exp_chain(const lynx_mb_t * mb,
+                       unsigned char ** r,
+                       unsigned char ** a,
+                       int count,
+                       int size,
+                       int chain)
+{
+    const mb_kernel_t * k = mb_pick();
+
+    /* the chains are only built for the 8 limb kernels */
+    if(k->chain8 && (mb->limbs == LYNX_MB_LIMBS / 2))
+    {
+        mb_run(mb, k, r, a, count, size, 0, 0, chain);
+        return;
+    }
+
+    lynx_mb_exp(mb, r, a, count, size, lynx_chain_crt[chain].exponent, lynx_chain_crt[chain].len);
+}
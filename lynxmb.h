@@ -0,0 +1,97 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is a multi-buffer Montgomery engine.  Every block in an image is an
+ * independent exponentiation with the same modulus and exponent, so instead
+ * of speeding up one block at a time this runs several blocks side by side,
+ * one per SIMD lane: 4 with AVX2 and 8 with AVX-512.  The numbers are held
+ * as limbs of 29 bits so the 32 x 32 -> 64 bit vector multiplies (vpmuludq)
+ * can be summed up without carrying after every step.  A full size Lynx
+ * modulus takes 16 limbs, the primes of a CRT key take 8.  When the CPU has
+ * neither, the blocks go through the scalar engine in lynxmont.c.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXMB_H_
+#define _LYNXMB_H_
+
+#include <stdint.h>
+#include "lynxmont.h"
+
+/* 16 * 29 = 464 bits.  R = 2**(29 * limbs) has to be more than 4 times the
+ * modulus so the final subtraction can be left until the very end. */
+#define LYNX_MB_LIMBS               (16)
+#define LYNX_MB_LIMB_BITS           (29)
+#define LYNX_MB_LIMB_MASK           ((1 << LYNX_MB_LIMB_BITS) - 1)
+
+/* the most blocks any kernel runs at once */
+#define LYNX_MB_LANES_MAX           (8)
+
+/* everything that only depends on the modulus */
+typedef struct lynx_mb_s
+{
+    lynx_mont_t mont;               /* the scalar fallback */
+    int limbs;                      /* 8 or 16 */
+    uint32_t n[LYNX_MB_LIMBS];      /* the modulus */
+    uint32_t rr[LYNX_MB_LIMBS];     /* R**2 mod n, R = 2**(29 * limbs) */
+    uint32_t n0;                    /* -1/n mod 2**29 */
+} lynx_mb_t;
+
+
+/* set up the engine for a big endian modulus of 'len' bytes */
+int lynx_mb_init(lynx_mb_t * mb, const unsigned char * modulus, int len);
+
+/* how many blocks the kernel picked for this CPU runs at once, and its name */
+int lynx_mb_lanes(void);
+const char * lynx_mb_kernel(void);
+
+/* r[i] = a[i]**e mod n for 'count' numbers of 'size' bytes each, least
+ * significant byte first.  The exponent is big endian, 'len' bytes.  r[i]
+ * may be the same buffer as a[i]. */
+void lynx_mb_exp(const lynx_mb_t * mb,
+                 unsigned char ** r,
+                 unsigned char ** a,
+                 int count,
+                 int size,
+                 const unsigned char * exponent,
+                 int len);
+
+/* r[i] = a[i]**e mod n, the same as lynx_mb_exp with e one of the CRT
+ * exponents in lynxchains.h, LYNX_CHAIN_DP or LYNX_CHAIN_DQ.  Those are run
+ * from the chains lynxchain unrolled at build time. */
+void lynx_mb_exp_chain(const lynx_mb_t * mb,
+                       unsigned char ** r,
+                       unsigned char ** a,
+                       int count,
+                       int size,
+                       int chain);
+
+/* r[i] = a[i]**3 mod n, same layout as lynx_mb_exp */
+void lynx_mb_cube(const lynx_mb_t * mb,
+                  unsigned char ** r,
+                  unsigned char ** a,
+                  int count,
+                  int size);
+
+#endif /* _LYNXMB_H_ */
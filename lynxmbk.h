@@ -0,0 +1,233 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is the body of the multi-buffer kernel.  It is not a normal header,
+ * lynxmb.c includes it once for each instruction set and limb count after
+ * defining MB_VEC
+ * (the vector type), MB_LANES (64-bit lanes in MB_VEC), MB_FN (the name
+ * suffix), MB_LIMBS (8 or 16) and the MB_* operations on MB_VEC.
+ *
+ * Each lane holds one number as MB_LIMBS limbs of 29 bits and the limbs are
+ * kept in 64-bit accumulators.  A product of two limbs is under 2**58 and a
+ * limb of the running total picks up at most two of them in each of the 16
+ * steps, so it stays under 2**63 and the carries only have to be pushed
+ * through once, at the end of each multiply.
+ *
+ * Because R = 2**(29 * MB_LIMBS) > 4n, a multiply of two numbers below 2n
+ * gives a result below 2n, so the conditional subtraction is skipped here
+ * and done once per block when the result is unpacked.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+
+/* r = a*b/R mod n (below 2n), r may alias a or b.  Instead of shifting the
+ * running total down a limb after every step, step i works on t[i] up and
+ * the result is left in the top half of t. */
+static void MB_FN(mul)(MB_VEC * r,
+                       const MB_VEC * a,
+                       const MB_VEC * b,
+                       const MB_VEC * n,
+                       const MB_VEC n0)
+{
+    int i, j;
+    MB_VEC t[2 * MB_LIMBS + 1];
+    MB_VEC m, c;
+    MB_VEC mask = MB_SET1(LYNX_MB_LIMB_MASK);
+
+    for(j = 0; j <= 2 * MB_LIMBS; j++)
+    {
+        t[j] = MB_ZERO();
+    }
+
+    for(i = 0; i < MB_LIMBS; i++)
+    {
+        /* t += a * b[i] * 2**(29 * i) */
+        for(j = 0; j < MB_LIMBS; j++)
+        {
+            t[i + j] = MB_ADD(t[i + j], MB_MUL(a[j], b[i]));
+        }
+
+        /* t += m * n * 2**(29 * i), which clears the low 29 bits of t[i]
+         * so only its carry moves up */
+        m = MB_AND(MB_MUL(t[i], n0), mask);
+        for(j = 0; j < MB_LIMBS; j++)
+        {
+            t[i + j] = MB_ADD(t[i + j], MB_MUL(n[j], m));
+        }
+        t[i + 1] = MB_ADD(t[i + 1], MB_SRLI(t[i], LYNX_MB_LIMB_BITS));
+    }
+
+    /* push the carries through the top half */
+    c = MB_ZERO();
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        t[MB_LIMBS + j] = MB_ADD(t[MB_LIMBS + j], c);
+        c = MB_SRLI(t[MB_LIMBS + j], LYNX_MB_LIMB_BITS);
+        r[j] = MB_AND(t[MB_LIMBS + j], mask);
+    }
+}
+
+
+/* broadcast a constant from the key schedule to every lane */
+static void MB_FN(splat)(MB_VEC * r, const uint32_t * a)
+{
+    int j;
+
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        r[j] = MB_SET1(a[j]);
+    }
+}
+
+
+/* x = x**e mod n (below 2n) for MB_LANES numbers.  x is the limbs of all the
+ * lanes, limb by limb. */
+static void MB_FN(exp)(const lynx_mb_t * mb,
+                       uint64_t * x,
+                       const unsigned char * exponent,
+                       int len)
+{
+    int i, j, bit;
+    int started = 0;
+    MB_VEC n[MB_LIMBS];
+    MB_VEC base[MB_LIMBS];
+    MB_VEC t[MB_LIMBS];
+    MB_VEC n0 = MB_SET1(mb->n0);
+
+    MB_FN(splat)(n, mb->n);
+    MB_FN(splat)(t, mb->rr);
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        base[j] = MB_LOAD(&x[j * MB_LANES]);
+    }
+
+    /* into the Montgomery domain */
+    MB_FN(mul)(base, base, t, n, n0);
+
+    /* left to right square and multiply, starting at the top set bit so
+     * there is no multiply by one */
+    for(i = 0; i < len; i++)
+    {
+        for(bit = 7; bit >= 0; bit--)
+        {
+            if(started)
+                MB_FN(mul)(t, t, t, n, n0);
+
+            if(exponent[i] & (1 << bit))
+            {
+                if(started)
+                    MB_FN(mul)(t, t, base, n, n0);
+                else
+                    memcpy(t, base, sizeof(t));
+                started = 1;
+            }
+        }
+    }
+
+    /* back out of the domain by multiplying with 1, x**0 is just 1 */
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        base[j] = MB_ZERO();
+    }
+    base[0] = MB_SET1(1);
+    if(started)
+        MB_FN(mul)(base, t, base, n, n0);
+
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        MB_STORE(&x[j * MB_LANES], base[j]);
+    }
+}
+
+
+/* x = x**3 mod n (below 2n), the same way lynx_mont_cube does it */
+static void MB_FN(cube)(const lynx_mb_t * mb, uint64_t * x)
+{
+    int j;
+    MB_VEC n[MB_LIMBS];
+    MB_VEC a[MB_LIMBS];
+    MB_VEC ar[MB_LIMBS];
+    MB_VEC t[MB_LIMBS];
+    MB_VEC n0 = MB_SET1(mb->n0);
+
+    MB_FN(splat)(n, mb->n);
+    MB_FN(splat)(t, mb->rr);
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        a[j] = MB_LOAD(&x[j * MB_LANES]);
+    }
+
+    MB_FN(mul)(ar, a, t, n, n0);
+    MB_FN(mul)(t, ar, a, n, n0);
+    MB_FN(mul)(t, t, ar, n, n0);
+
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        MB_STORE(&x[j * MB_LANES], t[j]);
+    }
+}
+
+
+#if MB_LIMBS == 8
+
+#include "lynxmbchains.h"
+
+/* x = x**e mod n (below 2n) like MB_FN(exp), with e the CRT exponent
+ * LYNX_CHAIN_DP or LYNX_CHAIN_DQ run from its unrolled chain */
+static void MB_FN(exp_chain)(const lynx_mb_t * mb, uint64_t * x, int chain)
+{
+    int j;
+    MB_VEC n[MB_LIMBS];
+    MB_VEC base[MB_LIMBS];
+    MB_VEC t[MB_LIMBS];
+    MB_VEC n0 = MB_SET1(mb->n0);
+
+    MB_FN(splat)(n, mb->n);
+    MB_FN(splat)(t, mb->rr);
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        base[j] = MB_LOAD(&x[j * MB_LANES]);
+    }
+
+    /* into the Montgomery domain, through the chain and back out */
+    MB_FN(mul)(base, base, t, n, n0);
+    if(chain == LYNX_CHAIN_DP)
+        MB_FN(chain_dp)(t, base, n, n0);
+    else
+        MB_FN(chain_dq)(t, base, n, n0);
+
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        base[j] = MB_ZERO();
+    }
+    base[0] = MB_SET1(1);
+    MB_FN(mul)(base, t, base, n, n0);
+
+    for(j = 0; j < MB_LIMBS; j++)
+    {
+        MB_STORE(&x[j * MB_LANES], base[j]);
+    }
+}
+
+#endif
@@ -0,0 +1,452 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The byte-wise MontMult in lynxrom.c does 51 x 51 single byte
+ * multiply-adds for every product.  This does the same job with seven 64-bit
+ * limbs (7 x 7 128-bit multiply-adds) using the CIOS (coarsely integrated
+ * operand scanning) form of Montgomery multiplication.  The final
+ * subtraction is done with a mask instead of a branch.
+ *
+ * The Lynx modulus is only 406 bits long so there is plenty of head room in
+ * the top limb; nothing here can overflow for moduli under 2**446.
+ *
+ * On x86-64 CPUs with BMI2 and ADX there is a second version of the multiply
+ * that does each row with mulx and two independent carry chains, adcx for
+ * the low halves of the products and adox for the high halves.  Which one
+ * lynx_mont_mul is gets decided once, when the library is loaded, through a
+ * GNU indirect function.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <string.h>
+#include "lynxmont.h"
+
+typedef unsigned __int128 lynx_dlimb_t;
+
+
+/* r = a - n if a >= n, where a has an extra top limb */
+static void mont_reduce(const lynx_mont_t * mont,
+                        uint64_t * r,
+                        const uint64_t * a,
+                        const uint64_t top)
+{
+    int i;
+    uint64_t d[LYNX_MONT_LIMBS];
+    uint64_t borrow = 0;
+    uint64_t mask;
+    lynx_dlimb_t x;
+
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        x = (lynx_dlimb_t)a[i] - mont->n[i] - borrow;
+        d[i] = (uint64_t)x;
+        borrow = (uint64_t)(x >> 64) & 1;
+    }
+    borrow = (top < borrow);
+
+    /* all ones when a >= n, so d is selected */
+    mask = borrow - 1;
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        r[i] = (d[i] & mask) | (a[i] & ~mask);
+    }
+}
+
+
+/* r = 2*a mod n */
+static void mont_double(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a)
+{
+    int i;
+    uint64_t t[LYNX_MONT_LIMBS];
+    uint64_t top = a[LYNX_MONT_LIMBS - 1] >> 63;
+
+    for(i = LYNX_MONT_LIMBS - 1; i > 0; i--)
+    {
+        t[i] = (a[i] << 1) | (a[i - 1] >> 63);
+    }
+    t[0] = a[0] << 1;
+
+    mont_reduce(mont, r, t, top);
+}
+
+
+int lynx_mont_init(lynx_mont_t * mont, const unsigned char * modulus, int len)
+{
+    int i;
+    uint64_t inv;
+    lynx_limbs_t r;
+
+    memset(mont, 0, sizeof(lynx_mont_t));
+
+    /* the modulus has to be odd and leave some head room in the top limb */
+    if((len <= 0) || (len >= LYNX_MONT_BYTES) || !(modulus[len - 1] & 1))
+        return 0;
+
+    lynx_mont_load_be(mont->n, modulus, len);
+
+    /* inv = 1/n mod 2**64 by Newton's method, each step doubles the number
+     * of correct bits starting from the 3 that n*n = 1 mod 8 gives us */
+    inv = mont->n[0];
+    for(i = 0; i < 5; i++)
+    {
+        inv *= 2 - (mont->n[0] * inv);
+    }
+    mont->n0 = (uint64_t)0 - inv;
+
+    /* R**2 mod n by doubling 1 up 2 * 448 times */
+    memset(r, 0, sizeof(r));
+    r[0] = 1;
+    for(i = 0; i < 2 * 64 * LYNX_MONT_LIMBS; i++)
+    {
+        mont_double(mont, r, r);
+    }
+    memcpy(mont->rr, r, sizeof(r));
+
+    return 1;
+}
+
+
+void lynx_mont_load_le(uint64_t * r, const unsigned char * bytes, int len)
+{
+    int i;
+
+    memset(r, 0, sizeof(lynx_limbs_t));
+    for(i = 0; i < len; i++)
+    {
+        r[i / 8] |= (uint64_t)bytes[i] << (8 * (i % 8));
+    }
+}
+
+
+void lynx_mont_load_be(uint64_t * r, const unsigned char * bytes, int len)
+{
+    int i;
+
+    memset(r, 0, sizeof(lynx_limbs_t));
+    for(i = 0; i < len; i++)
+    {
+        r[i / 8] |= (uint64_t)bytes[(len - 1) - i] << (8 * (i % 8));
+    }
+}
+
+
+void lynx_mont_store_le(unsigned char * bytes, const uint64_t * a, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+    {
+        bytes[i] = (unsigned char)(a[i / 8] >> (8 * (i % 8)));
+    }
+}
+
+
+void lynx_mont_store_be(unsigned char * bytes, const uint64_t * a, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+    {
+        bytes[(len - 1) - i] = (unsigned char)(a[i / 8] >> (8 * (i % 8)));
+    }
+}
+
+
+static void mont_mul_generic(const lynx_mont_t * mont,
+                             uint64_t * r,
+                             const uint64_t * a,
+                             const uint64_t * b)
+{
+    int i, j;
+    uint64_t t[LYNX_MONT_LIMBS + 2];
+    uint64_t m, c;
+    lynx_dlimb_t x;
+
+    memset(t, 0, sizeof(t));
+
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        /* t += a * b[i] */
+        c = 0;
+        for(j = 0; j < LYNX_MONT_LIMBS; j++)
+        {
+            x = (lynx_dlimb_t)a[j] * b[i] + t[j] + c;
+            t[j] = (uint64_t)x;
+            c = (uint64_t)(x >> 64);
+        }
+        x = (lynx_dlimb_t)t[LYNX_MONT_LIMBS] + c;
+        t[LYNX_MONT_LIMBS] = (uint64_t)x;
+        t[LYNX_MONT_LIMBS + 1] = (uint64_t)(x >> 64);
+
+        /* t = (t + m * n) / 2**64 */
+        m = t[0] * mont->n0;
+        x = (lynx_dlimb_t)m * mont->n[0] + t[0];
+        c = (uint64_t)(x >> 64);
+        for(j = 1; j < LYNX_MONT_LIMBS; j++)
+        {
+            x = (lynx_dlimb_t)m * mont->n[j] + t[j] + c;
+            t[j - 1] = (uint64_t)x;
+            c = (uint64_t)(x >> 64);
+        }
+        x = (lynx_dlimb_t)t[LYNX_MONT_LIMBS] + c;
+        t[LYNX_MONT_LIMBS - 1] = (uint64_t)x;
+        t[LYNX_MONT_LIMBS] = t[LYNX_MONT_LIMBS + 1] + (uint64_t)(x >> 64);
+    }
+
+    mont_reduce(mont, r, t, t[LYNX_MONT_LIMBS]);
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__ELF__)
+
+#define LYNX_MONT_ADX
+
+/* One step of a row.  T0 holds t[j], which already has the high half of the
+ * previous product in it, and T1 gets t[j + 1] loaded.  The low half of
+ * a[j] * rdx goes into T0 on the CF chain and the high half into T1 on the
+ * OF chain, then T0 is stored at 'out'.  The next step swaps T0 and T1. */
+#define ADX_STEP(aj, next, T0, T1, out) \
+    "movq " #next "(%[t]), %%" #T1 "\n\t" \
+    "mulxq " #aj "(%[a]), %%r10, %%r11\n\t" \
+    "adcxq %%r10, %%" #T0 "\n\t" \
+    "adoxq %%r11, %%" #T1 "\n\t" \
+    out
+
+#define ADX_STORE(T0, off) "movq %%" #T0 ", " #off "(%[t])\n\t"
+
+/* t[0..8] += a * b, a being 7 limbs */
+static inline void mont_row_adx(uint64_t * t, const uint64_t * a, uint64_t b)
+{
+    __asm__ volatile(
+        "xorl %%eax, %%eax\n\t"
+        "movq 0(%[t]), %%r8\n\t"
+        ADX_STEP(0, 8, r8, r9, ADX_STORE(r8, 0))
+        ADX_STEP(8, 16, r9, r8, ADX_STORE(r9, 8))
+        ADX_STEP(16, 24, r8, r9, ADX_STORE(r8, 16))
+        ADX_STEP(24, 32, r9, r8, ADX_STORE(r9, 24))
+        ADX_STEP(32, 40, r8, r9, ADX_STORE(r8, 32))
+        ADX_STEP(40, 48, r9, r8, ADX_STORE(r9, 40))
+        ADX_STEP(48, 56, r8, r9, ADX_STORE(r8, 48))
+        /* r9 is t[7] and still owes the CF carry, which can carry on into
+         * t[8] along with the OF carry */
+        "movq 64(%[t]), %%r8\n\t"
+        "adcxq %%rax, %%r9\n\t"
+        "adoxq %%rax, %%r8\n\t"
+        "adcxq %%rax, %%r8\n\t"
+        ADX_STORE(r9, 56)
+        ADX_STORE(r8, 64)
+        :
+        : [t] "r" (t), [a] "r" (a), "d" (b)
+        : "rax", "r8", "r9", "r10", "r11", "cc", "memory");
+}
+
+/* t[0..8] = (t + n * m) / 2**64, where m was picked to make the low limb 0.
+ * The same as mont_row_adx except each limb is stored one place down. */
+static inline void mont_reduce_row_adx(uint64_t * t, const uint64_t * n, uint64_t m)
+{
+    __asm__ volatile(
+        "xorl %%eax, %%eax\n\t"
+        "movq 0(%[t]), %%r8\n\t"
+        ADX_STEP(0, 8, r8, r9, "")
+        ADX_STEP(8, 16, r9, r8, ADX_STORE(r9, 0))
+        ADX_STEP(16, 24, r8, r9, ADX_STORE(r8, 8))
+        ADX_STEP(24, 32, r9, r8, ADX_STORE(r9, 16))
+        ADX_STEP(32, 40, r8, r9, ADX_STORE(r8, 24))
+        ADX_STEP(40, 48, r9, r8, ADX_STORE(r9, 32))
+        ADX_STEP(48, 56, r8, r9, ADX_STORE(r8, 40))
+        "movq 64(%[t]), %%r8\n\t"
+        "adcxq %%rax, %%r9\n\t"
+        "adoxq %%rax, %%r8\n\t"
+        "adcxq %%rax, %%r8\n\t"
+        ADX_STORE(r9, 48)
+        ADX_STORE(r8, 56)
+        "movq %%rax, 64(%[t])\n\t"
+        :
+        : [t] "r" (t), [a] "r" (n), "d" (m)
+        : "rax", "r8", "r9", "r10", "r11", "cc", "memory");
+}
+
+/* the same CIOS loop as mont_mul_generic, a row at a time */
+static void mont_mul_adx(const lynx_mont_t * mont,
+                         uint64_t * r,
+                         const uint64_t * a,
+                         const uint64_t * b)
+{
+    int i;
+    uint64_t t[LYNX_MONT_LIMBS + 2];
+
+    memset(t, 0, sizeof(t));
+
+    for(i = 0; i < LYNX_MONT_LIMBS; i++)
+    {
+        mont_row_adx(t, a, b[i]);
+        mont_reduce_row_adx(t, mont->n, t[0] * mont->n0);
+    }
+
+    mont_reduce(mont, r, t, t[LYNX_MONT_LIMBS]);
+}
+
+
+/* mulx is BMI2, adcx and adox are ADX */
+static int mont_has_adx(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx");
+}
+
+
+/* the resolver for lynx_mont_mul, run once by the dynamic loader (or at
+ * start up for a static binary) */
+typedef void (*mont_mul_fn_t)(const lynx_mont_t *, uint64_t *, const uint64_t *, const uint64_t *);
+static mont_mul_fn_t mont_pick_mul(void)
+{
+    return mont_has_adx() ? mont_mul_adx : mont_mul_generic;
+}
+
+void lynx_mont_mul(const lynx_mont_t * mont,
+                   uint64_t * r,
+                   const uint64_t * a,
+                   const uint64_t * b) __attribute__((ifunc("mont_pick_mul")));
+
+#else
+
+void lynx_mont_mul(const lynx_mont_t * mont,
+                   uint64_t * r,
+                   const uint64_t * a,
+                   const uint64_t * b)
+{
+    mont_mul_generic(mont, r, a, b);
+}
+
+#endif
+
+
+const char * lynx_mont_kernel(void)
+{
+#if defined(LYNX_MONT_ADX)
+    if(mont_has_adx())
+        return "mulx/adx";
+#endif
+    return "generic";
+}
+
+
+void lynx_mont_to(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a)
+{
+    lynx_mont_mul(mont, r, a, mont->rr);
+}
+
+
+void lynx_mont_from(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a)
+{
+    lynx_limbs_t one;
+
+    memset(one, 0, sizeof(one));
+    one[0] = 1;
+    lynx_mont_mul(mont, r, a, one);
+}
+
+
+void lynx_mont_exp(const lynx_mont_t * mont,
+                   uint64_t * r,
+                   const uint64_t * a,
+                   const unsigned char * exponent,
+                   int len)
+{
+    int i, bit;
+    int started = 0;
+    lynx_limbs_t base;
+    lynx_limbs_t t;
+
+    /* t = 1 in the Montgomery domain, i.e. R mod n */
+    memset(t, 0, sizeof(t));
+    t[0] = 1;
+    lynx_mont_to(mont, t, t);
+    lynx_mont_to(mont, base, a);
+
+    /* left to right square and multiply, skipping the leading zero bits */
+    for(i = 0; i < len; i++)
+    {
+        for(bit = 7; bit >= 0; bit--)
+        {
+            if(started)
+                lynx_mont_mul(mont, t, t, t);
+
+            if(exponent[i] & (1 << bit))
+            {
+                lynx_mont_mul(mont, t, t, base);
+                started = 1;
+            }
+        }
+    }
+
+    lynx_mont_from(mont, r, t);
+}
+
+
+/* a**3 is one square and one multiply.  Multiplying the Montgomery form of
+ * a (aR) by plain a gives a*a, and multiplying that by aR again gives a*a*a,
+ * so there is no conversion back out of the domain. */
+void lynx_mont_cube(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a)
+{
+    lynx_limbs_t ar;
+    lynx_limbs_t t;
+
+    lynx_mont_to(mont, ar, a);
+    lynx_mont_mul(mont, t, ar, a);
+    lynx_mont_mul(mont, r, t, ar);
+}
+
+
+void lynx_mont_mod_exp(unsigned char * A,
+                       const unsigned char * B,
+                       const unsigned char * exponent,
+                       const unsigned char * modulus,
+                       const int m)
+{
+    int i;
+    lynx_mont_t mont;
+    lynx_limbs_t a;
+    unsigned char n[LYNX_MONT_BYTES];
+    unsigned char e[LYNX_MONT_BYTES];
+
+    /* lynx_mont_init would turn this length down too, but n and e have to
+     * hold it before we get that far */
+    if((m <= 0) || (m >= LYNX_MONT_BYTES))
+        return;
+
+    /* the engine wants the modulus and exponent big endian */
+    for(i = 0; i < m; i++)
+    {
+        n[i] = modulus[(m - 1) - i];
+        e[i] = exponent[(m - 1) - i];
+    }
+
+    if(!lynx_mont_init(&mont, n, m))
+        return;
+
+    lynx_mont_load_le(a, B, m);
+    lynx_mont_exp(&mont, a, a, e, m);
+    lynx_mont_store_le(A, a, m);
+}
@@ -0,0 +1,95 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is a fixed width Montgomery engine for the Lynx key size.  The
+ * 408 bit (51 byte) numbers are held in seven 64-bit limbs, least
+ * significant limb first, and the products are done with 128-bit
+ * multiplies instead of the byte at a time loops in lynxrom.c.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXMONT_H_
+#define _LYNXMONT_H_
+
+#include <stdint.h>
+
+/* 7 * 64 = 448 bits, enough for the 408 bit Lynx numbers */
+#define LYNX_MONT_LIMBS             (7)
+#define LYNX_MONT_BYTES             (LYNX_MONT_LIMBS * 8)
+
+typedef uint64_t lynx_limbs_t[LYNX_MONT_LIMBS];
+
+/* everything that only depends on the modulus */
+typedef struct lynx_mont_s
+{
+    lynx_limbs_t n;         /* the modulus */
+    lynx_limbs_t rr;        /* R**2 mod n, R = 2**448 */
+    uint64_t n0;            /* -1/n mod 2**64 */
+} lynx_mont_t;
+
+
+/* set up the engine for a big endian modulus of 'len' bytes */
+int lynx_mont_init(lynx_mont_t * mont, const unsigned char * modulus, int len);
+
+/* move numbers in and out of limbs.  _le is least significant byte first
+ * (the encrypted block layout), _be is most significant byte first (the
+ * keys.h and OpenSSL layout). */
+void lynx_mont_load_le(uint64_t * r, const unsigned char * bytes, int len);
+void lynx_mont_load_be(uint64_t * r, const unsigned char * bytes, int len);
+void lynx_mont_store_le(unsigned char * bytes, const uint64_t * a, int len);
+void lynx_mont_store_be(unsigned char * bytes, const uint64_t * a, int len);
+
+/* r = a*b/R mod n, r may alias a or b */
+void lynx_mont_mul(const lynx_mont_t * mont,
+                   uint64_t * r,
+                   const uint64_t * a,
+                   const uint64_t * b);
+
+/* the name of the multiply picked for this CPU, "mulx/adx" or "generic" */
+const char * lynx_mont_kernel(void);
+
+/* convert into and out of the Montgomery domain */
+void lynx_mont_to(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a);
+void lynx_mont_from(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a);
+
+/* r = a**e mod n, with a big endian exponent of 'len' bytes.  a and r are
+ * normal (not Montgomery domain) numbers less than n. */
+void lynx_mont_exp(const lynx_mont_t * mont,
+                   uint64_t * r,
+                   const uint64_t * a,
+                   const unsigned char * exponent,
+                   int len);
+
+/* r = a**3 mod n, the Lynx public exponent */
+void lynx_mont_cube(const lynx_mont_t * mont, uint64_t * r, const uint64_t * a);
+
+/* drop-in replacement for lynx_mod_exp: all operands have the least
+ * significant byte first.  A = B**exponent mod modulus */
+void lynx_mont_mod_exp(unsigned char * A,
+                       const unsigned char * B,
+                       const unsigned char * exponent,
+                       const unsigned char * modulus,
+                       const int m);
+
+#endif /* _LYNXMONT_H_ */
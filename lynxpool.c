@@ -0,0 +1,357 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The deques are plain growable ring buffers with their own lock.  The
+ * tasks here are whole RSA steps, tens of microseconds each, so a lock per
+ * push/pop is noise and keeps this a lot simpler than a lock-free deque.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lynxpool.h"
+
+typedef struct lynx_task_s
+{
+    lynx_task_fn_t fn;
+    void * arg;
+} lynx_task_t;
+
+typedef struct lynx_deque_s
+{
+    pthread_mutex_t lock;
+    lynx_task_t * tasks;
+    int size;       /* allocated slots, always a power of 2 */
+    int head;       /* oldest task, where thieves steal from */
+    int count;
+} lynx_deque_t;
+
+typedef struct lynx_worker_s
+{
+    lynx_pool_t * pool;
+    pthread_t thread;
+    lynx_deque_t deque;
+    void * state;
+    int index;
+    int started;
+} lynx_worker_t;
+
+struct lynx_pool_s
+{
+    int threads;
+    lynx_worker_t * workers;
+    lynx_state_new_fn_t state_new;
+    lynx_state_free_fn_t state_free;
+
+    /* pending counts queued but unfinished tasks, the workers sleep on
+     * work when there is nothing to steal and wait() sleeps on idle */
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    int pending;
+    int queued;
+    int next;
+    int stop;
+};
+
+/* the worker the current thread is, so submits from inside a task stay on
+ * the local deque */
+static __thread lynx_worker_t * current_worker = 0;
+
+
+static int deque_push(lynx_deque_t * deque, lynx_task_fn_t fn, void * arg)
+{
+    int i;
+    int size;
+    lynx_task_t * tasks;
+
+    pthread_mutex_lock(&deque->lock);
+
+    /* grow the ring, unrolling it into the new buffer */
+    if(deque->count == deque->size)
+    {
+        size = deque->size ? (deque->size * 2) : 64;
+        tasks = malloc(size * sizeof(lynx_task_t));
+        if(!tasks)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            return 0;
+        }
+        for(i = 0; i < deque->count; i++)
+        {
+            tasks[i] = deque->tasks[(deque->head + i) & (deque->size - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->size = size;
+        deque->head = 0;
+    }
+
+    deque->tasks[(deque->head + deque->count) & (deque->size - 1)].fn = fn;
+    deque->tasks[(deque->head + deque->count) & (deque->size - 1)].arg = arg;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+
+/* the owner takes the newest task */
+static int deque_pop(lynx_deque_t * deque, lynx_task_t * task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0)
+    {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) & (deque->size - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+
+/* thieves take the oldest task */
+static int deque_steal(lynx_deque_t * deque, lynx_task_t * task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0)
+    {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) & (deque->size - 1);
+        deque->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+
+/* look in our own deque first, then go around the others */
+static int find_task(lynx_worker_t * worker, lynx_task_t * task)
+{
+    int i;
+    lynx_pool_t * pool = worker->pool;
+
+    if(deque_pop(&worker->deque, task))
+        return 1;
+
+    for(i = 1; i < pool->threads; i++)
+    {
+        if(deque_steal(&pool->workers[(worker->index + i) % pool->threads].deque, task))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+static void * worker_main(void * arg)
+{
+    lynx_worker_t * worker = (lynx_worker_t *)arg;
+    lynx_pool_t * pool = worker->pool;
+    lynx_task_t task;
+
+    current_worker = worker;
+
+    while(1)
+    {
+        if(find_task(worker, &task))
+        {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(worker->state, task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if(pool->pending == 0)
+                pthread_cond_broadcast(&pool->idle);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        /* nothing to do, sleep until something is queued */
+        pthread_mutex_lock(&pool->lock);
+        while(!pool->stop && (pool->queued == 0))
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if(pool->stop && (pool->queued == 0))
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return 0;
+}
+
+
+lynx_pool_t * lynx_pool_new(int threads,
+                            lynx_state_new_fn_t state_new,
+                            lynx_state_free_fn_t state_free)
+{
+    int i;
+    lynx_pool_t * pool;
+
+    if(threads < 1)
+        return 0;
+
+    pool = calloc(1, sizeof(lynx_pool_t));
+    if(!pool)
+        return 0;
+
+    pool->workers = calloc(threads, sizeof(lynx_worker_t));
+    if(!pool->workers)
+    {
+        free(pool);
+        return 0;
+    }
+
+    pool->threads = threads;
+    pool->state_new = state_new;
+    pool->state_free = state_free;
+    pthread_mutex_init(&pool->lock, 0);
+    pthread_cond_init(&pool->work, 0);
+    pthread_cond_init(&pool->idle, 0);
+
+    for(i = 0; i < threads; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, 0);
+    }
+
+    /* the worker state is made up front so a failure fails the whole pool
+     * instead of leaving tasks nobody can run */
+    for(i = 0; i < threads; i++)
+    {
+        if(state_new && !(pool->workers[i].state = state_new()))
+        {
+            lynx_pool_free(pool);
+            return 0;
+        }
+    }
+
+    for(i = 0; i < threads; i++)
+    {
+        if(pthread_create(&pool->workers[i].thread, 0, worker_main, &pool->workers[i]) != 0)
+        {
+            lynx_pool_free(pool);
+            return 0;
+        }
+        pool->workers[i].started = 1;
+    }
+
+    return pool;
+}
+
+
+int lynx_pool_submit(lynx_pool_t * pool, lynx_task_fn_t fn, void * arg)
+{
+    lynx_worker_t * worker = current_worker;
+
+    /* count it first so a worker can never finish it before it is counted */
+    pthread_mutex_lock(&pool->lock);
+    if(!worker || (worker->pool != pool))
+    {
+        worker = &pool->workers[pool->next];
+        pool->next = (pool->next + 1) % pool->threads;
+    }
+    pool->pending++;
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(!deque_push(&worker->deque, fn, arg))
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pool->queued--;
+        if(pool->pending == 0)
+            pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 1;
+}
+
+
+void lynx_pool_wait(lynx_pool_t * pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while(pool->pending > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void lynx_pool_free(lynx_pool_t * pool)
+{
+    int i;
+
+    if(!pool)
+        return;
+
+    lynx_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* every worker has to be gone before any deque goes away, the others
+     * may still be trying to steal from it */
+    for(i = 0; i < pool->threads; i++)
+    {
+        if(pool->workers[i].started)
+            pthread_join(pool->workers[i].thread, 0);
+    }
+
+    for(i = 0; i < pool->threads; i++)
+    {
+        if(pool->workers[i].state && pool->state_free)
+            pool->state_free(pool->workers[i].state);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,59 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * A small work-stealing thread pool.  Every worker has its own deque of
+ * tasks.  A worker takes the newest task from its own deque and, when that
+ * is empty, steals the oldest task from another worker's deque.  Each worker
+ * also gets its own state (e.g. a lynx_ctx_t) from the state_new callback,
+ * since the crypto contexts must not be shared between threads.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXPOOL_H_
+#define _LYNXPOOL_H_
+
+typedef struct lynx_pool_s lynx_pool_t;
+
+/* a task gets the state of the worker running it and its own argument */
+typedef void (*lynx_task_fn_t)(void * state, void * arg);
+
+/* per-worker state constructor and destructor */
+typedef void * (*lynx_state_new_fn_t)(void);
+typedef void (*lynx_state_free_fn_t)(void * state);
+
+lynx_pool_t * lynx_pool_new(int threads,
+                            lynx_state_new_fn_t state_new,
+                            lynx_state_free_fn_t state_free);
+
+/* queue a task.  tasks queued from inside a worker go on that worker's own
+ * deque, the others are spread over the workers round robin. */
+int lynx_pool_submit(lynx_pool_t * pool, lynx_task_fn_t fn, void * arg);
+
+/* block until every queued task has run */
+void lynx_pool_wait(lynx_pool_t * pool);
+
+/* finish the queued tasks and stop the workers */
+void lynx_pool_free(lynx_pool_t * pool);
+
+#endif /* _LYNXPOOL_H_ */
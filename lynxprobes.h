@@ -0,0 +1,90 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * These are static tracepoints in the encrypt and decrypt paths, for looking
+ * at a live run with bpftrace or perf without rebuilding it.  When
+ * <sys/sdt.h> is there (systemtap-sdt-dev on Debian, systemtap-sdt-devel on
+ * Fedora) each probe is a single nop plus a note in the ELF file that tells
+ * the tracer where it is and where its arguments live.  Without it, or when
+ * built with -DLYNX_NO_PROBES, they are nothing at all.
+ *
+ * The provider is "lynxcrypt".  The probes and their arguments:
+ *
+ *   encrypt_block_start/done   ctx, frame index, block index, bytes
+ *   decrypt_block_start/done   ctx, frame index, block index, bytes
+ *   encrypt_frame_start/done   ctx, frame index, blocks, bytes
+ *   decrypt_frame_start/done   ctx, frame index, blocks, bytes
+ *   encrypt_jobs_start/done    ctx, jobs, job count
+ *   encode_image_start         jobs, frames, encrypted bytes
+ *   encode_image_done          jobs, frames, job count
+ *   encrypt_image_start/done   ctx, frames, encrypted bytes
+ *   decrypt_image_start        ctx, encrypted bytes, plaintext room
+ *   decrypt_image_done         ctx, encrypted bytes, plaintext bytes
+ *   process_frame_start        frame index, offset, blocks
+ *   process_frame_done         frame index, offset, bytes written
+ *   read_frame_start           frame index, offset
+ *   read_frame_done            frame index, offset, blocks
+ *
+ * The block and frame probes fire on every path, one block at a time or
+ * batched: lynxenc -j and -m, lynxd and the image calls included.  The
+ * indexes are the frame's place in its image and the block's place in its
+ * frame.  lynx_encrypt_block and lynx_decrypt_block called on their own
+ * don't know either and give -1.  The blocks of a batch that go through the
+ * SIMD lanes together all start before the first of them is done, so key
+ * the start times on the indexes as well as the thread.  For example, a
+ * histogram of block latencies in microseconds:
+ *
+ *   bpftrace -e '
+ *     usdt:./lynxenc:lynxcrypt:encrypt_block_start { @t[tid, arg1, arg2] = nsecs; }
+ *     usdt:./lynxenc:lynxcrypt:encrypt_block_done /@t[tid, arg1, arg2]/ {
+ *       @us = hist((nsecs - @t[tid, arg1, arg2]) / 1000);
+ *       delete(@t[tid, arg1, arg2]); }'
+ *
+ * When lynx_encrypt_jobs uses the SIMD lanes, it looks the blocks up in the
+ * block cache before they reach the lanes.  The blocks it finds there have
+ * no block probes.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXPROBES_H_
+#define _LYNXPROBES_H_
+
+#if !defined(LYNX_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LYNX_HAVE_PROBES
+#endif
+#endif
+
+#ifdef LYNX_HAVE_PROBES
+#define LYNX_PROBE2(name, a, b)             DTRACE_PROBE2(lynxcrypt, name, a, b)
+#define LYNX_PROBE3(name, a, b, c)          DTRACE_PROBE3(lynxcrypt, name, a, b, c)
+#define LYNX_PROBE4(name, a, b, c, d)       DTRACE_PROBE4(lynxcrypt, name, a, b, c, d)
+#else
+#define LYNX_PROBE2(name, a, b)             do { } while(0)
+#define LYNX_PROBE3(name, a, b, c)          do { } while(0)
+#define LYNX_PROBE4(name, a, b, c, d)       do { } while(0)
+#endif
+
+#endif /* _LYNXPROBES_H_ */
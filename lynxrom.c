@@ -0,0 +1,689 @@
+/* Atari Lynx Encryption Library
+ *
+ * NOTES:
+ *
+ * Curt Vendell has posted the encryption sources to AtariAge.
+ * The encryption sources work by indexing everything with the
+ * least significant byte first.
+ *
+ * In the real Atari Lynx hardware the byte order is LITTLE_ENDIAN.
+ * If you run this on Intel or AMD CPU then you also have LITTLE_ENDIAN.
+ * But the original encryption was run on Amiga that has a BIG_ENDIAN CPU.
+ *
+ * This means that all the keys are presented in BIG_ENDIAN format.
+ *
+ * The ROM-faithful decryptor below is the inner working of the Lynx.  The
+ * code was created by Harry Dodgson by analyzing the Lynx disassembled code.
+ * It used to keep all of its state in globals in lynxverify.c; it now lives
+ * in a lynx_rom_t so that it can be run on any number of images at once.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "lynxcrypt.h"
+
+#define chunkLength LYNX_RSA_KEY_SIZE
+
+#define BIT(C, i, m) ((C)[(i)/8] & (1 << ((i) & 7)))
+
+/* A = 0 */
+static void Clear(unsigned char *A, int m)
+{
+    int i;
+
+    for (i = 0; i < m; i++)
+	A[i] = 0;
+}
+
+/* A = 1 */
+static void One(unsigned char *A, int m)
+{
+    Clear(A, m);
+    A[0] = 1;
+}
+
+/* A = B */
+static void Copy(unsigned char *A, const unsigned char *B, int m)
+{
+    int i;
+
+    for (i = 0; i < m; i++)
+	A[i] = B[i];
+}
+
+/* B = 2*B */
+static void Double(unsigned char *B, int m)
+{
+    int i, x;
+
+    x = 0;
+    for (i = 0; i < m; i++) {
+	x += 2 * B[i];
+	B[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+    /* shouldn't carry */
+}
+
+/* B = (B-N) if B >= N */
+static int Adjust(unsigned char *B, const unsigned char *PublicKey, int m)
+{
+    int i, x;
+    unsigned char T[chunkLength];
+
+    x = 0;
+    for (i = 0; i < m; i++) {
+	x += B[i] - PublicKey[i];
+	T[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+
+    if (x >= 0) {
+	Copy(B, T, m);
+        return 1;
+    }
+    return 0;
+}
+
+/* v = -1/PublicKey mod 256 */
+static void MontCoeff(unsigned char *v, const unsigned char *PublicKey, int m)
+{
+    int i;
+    int lsb = 0;
+
+    *v = 0;
+    for (i = 0; i < 8; i++)
+	if (!((PublicKey[lsb] * (*v) & (1 << i))))
+	    *v += (1 << i);
+}
+
+/* A = B*(256**m) mod PublicKey */
+static void Mont(unsigned char *A, const unsigned char *B,
+		 const unsigned char *PublicKey, int m)
+{
+    int i;
+
+    Copy(A, B, m);
+
+    for (i = 0; i < 8 * m; i++) {
+	Double(A, m);
+	Adjust(A, PublicKey, m);
+    }
+}
+
+/* A = T/(256**m) mod PublicKey where v*PublicKey = -1 mod 256.  T is the
+   2*m byte product and gets clobbered. */
+static void MontReduce(unsigned char *A, unsigned char *T,
+		       const unsigned char *PublicKey, unsigned char v, int m)
+{
+    int i, j;
+    unsigned char ei;
+    unsigned int x;
+
+    for (i = 0; i < m; i++) {
+	x = 0;
+	ei = (unsigned char) (((unsigned int) v * (unsigned int) T[i]) &
+			      0xFF);
+	for (j = 0; j < m; j++) {
+	    x += (unsigned int) T[i + j] +
+		(unsigned int) ei *(unsigned int) PublicKey[j];
+	    T[i + j] = (unsigned char) (x & 0xFF);
+	    x >>= 8;
+	}
+	A[i] = (unsigned char) (x & 0xFF);
+    }
+
+    x = 0;
+    for (i = 0; i < m; i++) {
+	x += (unsigned int) T[i + m] + (unsigned int) A[i];
+	A[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+    /* shouldn't carry */
+}
+
+/* A = B*C/(256**m) mod PublicKey where v*PublicKey = -1 mod 256 */
+static void MontMult(unsigned char *A, const unsigned char *B,
+		     const unsigned char *C, const unsigned char *PublicKey,
+		     unsigned char v, int m)
+{
+    int i, j;
+    unsigned char T[2 * chunkLength];
+    unsigned int x;
+
+    Clear(T, 2 * m);
+
+    for (i = 0; i < m; i++) {
+	x = 0;
+	for (j = 0; j < m; j++) {
+	    x += (unsigned int) T[i + j] +
+		(unsigned int) B[i] * (unsigned int) C[j];
+	    T[i + j] = (unsigned char) (x & 0xFF);
+	    x >>= 8;
+	}
+	T[i + m] = (unsigned char) (x & 0xFF);
+    }
+
+    MontReduce(A, T, PublicKey, v, m);
+}
+
+/* A = B*B/(256**m) mod PublicKey where v*PublicKey = -1 mod 256.  B[i]*B[j]
+   and B[j]*B[i] are the same, so the cross products are only worked out
+   once and doubled, which is about half the byte multiplies of MontMult. */
+static void MontSquare(unsigned char *A, const unsigned char *B,
+		       const unsigned char *PublicKey, unsigned char v, int m)
+{
+    int i, j;
+    unsigned char T[2 * chunkLength];
+    unsigned int x;
+
+    Clear(T, 2 * m);
+
+    /* the cross products, i < j */
+    for (i = 0; i < m; i++) {
+	x = 0;
+	for (j = i + 1; j < m; j++) {
+	    x += (unsigned int) T[i + j] +
+		(unsigned int) B[i] * (unsigned int) B[j];
+	    T[i + j] = (unsigned char) (x & 0xFF);
+	    x >>= 8;
+	}
+	T[i + m] = (unsigned char) (x & 0xFF);
+    }
+
+    /* double them */
+    x = 0;
+    for (i = 0; i < 2 * m; i++) {
+	x += 2 * (unsigned int) T[i];
+	T[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+
+    /* and add the squares on the diagonal */
+    x = 0;
+    for (i = 0; i < m; i++) {
+	x += (unsigned int) T[2 * i] +
+	    (unsigned int) B[i] * (unsigned int) B[i];
+	T[2 * i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+	x += (unsigned int) T[2 * i + 1];
+	T[2 * i + 1] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+
+    MontReduce(A, T, PublicKey, v, m);
+}
+
+/* the largest window MontExp will use and its table of odd powers */
+#define MAX_WINDOW 5
+#define MAX_POWERS (1 << (MAX_WINDOW - 1))
+
+/* The window size for an exponent of this many bits.  A bigger window means
+   fewer multiplies in the main loop but a bigger table to fill first. */
+static int WindowBits(int bits)
+{
+    if (bits > 239)
+	return 5;
+    if (bits > 79)
+	return 4;
+    if (bits > 23)
+	return 3;
+    return 1;
+}
+
+/* A = (B**PrivateKey)/(256**((PrivateKey-1)*m)) mod PublicKey, where v*PublicKey = -1 mod 256
+
+   This is a sliding window exponentiation.  The exponent is scanned from the
+   top set bit down in windows of up to w bits that start and end with a 1
+   bit, so each window is an odd number.  B, B**3, B**5, ... B**(2**w - 1)
+   are worked out first and each window is then one multiply from that
+   table after squaring once per bit. */
+static void MontExp(unsigned char *A, const unsigned char *B,
+		    const unsigned char *PrivateKey, const lynx_mod_key_t *key)
+{
+    const unsigned char *PublicKey = key->modulus;
+    unsigned char v = key->v;
+    int m = key->m;
+    int i, j, k, w, bits, value;
+    unsigned char T[chunkLength];
+    unsigned char Powers[MAX_POWERS][chunkLength];
+
+    /* skip the leading zero bits */
+    for (bits = 8 * m; bits > 0; bits--) {
+	if (BIT(PrivateKey, bits - 1, m))
+	    break;
+    }
+
+    /* B**0 is 1, i.e. 256**m in the Montgomery domain */
+    if (bits == 0) {
+	Copy(A, key->R, m);
+	return;
+    }
+
+    /* the odd powers of B */
+    w = WindowBits(bits);
+    Copy(Powers[0], B, m);
+    if (w > 1) {
+	MontSquare(T, B, PublicKey, v, m);
+	for (k = 1; k < (1 << (w - 1)); k++)
+	    MontMult(Powers[k], Powers[k - 1], T, PublicKey, v, m);
+    }
+
+    i = bits - 1;
+    while (i >= 0) {
+	if (!BIT(PrivateKey, i, m)) {
+	    MontSquare(T, T, PublicKey, v, m);
+	    i--;
+	    continue;
+	}
+
+	/* the longest window, up to w bits, that ends in a 1 */
+	j = (i - w + 1 > 0) ? (i - w + 1) : 0;
+	while (!BIT(PrivateKey, j, m))
+	    j++;
+
+	value = 0;
+	for (k = i; k >= j; k--) {
+	    value <<= 1;
+	    if (BIT(PrivateKey, k, m))
+		value |= 1;
+	}
+
+	/* the first window starts off T, so there is never a multiply by
+	   one */
+	if (i == bits - 1) {
+	    Copy(T, Powers[value >> 1], m);
+	} else {
+	    for (k = i; k >= j; k--)
+		MontSquare(T, T, PublicKey, v, m);
+	    MontMult(T, T, Powers[value >> 1], PublicKey, v, m);
+	}
+
+	i = j - 1;
+    }
+
+    Copy(A, T, m);
+}
+
+/* A = B/(256**m) mod PublicKey, where v*PublicKey = -1 mod 256 */
+static void UnMont(unsigned char *A, const unsigned char *B,
+		   const unsigned char *PublicKey, unsigned char v, int m)
+{
+    unsigned char T[chunkLength];
+
+    One(T, m);
+    MontMult(A, B, T, PublicKey, v, m);
+
+    Adjust(A, PublicKey, m);
+}
+
+/* Everything in lynx_mod_key_t only depends on the modulus, so it is worked
+   out once per key here and not on every call.  The slow bit-serial Mont()
+   is only used for R and R**2, after that getting into the Montgomery
+   domain is one MontMult by R**2. */
+int lynx_mod_key_init(lynx_mod_key_t *key, const unsigned char *PublicKey,
+		      const int m)
+{
+    if ((m < 1) || (m > chunkLength) || !(PublicKey[0] & 1))
+	return 0;
+
+    key->m = m;
+    Clear(key->modulus, chunkLength);
+    Copy(key->modulus, PublicKey, m);
+    MontCoeff(&key->v, PublicKey, m);
+
+    One(key->R, m);
+    Mont(key->R, key->R, PublicKey, m);
+    Mont(key->RR, key->R, PublicKey, m);
+    return 1;
+}
+
+/* the schedule for the Lynx public modulus, built on first use */
+static lynx_mod_key_t PublicModKey;
+static pthread_once_t PublicModOnce = PTHREAD_ONCE_INIT;
+
+static void PublicModInit(void)
+{
+    int i;
+    unsigned char N[chunkLength];
+
+    for (i = 0; i < chunkLength; i++)
+	N[i] = lynx_public_mod[(chunkLength - 1) - i];
+    lynx_mod_key_init(&PublicModKey, N, chunkLength);
+}
+
+const lynx_mod_key_t *lynx_public_mod_key(void)
+{
+    pthread_once(&PublicModOnce, PublicModInit);
+    return &PublicModKey;
+}
+
+/* All operands have least significant byte first. */
+/* A = B**PrivateKey mod key->modulus */
+void lynx_mod_key_exp(unsigned char *A, const unsigned char *B,
+		      const unsigned char *PrivateKey,
+		      const lynx_mod_key_t *key)
+{
+    unsigned char T[chunkLength];
+
+    MontMult(T, B, key->RR, key->modulus, key->v, key->m);
+    MontExp(T, T, PrivateKey, key);
+    UnMont(A, T, key->modulus, key->v, key->m);
+}
+
+/* A = B**PrivateKey mod PublicKey */
+void lynx_mod_exp(unsigned char *A, const unsigned char *B,
+		  const unsigned char *PrivateKey,
+		  const unsigned char *PublicKey, int m)
+{
+    const lynx_mod_key_t *public_key = lynx_public_mod_key();
+    lynx_mod_key_t key;
+
+    if ((m == public_key->m) && !memcmp(PublicKey, public_key->modulus, m)) {
+	lynx_mod_key_exp(A, B, PrivateKey, public_key);
+	return;
+    }
+
+    if (lynx_mod_key_init(&key, PublicKey, m))
+	lynx_mod_key_exp(A, B, PrivateKey, &key);
+}
+
+/*
+    The inner working of the Lynx.  The ROM keeps its numbers most significant
+    byte first and walks them from the last byte to the first, so the helpers
+    below run in the opposite direction to the ones above.  The encrypted
+    blocks are stored least significant byte first, which is why convert_it
+    loads them backwards into E.
+*/
+
+/* B = 2*B */
+static void RomDouble(unsigned char *B, int m)
+{
+    int i, x;
+
+    x = 0;
+    for (i = m - 1; i >= 0; i--) {
+	x += 2 * B[i];
+	B[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+    /* shouldn't carry */
+}
+
+/* B = (B-N) if B >= N */
+static int RomAdjust(unsigned char *B, const unsigned char *PublicKey, int m)
+{
+    int i, x;
+    unsigned char T[chunkLength];
+
+    x = 0;
+    for (i = m - 1; i >= 0; i--) {
+	x += B[i] - PublicKey[i];
+	T[i] = (unsigned char) (x & 0xFF);
+	x >>= 8;
+    }
+
+    if (x >= 0) {
+	Copy(B, T, m);
+        return 1;
+    }
+    return 0;
+}
+
+// B = B + F
+static void add_it(lynx_rom_t *rom, unsigned char *B, const unsigned char *F,
+		   int m)
+{
+    int ct, tmp;
+    rom->carry = 0;
+    for (ct = m - 1; ct >= 0; ct--) {
+	tmp = B[ct] + F[ct] + rom->carry;
+	if (tmp >= 256)
+	    rom->carry = 1;
+	else
+	    rom->carry = 0;
+	B[ct] = (unsigned char) (tmp);
+    }
+}
+
+/* B = E*F mod PublicKey */
+static void LynxMont(lynx_rom_t *rom, const unsigned char *PublicKey, int m)
+{
+    int Yctr;
+
+    Clear(rom->B, m);
+    Yctr = 0;
+    do {
+	int num8, numA;
+	numA = rom->F[Yctr];
+	num8 = 255;
+	do {
+	    RomDouble(rom->B, m);
+	    rom->carry = (numA & 0x80) / 0x80;
+	    numA = (unsigned char) (numA << 1);
+	    rom->cost.doubles++;
+	    if (rom->carry != 0) {
+		add_it(rom, rom->B, rom->E, m);
+                rom->carry = RomAdjust(rom->B, PublicKey, m);
+		rom->cost.adds++;
+		rom->cost.adjusts++;
+		rom->cost.copies += rom->carry;
+		if (rom->carry != 0) {
+                    rom->cost.adjusts++;
+                    rom->cost.copies += RomAdjust(rom->B, PublicKey, m);
+		}
+	    } else {
+                rom->cost.adjusts++;
+                rom->cost.copies += RomAdjust(rom->B, PublicKey, m);
+	    }
+	    num8 = num8 >> 1;
+	} while (num8 != 0);
+	Yctr++;
+    } while (Yctr < m);
+}
+
+/* B = E**3 mod PublicKey */
+static void sub5000(lynx_rom_t *rom, int m)
+{
+    Copy(rom->F, rom->E, m);
+    LynxMont(rom, lynx_public_mod, m);
+    Copy(rom->F, rom->B, m);
+    LynxMont(rom, lynx_public_mod, m);
+}
+
+/* The checks convert_it makes on a block before it goes anywhere near
+ * sub5000, made straight on the block as it is stored.  The ROM loads the
+ * block backwards into E, so E[0], E[1] and E[2] are its last three bytes.
+ * It returns the error bits. */
+int lynx_check_block(const unsigned char *encrypted)
+{
+    int err = LYNX_VERIFY_OK;
+    long t1, t2;
+    const unsigned char *E0 = &encrypted[chunkLength - 1];
+
+    if ((E0[0] | E0[-1] | E0[-2]) == 0) {
+	err |= LYNX_VERIFY_ZERO_LEAD;
+    }
+    t1 = ((long) (E0[0]) << 16) +
+	((long) (E0[-1]) << 8) +
+	(long) (E0[-2]);
+    t2 = ((long) (lynx_public_mod[0]) << 16) +
+	((long) (lynx_public_mod[1]) << 8) + (long) (lynx_public_mod[2]);
+    if (t1 > t2) {
+	err |= LYNX_VERIFY_RANGE;
+    }
+
+    return err;
+}
+
+/* This is what really happens inside the Atari Lynx at boot time.  It
+ * decrypts a single frame, block count byte included, into plaintext and
+ * returns the error bits for the checks the ROM makes along the way. */
+int lynx_verify_frame(lynx_rom_t * rom,
+                      unsigned char * plaintext,
+                      const unsigned char * encrypted,
+                      const size_t size,
+                      size_t * consumed)
+{
+    int ct, err = LYNX_VERIFY_OK;
+    int num2, num7, Actr = 0;
+    size_t Cptr = 0;
+    unsigned char *result = plaintext;
+    long t1, t2;
+
+    if (consumed)
+	*consumed = 0;
+    if (size < 1)
+	return LYNX_VERIFY_TRUNCATED;
+
+    /* the ROM would go on for up to 256 blocks, more than the caller's
+       buffer has room for, so a count that big is as far as it gets */
+    if (256 - encrypted[0] > MAX_BLOCKS_PER_FRAME) {
+	if (consumed)
+	    *consumed = 1;
+	return LYNX_VERIFY_COUNT;
+    }
+
+    num7 = encrypted[Cptr];
+    num2 = 0;
+    Cptr++;
+    do {
+	int Yctr;
+
+	if (size - Cptr < chunkLength) {
+	    err |= LYNX_VERIFY_TRUNCATED;
+	    break;
+	}
+
+	for (ct = chunkLength - 1; ct >= 0; ct--) {
+	    rom->E[ct] = encrypted[Cptr];
+	    Cptr++;
+	}
+	if ((rom->E[0] | rom->E[1] | rom->E[2]) == 0) {
+	    err |= LYNX_VERIFY_ZERO_LEAD;
+	}
+	t1 = ((long) (rom->E[0]) << 16) +
+	    ((long) (rom->E[1]) << 8) +
+	    (long) (rom->E[2]);
+	t2 = ((long) (lynx_public_mod[0]) << 16) +
+	    ((long) (lynx_public_mod[1]) << 8) + (long) (lynx_public_mod[2]);
+	if (t1 > t2) {
+	    err |= LYNX_VERIFY_RANGE;
+	}
+	sub5000(rom, chunkLength);
+	rom->cost.blocks++;
+	if (rom->B[0] != 0x15) {
+	    err |= LYNX_VERIFY_MARKER;
+	}
+	Actr = num2;
+	Yctr = 0x32;
+	do {
+	    Actr += rom->B[Yctr];
+	    Actr &= 255;
+	    *result = (unsigned char) (Actr);
+	    result++;
+	    Yctr--;
+	} while (Yctr != 0);
+	num2 = Actr;
+	num7++;
+    } while (num7 != 256);
+    if (Actr != 0) {
+        err |= LYNX_VERIFY_ACCUMULATOR;
+    }
+
+    if (consumed)
+	*consumed = Cptr;
+
+    return err;
+}
+
+/* This runs the ROM decryptor over every frame of an encrypted loader.  Each
+ * frame is written out as MAX_PLAINTEXT_FRAME_SIZE bytes of plaintext, the
+ * same way lynxdec does it.  It returns the combined error bits. */
+int lynx_verify_image(lynx_rom_t * rom,
+                      unsigned char * plaintext,
+                      const size_t plaintext_size,
+                      const unsigned char * encrypted,
+                      const size_t encrypted_size,
+                      int * frames)
+{
+    int err = LYNX_VERIFY_OK;
+    int count = 0;
+    size_t in = 0;
+    size_t out = 0;
+    size_t consumed;
+
+    while (in < encrypted_size) {
+	/* the plaintext buffer has to be able to hold the whole frame */
+	if (plaintext_size - out < MAX_PLAINTEXT_FRAME_SIZE) {
+	    err |= LYNX_VERIFY_TRUNCATED;
+	    break;
+	}
+
+	memset(&plaintext[out], 0, MAX_PLAINTEXT_FRAME_SIZE);
+	err |= lynx_verify_frame(rom, &plaintext[out], &encrypted[in],
+				 encrypted_size - in, &consumed);
+	in += consumed;
+	out += MAX_PLAINTEXT_FRAME_SIZE;
+	count++;
+
+	/* without a good count there is no telling where the next frame is */
+	if (err & (LYNX_VERIFY_TRUNCATED | LYNX_VERIFY_COUNT))
+	    break;
+    }
+
+    if (frames)
+	*frames = count;
+
+    return err;
+}
+
+/*
+    The boot time cost model.  The cycle counts are for each routine above
+    written the obvious way in 65C02 code with the scratch buffers in zero
+    page, e.g. RomDouble is a ROL zp,X / DEX / BPL loop at 11 cycles a byte.
+    They are estimates, not a count of the real ROM code, and leave out the
+    cartridge wait states while the encrypted block is read in.
+*/
+#define ROM_CALL	12		/* JSR + RTS */
+#define ROM_BIT		16		/* ASL/BCC on the exponent, LSR/BNE on the bit count */
+#define ROM_DOUBLE(m)	(ROM_CALL + 4 + 11 * (m))
+#define ROM_ADD(m)	(ROM_CALL + 4 + 17 * (m))
+#define ROM_ADJUST(m)	(ROM_CALL + 7 + 17 * (m))	/* LDA/SBC/STA into scratch */
+#define ROM_COPY(m)	(2 + 13 * (m))			/* scratch back into B */
+
+/* per block: read E in, the range checks, the two Copy and two Clear calls
+   of sub5000, fetching each byte of F in LynxMont and the decode loop */
+#define ROM_BLOCK(m)	((2 + 13 * (m)) + 40 + 2 * (ROM_CALL + ROM_COPY(m)) + \
+			 2 * (ROM_CALL + 2 + 9 * (m)) + 2 * 15 * (m) + \
+			 (4 + 17 * ((m) - 1)))
+
+unsigned long lynx_rom_cycles(const lynx_rom_cost_t * cost)
+{
+    return (cost->blocks * ROM_BLOCK(chunkLength)) +
+	(cost->doubles * (ROM_BIT + ROM_DOUBLE(chunkLength))) +
+	(cost->adds * ROM_ADD(chunkLength)) +
+	(cost->adjusts * ROM_ADJUST(chunkLength)) +
+	(cost->copies * ROM_COPY(chunkLength));
+}
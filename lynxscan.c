@@ -0,0 +1,547 @@
+/* Atari Lynx Loader Scanner
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This finds encrypted loaders inside raw cartridge dumps, wherever they
+ * are in the dump.  Every offset of the dump is a candidate for the start of
+ * a frame, and the candidates are weeded out in order of how much it costs
+ * to do it:
+ *
+ *   1. the byte at the offset has to be a block count byte, 256 - blocks
+ *      with 1 to 5 blocks, and that many blocks have to fit in the dump
+ *   2. every block has to get past the checks convert_it makes before it
+ *      decrypts anything: the leading three bytes aren't all 0 and they
+ *      aren't above the modulus
+ *   3. the blocks are cubed one at a time and each one has to come out with
+ *      the 0x15 marker
+ *   4. what is left goes through the ROM-faithful decryptor, which has to
+ *      be happy with all of it, the final accumulator included
+ *
+ * Only a couple of offsets in every hundred get past 1, and 2 throws most of
+ * those out too, so only a tiny fraction of a dump is ever cubed and step 4
+ * only runs on real frames.  Frames that follow straight on from each other
+ * are put together into one loader, the same way lynxdec reads them.
+ *
+ * Each dump is mapped and cut into chunks that are scanned on a pool of
+ * threads, each thread with its own crypto context and ROM scratch memory.
+ * Cart dumps are only a few hundred KB, so the chunks of a whole run of
+ * dumps go on the pool before it is waited on, and the loaders are reported
+ * dump by dump afterwards.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "lynxcrypt.h"
+#include "lynxpool.h"
+#include "lynxmap.h"
+
+/* how much of a dump each task scans */
+#define SCAN_CHUNK_SIZE             (64 * 1024)
+
+/* how many dumps are scanned at once */
+#define SCAN_DUMP_BATCH             (32)
+
+/* the encoded block starts with this once it is decrypted */
+#define SCAN_MARKER                 (0x15)
+
+#define min(x,y) ((x < y) ? x : y)
+#define max(x,y) ((x > y) ? x : y)
+
+/* a frame that got past every check */
+typedef struct scan_hit_s
+{
+    size_t offset;
+    int blocks;
+    int next;           /* index of the frame straight after it, or -1 */
+    int follows;        /* another frame runs straight on to this one */
+    unsigned char plaintext[MAX_PLAINTEXT_FRAME_SIZE];
+} scan_hit_t;
+
+/* one chunk of a dump, a task for the pool */
+typedef struct scan_chunk_s
+{
+    const lynx_map_t * dump;
+    size_t start;
+    size_t end;
+    scan_hit_t * hits;
+    int count;
+    int room;
+    int failed;
+    unsigned long candidates;   /* got past the block count byte */
+    unsigned long cubed;        /* blocks that got past convert_it */
+} scan_chunk_t;
+
+/* one dump and the chunks it is cut into */
+typedef struct scan_dump_s
+{
+    const char * file;
+    lynx_map_t map;
+    scan_chunk_t * chunks;
+    int chunk_count;
+    int failed;
+} scan_dump_t;
+
+/* what each pool thread works with */
+typedef struct scan_state_s
+{
+    lynx_ctx_t * ctx;
+    lynx_rom_t rom;
+} scan_state_t;
+
+static int quiet = 0;
+static int min_blocks = 1;
+static char * out_dir = 0;
+
+
+static void * scan_state_new(void)
+{
+    scan_state_t * state = calloc(1, sizeof(scan_state_t));
+
+    if(!state)
+        return 0;
+
+    /* the limb engine has the quickest cube */
+    if(!(state->ctx = lynx_ctx_new()))
+    {
+        free(state);
+        return 0;
+    }
+    lynx_ctx_set_engine(state->ctx, LYNX_ENGINE_MONT64);
+
+    return state;
+}
+
+static void scan_state_free(void * arg)
+{
+    scan_state_t * state = (scan_state_t *)arg;
+
+    lynx_ctx_free(state->ctx);
+    free(state);
+}
+
+
+/* This checks the frame at offset, cheapest check first.  It returns the
+ * number of blocks in it if the ROM would take it, 0 if not. */
+static int scan_frame(scan_state_t * state, scan_chunk_t * chunk, size_t offset, unsigned char * plaintext)
+{
+    int i;
+    int blocks;
+    const unsigned char * data = chunk->dump->data;
+    const unsigned char * frame = &data[offset];
+    unsigned char encoded[ENCRYPTED_BLOCK_SIZE];
+
+    /* the block count byte, and the blocks it says are there */
+    blocks = 256 - frame[0];
+    if((blocks > MAX_BLOCKS_PER_FRAME) ||
+       (chunk->dump->size - offset <= (size_t)ENCRYPTED_FRAME_SIZE(blocks)))
+        return 0;
+    chunk->candidates++;
+
+    /* the checks convert_it makes before it decrypts */
+    for(i = 0; i < blocks; i++)
+    {
+        if(lynx_check_block(&frame[1 + i * ENCRYPTED_BLOCK_SIZE]))
+            return 0;
+    }
+
+    /* the marker, one block at a time */
+    for(i = 0; i < blocks; i++)
+    {
+        lynx_decrypt_encoded(state->ctx, encoded, &frame[1 + i * ENCRYPTED_BLOCK_SIZE]);
+        chunk->cubed++;
+        if(encoded[0] != SCAN_MARKER)
+            return 0;
+    }
+
+    /* and the rest the way the ROM does it */
+    memset(plaintext, 0, MAX_PLAINTEXT_FRAME_SIZE);
+    if(lynx_verify_frame(&state->rom, plaintext, frame, 1 + ENCRYPTED_FRAME_SIZE(blocks), 0) != LYNX_VERIFY_OK)
+        return 0;
+
+    return blocks;
+}
+
+
+/* This scans every offset in one chunk of a dump */
+static void scan_task(void * state, void * arg)
+{
+    scan_chunk_t * chunk = (scan_chunk_t *)arg;
+    scan_hit_t * hits;
+    scan_hit_t * hit;
+    size_t offset;
+    int blocks;
+    unsigned char plaintext[MAX_PLAINTEXT_FRAME_SIZE];
+
+    for(offset = chunk->start; offset < chunk->end; offset++)
+    {
+        if(!(blocks = scan_frame((scan_state_t *)state, chunk, offset, plaintext)))
+            continue;
+
+        if(chunk->count == chunk->room)
+        {
+            chunk->room = chunk->room ? (chunk->room * 2) : 4;
+            if(!(hits = realloc(chunk->hits, chunk->room * sizeof(scan_hit_t))))
+            {
+                chunk->failed = 1;
+                return;
+            }
+            chunk->hits = hits;
+        }
+
+        hit = &chunk->hits[chunk->count++];
+        hit->offset = offset;
+        hit->blocks = blocks;
+        hit->next = -1;
+        hit->follows = 0;
+        memcpy(hit->plaintext, plaintext, MAX_PLAINTEXT_FRAME_SIZE);
+    }
+}
+
+
+/* This finds the frame at offset in the hits, which are in offset order */
+static int find_hit(const scan_hit_t * hits, int count, size_t offset)
+{
+    int lo = 0;
+    int hi = count - 1;
+    int mid;
+
+    while(lo <= hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if(hits[mid].offset == offset)
+            return mid;
+        if(hits[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return -1;
+}
+
+
+/* This writes a loader out as a plaintext binary with each frame on its
+ * own 256 byte page, like lynxdec does, and a config file that lynxenc can
+ * build the same loader back from */
+static int write_loader(const char * dump_file, const scan_hit_t * hits, int first, int frame_count)
+{
+    int i, n;
+    int status = 0;
+    const char * name;
+    char path[4096];
+    unsigned char * plaintext = 0;
+    lynx_frame_def_t * frames = 0;
+    FILE * out = 0;
+
+    name = strrchr(dump_file, '/') ? (strrchr(dump_file, '/') + 1) : dump_file;
+
+    plaintext = malloc(frame_count * MAX_PLAINTEXT_FRAME_SIZE);
+    frames = calloc(frame_count, sizeof(lynx_frame_def_t));
+    if(!plaintext || !frames)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        goto done;
+    }
+
+    for(i = 0, n = first; i < frame_count; i++, n = hits[n].next)
+    {
+        memcpy(&plaintext[i * MAX_PLAINTEXT_FRAME_SIZE], hits[n].plaintext, MAX_PLAINTEXT_FRAME_SIZE);
+        frames[i].offset = i * MAX_PLAINTEXT_FRAME_SIZE;
+        frames[i].blocks = hits[n].blocks;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.%08lx.bin", out_dir, name, (unsigned long)hits[first].offset);
+    if(!(out = fopen(path, "wb")) ||
+       !lynx_write_all(fileno(out), plaintext, frame_count * MAX_PLAINTEXT_FRAME_SIZE))
+    {
+        fprintf(stderr, "error: failed to write plaintext loader file: %s\n", path);
+        goto done;
+    }
+    fclose(out);
+    printf("    plaintext:  %s\n", path);
+
+    snprintf(path, sizeof(path), "%s/%s.%08lx.cfg", out_dir, name, (unsigned long)hits[first].offset);
+    if(!(out = fopen(path, "w")) || !lynx_write_config_file(out, frames, frame_count))
+    {
+        fprintf(stderr, "error: failed to write config file: %s\n", path);
+        goto done;
+    }
+    printf("    config:     %s\n", path);
+
+    status = 1;
+
+done:
+    if(out)
+        fclose(out);
+    free(plaintext);
+    free(frames);
+    return status;
+}
+
+
+/* This puts the frames that follow on from each other together and reports
+ * on each loader.  It returns the number of loaders, -1 on failure. */
+static int report_loaders(const char * dump_file, scan_hit_t * hits, int count)
+{
+    int i, n, f;
+    int frame_count;
+    int blocks;
+    int loaders = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        n = find_hit(hits, count, hits[i].offset + 1 + ENCRYPTED_FRAME_SIZE(hits[i].blocks));
+        hits[i].next = n;
+        if(n >= 0)
+            hits[n].follows = 1;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(hits[i].follows)
+            continue;
+
+        for(frame_count = 0, blocks = 0, n = i; n >= 0; n = hits[n].next)
+        {
+            frame_count++;
+            blocks += hits[n].blocks;
+        }
+        if(blocks < min_blocks)
+            continue;
+
+        printf("%s: loader at 0x%08lx, %d frame%s\n", dump_file,
+               (unsigned long)hits[i].offset, frame_count, (frame_count == 1) ? "" : "s");
+        for(f = 0, n = i; n >= 0; f++, n = hits[n].next)
+        {
+            printf("    frame %d at 0x%08lx: %d blocks\n", f, (unsigned long)hits[n].offset, hits[n].blocks);
+            if(!quiet && !out_dir)
+                lynx_print_data(hits[n].plaintext, PLAINTEXT_FRAME_SIZE(hits[n].blocks));
+        }
+
+        if(out_dir && !write_loader(dump_file, hits, i, frame_count))
+            return -1;
+        loaders++;
+    }
+
+    return loaders;
+}
+
+
+/* This maps a dump and queues its chunks on the pool.  It returns 1 if it
+ * could, 0 if not. */
+static int scan_start(lynx_pool_t * pool, scan_dump_t * dump, const char * dump_file)
+{
+    int i;
+    lynx_map_t unmapped = LYNX_MAP_INIT;
+
+    memset(dump, 0, sizeof(scan_dump_t));
+    dump->file = dump_file;
+    dump->map = unmapped;
+
+    if(!lynx_map_file(&dump->map, dump_file))
+    {
+        fprintf(stderr, "failed to open dump file: %s\n", dump_file);
+        dump->failed = 1;
+        return 0;
+    }
+
+    dump->chunk_count = (dump->map.size + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+    if((dump->chunk_count > 0) && !(dump->chunks = calloc(dump->chunk_count, sizeof(scan_chunk_t))))
+    {
+        fprintf(stderr, "error: out of memory\n");
+        dump->failed = 1;
+        return 0;
+    }
+
+    /* scan the chunks on the pool */
+    for(i = 0; i < dump->chunk_count; i++)
+    {
+        dump->chunks[i].dump = &dump->map;
+        dump->chunks[i].start = (size_t)i * SCAN_CHUNK_SIZE;
+        dump->chunks[i].end = min((size_t)(i + 1) * SCAN_CHUNK_SIZE, dump->map.size);
+        while(!lynx_pool_submit(pool, scan_task, &dump->chunks[i]))
+            lynx_pool_wait(pool);
+    }
+
+    return 1;
+}
+
+
+/* This reports on a dump once its chunks have all been scanned, and frees
+ * it.  It returns 1 if it could, 0 if not. */
+static int scan_finish(scan_dump_t * dump)
+{
+    int i, n;
+    int count = 0;
+    int loaders;
+    int status = 0;
+    unsigned long candidates = 0;
+    unsigned long cubed = 0;
+    scan_hit_t * hits = 0;
+
+    if(dump->failed)
+        goto done;
+
+    /* the chunks are in order, so the hits end up in offset order */
+    for(i = 0; i < dump->chunk_count; i++)
+    {
+        if(dump->chunks[i].failed)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            goto done;
+        }
+        count += dump->chunks[i].count;
+        candidates += dump->chunks[i].candidates;
+        cubed += dump->chunks[i].cubed;
+    }
+    if((count > 0) && !(hits = malloc(count * sizeof(scan_hit_t))))
+    {
+        fprintf(stderr, "error: out of memory\n");
+        goto done;
+    }
+    for(i = 0, n = 0; i < dump->chunk_count; i++)
+    {
+        memcpy(&hits[n], dump->chunks[i].hits, dump->chunks[i].count * sizeof(scan_hit_t));
+        n += dump->chunks[i].count;
+    }
+
+    if((loaders = report_loaders(dump->file, hits, count)) < 0)
+        goto done;
+
+    printf("%s: %d loader%s, %lu bytes, %lu candidates, %lu blocks decrypted\n",
+           dump->file, loaders, (loaders == 1) ? "" : "s",
+           (unsigned long)dump->map.size, candidates, cubed);
+    status = 1;
+
+done:
+    for(i = 0; dump->chunks && (i < dump->chunk_count); i++)
+    {
+        free(dump->chunks[i].hits);
+    }
+    free(dump->chunks);
+    free(hits);
+    lynx_unmap(&dump->map);
+    return status;
+}
+
+void print_help(char * name)
+{
+    printf("usage: %s [-j <threads>] [-b <blocks>] [-o <directory>] [-q] <dump> [<dump> ...]\n", name);
+    printf("       %s --version\n\n", name);
+    printf("finds the encrypted loaders in raw cartridge dumps and decrypts them\n\n");
+    printf("    -j <threads>     scan on this many threads, one per CPU by default\n");
+    printf("    -b <blocks>      only report loaders with at least this many blocks.  one\n");
+    printf("                     block loaders turn up by chance in random data, about\n");
+    printf("                     one every 20 MB\n");
+    printf("    -o <directory>   write each loader there as a plaintext binary and a\n");
+    printf("                     config file lynxenc can encrypt it again with\n");
+    printf("    -q, --quiet      don't dump the plaintext of every frame\n\n");
+}
+
+/* the long options, each of them maps onto a short one */
+static struct option long_options[] =
+{
+    { "help",       no_argument,        0, 'h' },
+    { "version",    no_argument,        0, 'V' },
+    { "quiet",      no_argument,        0, 'q' },
+    { 0, 0, 0, 0 }
+};
+
+int main (int argc, char ** argv)
+{
+    int i, j, n;
+    int opt;
+    int status = EXIT_SUCCESS;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    lynx_pool_t * pool = 0;
+    scan_dump_t dumps[SCAN_DUMP_BATCH];
+
+    while((opt = getopt_long(argc, argv, "hqj:b:o:", long_options, 0)) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                threads = atoi(optarg);
+                if(threads < 1)
+                {
+                    fprintf(stderr, "error: invalid thread count: %s\n\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                min_blocks = atoi(optarg);
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'h':
+                print_help(argv[0]);
+                return EXIT_SUCCESS;
+            case 'V':
+                lynx_print_version("lynxscan");
+                return EXIT_SUCCESS;
+            default:
+                print_help(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        print_help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(!(pool = lynx_pool_new(max(threads, 1), scan_state_new, scan_state_free)))
+    {
+        fprintf(stderr, "error: failed to start the worker threads\n");
+        return EXIT_FAILURE;
+    }
+
+    /* queue a run of dumps, then report on them in order */
+    for(i = optind; i < argc; i += n)
+    {
+        n = min(argc - i, SCAN_DUMP_BATCH);
+        for(j = 0; j < n; j++)
+        {
+            scan_start(pool, &dumps[j], argv[i + j]);
+        }
+        lynx_pool_wait(pool);
+
+        for(j = 0; j < n; j++)
+        {
+            if(!scan_finish(&dumps[j]))
+                status = EXIT_FAILURE;
+        }
+    }
+
+    lynx_pool_free(pool);
+    return status;
+}
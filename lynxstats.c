@@ -0,0 +1,138 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * The stage timers read CLOCK_MONOTONIC for the wall clock time and
+ * CLOCK_THREAD_CPUTIME_ID for the CPU time.  The thread CPU clock is a
+ * system call on most kernels, so timing a stage costs a little under a
+ * microsecond.  That is noise next to an RSA step but not next to decoding a
+ * single block, which is why none of it happens unless --stats was asked for.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "lynxstats.h"
+
+static const char * stage_names[LYNX_STAGE_COUNT] =
+{
+    "config", "read", "codec", "modexp", "reverse", "write"
+};
+
+static const char * count_names[LYNX_COUNT_COUNT] =
+{
+    "frames", "blocks", "mulmods", "bytes_in", "bytes_out", "cache_hits"
+};
+
+
+static uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+
+void lynx_stats_init(lynx_stats_t * stats)
+{
+    memset(stats, 0, sizeof(lynx_stats_t));
+    stats->start_wall_ns = clock_ns(CLOCK_MONOTONIC);
+    stats->start_cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+
+void lynx_stats_start(const lynx_stats_t * stats, lynx_timer_t * timer)
+{
+    if(!stats)
+        return;
+
+    timer->wall_ns = clock_ns(CLOCK_MONOTONIC);
+    timer->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+void lynx_stats_stop(lynx_stats_t * stats, const lynx_timer_t * timer, int stage)
+{
+    uint64_t wall, cpu;
+
+    if(!stats)
+        return;
+
+    wall = clock_ns(CLOCK_MONOTONIC) - timer->wall_ns;
+    cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_ns;
+    __atomic_add_fetch(&stats->wall_ns[stage], wall, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->cpu_ns[stage], cpu, __ATOMIC_RELAXED);
+}
+
+
+void lynx_stats_count(lynx_stats_t * stats, int counter, uint64_t n)
+{
+    if(!stats)
+        return;
+
+    __atomic_add_fetch(&stats->count[counter], n, __ATOMIC_RELAXED);
+}
+
+
+/* This function prints the stats.  The table goes in milliseconds, the JSON
+ * in nanoseconds so nothing is lost to rounding. */
+void lynx_stats_print(FILE * out, const lynx_stats_t * stats, int json)
+{
+    int i;
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC) - stats->start_wall_ns;
+    uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - stats->start_cpu_ns;
+
+    if(json)
+    {
+        fprintf(out, "{\"wall_ns\": %llu, \"cpu_ns\": %llu, \"stages\": {",
+                (unsigned long long)wall, (unsigned long long)cpu);
+        for(i = 0; i < LYNX_STAGE_COUNT; i++)
+        {
+            fprintf(out, "%s\"%s\": {\"wall_ns\": %llu, \"cpu_ns\": %llu}",
+                    i ? ", " : "", stage_names[i],
+                    (unsigned long long)stats->wall_ns[i],
+                    (unsigned long long)stats->cpu_ns[i]);
+        }
+        fprintf(out, "}");
+        for(i = 0; i < LYNX_COUNT_COUNT; i++)
+        {
+            fprintf(out, ", \"%s\": %llu", count_names[i], (unsigned long long)stats->count[i]);
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, "stats:\n");
+    fprintf(out, "    %-10s %12s %12s\n", "stage", "wall ms", "cpu ms");
+    for(i = 0; i < LYNX_STAGE_COUNT; i++)
+    {
+        fprintf(out, "    %-10s %12.3f %12.3f\n", stage_names[i],
+                stats->wall_ns[i] / 1e6, stats->cpu_ns[i] / 1e6);
+    }
+    fprintf(out, "    %-10s %12.3f %12.3f\n", "total", wall / 1e6, cpu / 1e6);
+    for(i = 0; i < LYNX_COUNT_COUNT; i++)
+    {
+        fprintf(out, "    %-10s %12llu\n", count_names[i], (unsigned long long)stats->count[i]);
+    }
+}
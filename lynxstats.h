@@ -0,0 +1,95 @@
+/* Atari Lynx Encryption Library
+ * Copyright (C) 2009 David Huseby <dave@linuxprogrammer.org>
+ *
+ * NOTES:
+ *
+ * This is what the tools report with --stats.  The time spent in each stage
+ * of encrypting or decrypting an image is added up, both wall clock and the
+ * CPU time of the thread doing it, along with counts of what went through.
+ * The library adds to the stats of a context that has them (see
+ * lynx_ctx_set_stats) and the tools time the stages the library never sees,
+ * like reading the config and writing the output.
+ *
+ * Everything is added atomically so the worker threads of -j and -m can
+ * share one lynx_stats_t.  The stage times are then summed over the threads
+ * and can add up to more than the wall clock time of the whole run.
+ *
+ * LICENSE:
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from the
+ * use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software in a
+ * product, an acknowledgment in the product documentation would be appreciated
+ * but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef _LYNXSTATS_H_
+#define _LYNXSTATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* the stages that are timed */
+#define LYNX_STAGE_CONFIG           (0)     /* reading the config file */
+#define LYNX_STAGE_READ             (1)     /* reading the input frames */
+#define LYNX_STAGE_CODEC            (2)     /* encoding or decoding blocks */
+#define LYNX_STAGE_MODEXP           (3)     /* the RSA steps */
+#define LYNX_STAGE_REVERSE          (4)     /* reversing blocks into frames */
+#define LYNX_STAGE_WRITE            (5)     /* writing the output */
+#define LYNX_STAGE_COUNT            (6)
+
+/* the things that are counted */
+#define LYNX_COUNT_FRAMES           (0)
+#define LYNX_COUNT_BLOCKS           (1)
+#define LYNX_COUNT_MULMODS          (2)     /* modular multiplies */
+#define LYNX_COUNT_BYTES_IN         (3)
+#define LYNX_COUNT_BYTES_OUT        (4)
+#define LYNX_COUNT_CACHE_HITS       (5)     /* blocks found in the block cache */
+#define LYNX_COUNT_COUNT            (6)
+
+typedef struct lynx_stats_s
+{
+    uint64_t wall_ns[LYNX_STAGE_COUNT];
+    uint64_t cpu_ns[LYNX_STAGE_COUNT];
+    uint64_t count[LYNX_COUNT_COUNT];
+
+    /* when lynx_stats_init was called, for the totals */
+    uint64_t start_wall_ns;
+    uint64_t start_cpu_ns;
+} lynx_stats_t;
+
+/* the start of one timed stage */
+typedef struct lynx_timer_s
+{
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+} lynx_timer_t;
+
+
+/* clear the stats and start the clock on the whole run */
+void lynx_stats_init(lynx_stats_t * stats);
+
+/* time a stage.  these do nothing when stats is 0, so the callers don't have
+ * to check first. */
+void lynx_stats_start(const lynx_stats_t * stats, lynx_timer_t * timer);
+void lynx_stats_stop(lynx_stats_t * stats, const lynx_timer_t * timer, int stage);
+
+/* add n to one of the counts, also nothing when stats is 0 */
+void lynx_stats_count(lynx_stats_t * stats, int counter, uint64_t n);
+
+/* print the stats as a table, or as one line of JSON */
+void lynx_stats_print(FILE * out, const lynx_stats_t * stats, int json);
+
+#endif /* _LYNXSTATS_H_ */
@@ -1,488 +1,254 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "lynxcrypt.h"
+#include "lynxmont.h"
 #include "loaders.h"
 
 /*
-  Curt Vendell has posted the encryption sources to AtariAge.
-  The encryption sources work by indexing everything with the
-  least significant byte first.
-
-  In the real Atari Lynx hardware the byte order is LITTLE_ENDIAN.
-  If you run this on Intel or AMD CPU then you also have LITTLE_ENDIAN.
-  But the original encryption was run on Amiga that has a BIG_ENDIAN CPU.
-
-  This means that all the keys are presented in BIG_ENDIAN format.
+  The ROM-faithful decryptor and the byte-wise Montgomery routines that used
+  to live in this file are now part of liblynxcrypt (see lynxrom.c).  This is
+  just the driver that checks them against the known loaders.
 */
 
-#define chunkLength 51
-int ptr, c,
-    num2, num7,
-    ptr5, Cptr, Actr, Xctr, carry, err, ptrEncrypted;
-unsigned char buffer[600];
-unsigned char result[600];
-static unsigned char A[chunkLength];
-static unsigned char B[chunkLength];
-static unsigned char InputData[chunkLength];
-static unsigned char C[chunkLength];
-static unsigned char PrivateKey[chunkLength];
-static unsigned char E[chunkLength];
-static unsigned char F[chunkLength];
-
-#define BIT(C, i, m) ((C)[(i)/8] & (1 << ((i) & 7)))
-
-#define min(x,y) ((x < y) ? x : y)
-void print_data(const unsigned char * data, int size)
-{
-    int i = 0;
-    int j, count;
-    int left = size;
-
-    while(i < size)
-    {
-        count = min(8, (size - i));
-
-        printf("    ");
-        for(j = 0; j < count; j++)
-        {
-            printf("0x%02x, ", data[i + j]);
-        }
-        printf("\n");
-        i += count;
-    }
-}
-
-void WriteOperand(FILE * fp, unsigned char *A, int m)
-{
-    int i;
-    unsigned char byte;
-
-    for (i = 0; i < m; i++) {
-	byte = A[i];
-	fprintf(fp, "%02x", byte);
-    }
-    fprintf(fp, "\n");
-}
-
-/* A = 0 */
-static void Clear(unsigned char *A, int m)
-{
-    int i;
-
-    for (i = 0; i < m; i++)
-	A[i] = 0;
-}
+#define bool char
+#define false 0
+#define true 1
 
-/* A = 1 */
-static void One(unsigned char *A, int m)
-{
-    Clear(A, m);
-    A[0] = 1;
-}
+/* set by --stats, the batch checks add to it */
+static lynx_stats_t *stats = 0;
 
-/* A = B */
-static void Copy(unsigned char *A, unsigned char *B, int m)
+bool Compare(const unsigned char *A, const unsigned char *B, int m)
 {
     int i;
+    bool res = true;
 
-    for (i = 0; i < m; i++)
-	A[i] = B[i];
-}
-
-/* B = 2*B */
-static void Double(unsigned char *B, int m)
-{
-    int i, x;
-
-    x = 0;
-    for (i = 0; i < m; i++) {
-	x += 2 * B[i];
-	B[i] = (unsigned char) (x & 0xFF);
-	x >>= 8;
-    }
-    /* shouldn't carry */
-}
-
-/* B = (B-N) if B >= N */
-static int Adjust(unsigned char *B, unsigned char *PublicKey, int m)
-{
-    int i, x;
-    unsigned char T[chunkLength];
-
-    x = 0;
     for (i = 0; i < m; i++) {
-	x += B[i] - PublicKey[i];
-	T[i] = (unsigned char) (x & 0xFF);
-	x >>= 8;
-    }
-
-    if (x >= 0) {
-	Copy(B, T, m);
-        return 1;
-    }
-    return 0;
-}
-
-/* v = -1/PublicKey mod 256 */
-static void MontCoeff(unsigned char *v, unsigned char *PublicKey, int m)
-{
-    int i;
-    int lsb = 0;
-
-    *v = 0;
-    for (i = 0; i < 8; i++)
-	if (!((PublicKey[lsb] * (*v) & (1 << i))))
-	    *v += (1 << i);
-}
-
-/* A = B*(256**m) mod PublicKey */
-static void Mont(unsigned char *A, unsigned char *B, unsigned char *PublicKey,
-		 int m)
-{
-    int i;
-
-    Copy(A, B, m);
-
-    for (i = 0; i < 8 * m; i++) {
-	Double(A, m);
-	Adjust(A, PublicKey, m);
+	if (B[i] != A[i])
+	    res = false;
     }
+    return res;
 }
 
-/* A = B*C/(256**m) mod PublicKey where v*PublicKey = -1 mod 256 */
-static void MontMult(unsigned char *A, unsigned char *B, unsigned char *C,
-		     unsigned char *PublicKey, unsigned char v, int m)
+/* lynx_mont_mod_exp is a drop-in replacement for lynx_mod_exp, so both have
+   to agree on every block of the encrypted loaders.  Raising the decrypted
+   block to the private exponent has to give back the encrypted block, which
+   puts a full size exponent through both of them too. */
+bool CompareModExp(const unsigned char *encrypted, int length)
 {
     int i, j;
-    unsigned char ei, T[2 * chunkLength];
-    unsigned int x;
-
-    Clear(T, 2 * m);
-
-    for (i = 0; i < m; i++) {
-	x = 0;
-	for (j = 0; j < m; j++) {
-	    x += (unsigned int) T[i + j] +
-		(unsigned int) B[i] * (unsigned int) C[j];
-	    T[i + j] = (unsigned char) (x & 0xFF);
-	    x >>= 8;
-	}
-	T[i + m] = (unsigned char) (x & 0xFF);
-    }
-
-    for (i = 0; i < m; i++) {
-	x = 0;
-	ei = (unsigned char) (((unsigned int) v * (unsigned int) T[i]) &
-			      0xFF);
-	for (j = 0; j < m; j++) {
-	    x += (unsigned int) T[i + j] +
-		(unsigned int) ei *(unsigned int) PublicKey[j];
-	    T[i + j] = (unsigned char) (x & 0xFF);
-	    x >>= 8;
+    bool res = true;
+    unsigned char N[LYNX_RSA_KEY_SIZE];
+    unsigned char e[LYNX_RSA_KEY_SIZE];
+    unsigned char d[LYNX_RSA_KEY_SIZE];
+    unsigned char A[LYNX_RSA_KEY_SIZE];
+    unsigned char M[LYNX_RSA_KEY_SIZE];
+    lynx_mod_key_t key;
+
+    /* the byte-wise routines want everything least significant byte first */
+    for (i = 0; i < LYNX_RSA_KEY_SIZE; i++) {
+	N[i] = lynx_public_mod[(LYNX_RSA_KEY_SIZE - 1) - i];
+	e[i] = lynx_public_exp[(LYNX_RSA_KEY_SIZE - 1) - i];
+	d[i] = lynx_private_exp[(LYNX_RSA_KEY_SIZE - 1) - i];
+    }
+
+    /* a schedule of its own as well as the shared one lynx_mod_exp uses */
+    if (!lynx_mod_key_init(&key, N, LYNX_RSA_KEY_SIZE))
+	return false;
+
+    i = 0;
+    while (i < length) {
+	int blocks = 256 - encrypted[i];
+	i++;
+	for (j = 0; (j < blocks) && (i + ENCRYPTED_BLOCK_SIZE <= length); j++) {
+	    lynx_mod_key_exp(A, &encrypted[i], e, &key);
+	    lynx_mont_mod_exp(M, &encrypted[i], e, N, LYNX_RSA_KEY_SIZE);
+	    if (!Compare(A, M, LYNX_RSA_KEY_SIZE))
+		res = false;
+
+	    lynx_mod_exp(M, A, d, N, LYNX_RSA_KEY_SIZE);
+	    if (!Compare(M, &encrypted[i], LYNX_RSA_KEY_SIZE))
+		res = false;
+	    lynx_mont_mod_exp(M, A, d, N, LYNX_RSA_KEY_SIZE);
+	    if (!Compare(M, &encrypted[i], LYNX_RSA_KEY_SIZE))
+		res = false;
+	    i += ENCRYPTED_BLOCK_SIZE;
 	}
-	A[i] = (unsigned char) (x & 0xFF);
-    }
-
-    x = 0;
-    for (i = 0; i < m; i++) {
-	x += (unsigned int) T[i + m] + (unsigned int) A[i];
-	A[i] = (unsigned char) (x & 0xFF);
-	x >>= 8;
     }
-    /* shouldn't carry */
-}
-
-/* A = (B**PrivateKey)/(256**((PrivateKey-1)*m)) mod PublicKey, where v*PublicKey = -1 mod 256 */
-static void MontExp(unsigned char *A, unsigned char *B, unsigned char *PrivateKey,
-		    unsigned char *PublicKey, unsigned char v, int m)
-{
-    int i;
-    unsigned char T[chunkLength];
-
-    One(T, m);
-    Mont(T, T, PublicKey, m);
-
-    for (i = 8 * m - 1; i >= 0; i--) {
-	MontMult(T, T, T, PublicKey, v, m);
-	if (BIT(PrivateKey, i, m))
-	    MontMult(T, T, B, PublicKey, v, m);
-    }
-
-    Copy(A, T, m);
-}
-
-/* A = B/(256**m) mod PublicKey, where v*PublicKey = -1 mod 256 */
-static void UnMont(unsigned char *A, unsigned char *B, unsigned char *PublicKey,
-		   unsigned char v, int m)
-{
-    unsigned char T[chunkLength];
-
-    One(T, m);
-    MontMult(A, B, T, PublicKey, v, m);
-
-    Adjust(A, PublicKey, m);
+    return res;
 }
 
-/* All operands have least significant byte first. */
-/* A = B**PrivateKey mod PublicKey */
-void ModExp(unsigned char *A, unsigned char *B, unsigned char *PrivateKey,
-	    unsigned char *PublicKey, int m)
+/* The batch calls run the blocks side by side in SIMD lanes, so check them
+   against the one block at a time path: decrypt the whole loader both ways
+   and then encrypt it again as a batch, which has to give back the same
+   loader. */
+bool CompareBatch(const unsigned char *encrypted, int length)
 {
-    unsigned char T[chunkLength], v;
-
-    MontCoeff(&v, PublicKey, m);
-    Mont(T, B, PublicKey, m);
-    MontExp(T, T, PrivateKey, PublicKey, v, m);
-    UnMont(A, T, PublicKey, v, m);
+    int i, frames;
+    bool res = true;
+    lynx_ctx_t *ctx = lynx_ctx_new();
+    lynx_frame_def_t defs[32];
+    unsigned char batch[32 * MAX_PLAINTEXT_FRAME_SIZE];
+    unsigned char single[32 * MAX_PLAINTEXT_FRAME_SIZE];
+    unsigned char again[32 * MAX_ENCRYPTED_FRAME_SIZE];
+
+    if (!ctx)
+	return false;
+    lynx_ctx_set_stats(ctx, stats);
+
+    memset(single, 0, sizeof(single));
+    i = 0;
+    for (frames = 0; (i < length) && (frames < 32); frames++) {
+	defs[frames].offset = frames * MAX_PLAINTEXT_FRAME_SIZE;
+	defs[frames].blocks = 256 - encrypted[i];
+	i++;
+	lynx_decrypt_frame(ctx, &single[defs[frames].offset], &encrypted[i],
+	                   defs[frames].blocks, frames);
+	i += ENCRYPTED_FRAME_SIZE(defs[frames].blocks);
+    }
+
+    if ((lynx_decrypt_image(ctx, batch, sizeof(batch), encrypted, length) !=
+         (size_t)(frames * MAX_PLAINTEXT_FRAME_SIZE)) ||
+        !Compare(batch, single, frames * MAX_PLAINTEXT_FRAME_SIZE))
+	res = false;
+
+    if ((lynx_encrypt_image(ctx, again, sizeof(again), batch, sizeof(batch),
+                            defs, frames) != (size_t)length) ||
+        !Compare(again, encrypted, length))
+	res = false;
+
+    lynx_ctx_free(ctx);
+    return res;
 }
 
-/*
-    The inner working of the Lynx. Code created by Harry Dodgson by analyzing
-    the Lynx disassembled code
-*/
-// This is the known public key from the Lynx ROM
-// Please note that this key is actually BIG_ENDIAN
-// even if it inside the Lynx that is LITTLE_ENDIAN
-static unsigned char LynxPublicKey[chunkLength] = {
-    0x35, 0xB5, 0xA3, 0x94, 0x28, 0x06, 0xD8, 0xA2,
-    0x26, 0x95, 0xD7, 0x71, 0xB2, 0x3C, 0xFD, 0x56,
-    0x1C, 0x4A, 0x19, 0xB6, 0xA3, 0xB0, 0x26, 0x00,
-    0x36, 0x5A, 0x30, 0x6E, 0x3C, 0x4D, 0x63, 0x38,
-    0x1B, 0xD4, 0x1C, 0x13, 0x64, 0x89, 0x36, 0x4C,
-    0xF2, 0xBA, 0x2A, 0x58, 0xF4, 0xFE, 0xE1, 0xFD,
-    0xAC, 0x7E, 0x79
-};
-
+/* The boot time of an encrypted image: run it through the ROM decryptor a
+   frame at a time and turn what the ROM routines did into 65C02 cycles and
+   milliseconds at the Lynx clock rate. */
+int RomCost(const char *path)
+{
+    FILE *in;
+    long size;
+    size_t at = 0, consumed;
+    int frame = 0, err, failed = 0;
+    unsigned long cycles, total = 0, blocks = 0;
+    unsigned char *encrypted;
+    unsigned char plaintext[MAX_PLAINTEXT_FRAME_SIZE];
+    lynx_rom_t rom;
+
+    if (!(in = fopen(path, "rb"))) {
+	fprintf(stderr, "failed to open encrypted file: %s\n", path);
+	return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    rewind(in);
+    if ((size <= 0) || !(encrypted = malloc(size))) {
+	fprintf(stderr, "failed to read encrypted file: %s\n", path);
+	fclose(in);
+	return 1;
+    }
+    if (fread(encrypted, 1, size, in) != (size_t)size) {
+	fprintf(stderr, "failed to read encrypted file: %s\n", path);
+	free(encrypted);
+	fclose(in);
+	return 1;
+    }
+    fclose(in);
+
+    printf("%-7s %6s %12s %10s\n", "frame", "blocks", "cycles", "ms");
+    while (at < (size_t)size) {
+	/* the ROM would run a bad count into the next frames, and plaintext
+	   only has room for MAX_BLOCKS_PER_FRAME blocks */
+	if (256 - encrypted[at] > MAX_BLOCKS_PER_FRAME) {
+	    printf("%-7d %6d %12s %10s  (fails the ROM checks)\n", frame,
+	           256 - encrypted[at], "-", "-");
+	    failed++;
+	    break;
+	}
 
-// B = B + F
-void add_it(unsigned char *B, unsigned char *F, int m)
-{
-    int ct, tmp;
-    carry = 0;
-    for (ct = 0; ct < m; ct++) {
-	tmp = B[ct] + F[ct] + carry;
-	if (tmp >= 256)
-	    carry = 1;
-	else
-	    carry = 0;
-	B[ct] = (unsigned char) (tmp);
+	memset(&rom.cost, 0, sizeof(rom.cost));
+	err = lynx_verify_frame(&rom, plaintext, &encrypted[at], size - at,
+	                        &consumed);
+	cycles = lynx_rom_cycles(&rom.cost);
+	printf("%-7d %6lu %12lu %10.1f%s\n", frame, rom.cost.blocks, cycles,
+	       (1000.0 * cycles) / LYNX_ROM_CPU_HZ,
+	       err ? "  (fails the ROM checks)" : "");
+	failed += (err != 0);
+	total += cycles;
+	blocks += rom.cost.blocks;
+	at += consumed;
+	frame++;
+	if (err & LYNX_VERIFY_TRUNCATED)
+	    break;
     }
-}
+    printf("%-7s %6lu %12lu %10.1f\n", "total", blocks, total,
+           (1000.0 * total) / LYNX_ROM_CPU_HZ);
 
-/* A = B*(256**m) mod PublicKey */
-static void LynxMontWorks(unsigned char *A1, unsigned char *B1, unsigned char *PublicKey,
-		 int m)
-{
-    int Yctr;
-
-    Clear(B, m);
-    Yctr = 0;
-    do {
-	int num8, numA;
-	numA = F[Yctr];
-	num8 = 255;
-	do {
-	    Double(B, m);
-	    carry = (numA & 0x80) / 0x80;
-	    numA = (unsigned char) (numA << 1);
-	    if (carry != 0) {
-		add_it(B, E, m);
-                carry = Adjust(B, PublicKey, m);
-		if (carry != 0)
-                    Adjust(B, PublicKey, m);
-	    } else
-                Adjust(B, PublicKey, m);
-	    num8 = num8 >> 1;
-	} while (num8 != 0);
-	Yctr++;
-    } while (Yctr < m);
+    free(encrypted);
+    return failed ? 1 : 0;
 }
 
-/* A = B*(256**m) mod PublicKey */
-static void LynxMont(unsigned char *A1, unsigned char *B1, unsigned char *PublicKey,
-		 int m)
-{
-    int Yctr;
-
-    Clear(B, m);
-    Yctr = 0;
-    do {
-	int num8, numA;
-	numA = F[Yctr];
-	num8 = 255;
-	do {
-	    Double(B, m);
-	    carry = (numA & 0x80) / 0x80;
-	    numA = (unsigned char) (numA << 1);
-	    if (carry != 0) {
-		add_it(B, E, m);
-                carry = Adjust(B, PublicKey, m);
-		if (carry != 0)
-                    Adjust(B, PublicKey, m);
-	    } else
-                Adjust(B, PublicKey, m);
-	    num8 = num8 >> 1;
-	} while (num8 != 0);
-	Yctr++;
-    } while (Yctr < m);
-}
-
-void sub5000(int m)
-{
-    Copy(F, E, m);
-    LynxMont(B, E, LynxPublicKey, m);
-    Copy(F, B, m);
-    LynxMont(B, E, LynxPublicKey, m);
-}
-
-void convert_it()
+int main(int argc, char *argv[])
 {
-    int ct;
-    long t1, t2;
-
-    num7 = buffer[Cptr];
-    num2 = 0;
-    Cptr++;
-    do {
-	int Yctr;
-
-	for (ct = 0; ct < chunkLength; ct++) {
-	    E[ct] = buffer[Cptr];
-	    Cptr++;
-	}
-	if ((E[0] | E[1] | E[2]) == 0) {
-	    err = 1;
-        fprintf(stderr, "332: first three bytes are 0\n");
-	}
-	t1 = ((long) (E[0]) << 16) +
-	    ((long) (E[1]) << 8) +
-	    (long) (E[2]);
-	t2 = ((long) (LynxPublicKey[0]) << 16) +
-	    ((long) (LynxPublicKey[1]) << 8) + (long) (LynxPublicKey[2]);
-	if (t1 > t2) {
-	    err = 1;
-        fprintf(stderr, "341: t1 > t2\n");
+    lynx_rom_t rom;
+    lynx_stats_t run_stats;
+    unsigned char result[MAX_PLAINTEXT_FRAME_SIZE];
+    int i, quiet = 0, json = 0;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--version")) {
+	    lynx_print_version("lynxverify");
+	    return 0;
+	} else if (!strcmp(argv[i], "--cost") && (i + 1 < argc)) {
+	    return RomCost(argv[i + 1]);
+	} else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet")) {
+	    quiet = 1;
+	} else if (!strcmp(argv[i], "--stats") ||
+	           !strcmp(argv[i], "--stats=json")) {
+	    json = (argv[i][7] == '=');
+	    lynx_stats_init(&run_stats);
+	    stats = &run_stats;
+	} else {
+	    fprintf(stderr, "usage: %s [-q|--quiet] [--stats[=json]] [--version]\n"
+	                    "       %s --cost <encrypted.bin>\n", argv[0], argv[0]);
+	    return 1;
 	}
-	sub5000(chunkLength);
-	if (B[0] != 0x15) {
-	    err = 1;
-        fprintf(stderr, "346: B[0] != 0x15\n");
-	}
-	Actr = num2;
-        // This is not flipped around yet
-    //printf("B:\n");
-    //print_data(B, 51);
-	Yctr = 0x32;
-	do {
-	    Actr += B[Yctr];
-	    Actr &= 255;
-	    result[ptr5] = (unsigned char) (Actr);
-	    ptr5++;
-	    Yctr--;
-	} while (Yctr != 0);
-	num2 = Actr;
-	num7++;
-    } while (num7 != 256);
-    if (Actr != 0) {
-        err = 1;
-        fprintf(stderr, "363: Actr != 0\n");
     }
-}
-
-// This is what really happens inside the Atari Lynx at boot time
-void LynxDecrypt(unsigned char encrypted_data[])
-{
-    int i;
-
-    memset(buffer, 0, 600);
-
-    ptrEncrypted = 0xAA;
-    c = 52;
-    for (i = 0; i < c; i++) {
-        buffer[i] = encrypted_data[i];
-    }
-    ptr5 = 0;
-    Cptr = 0;
-    convert_it();
-}
 
-unsigned char AtariPrivateKey[chunkLength];
-unsigned char Result[410];
+    memset(result, 0, MAX_PLAINTEXT_FRAME_SIZE);
 
-void ReadLength(FILE * fp, int *m)
-{
-    fscanf(fp, "%d", m);
-}
-
-void ReadOperand(FILE * fp, unsigned char *A, int m)
-{
-    int i;
-    unsigned int byte;
+    lynx_verify_frame(&rom, result, wookies_micro_loader_encrypted_bin,
+                      sizeof(wookies_micro_loader_encrypted_bin), 0);
 
-    for (i = m - 1; i >= 0; i--) {
-	fscanf(fp, "%02x", &byte);
-	A[i] = (unsigned char) byte;
+    if (!quiet) {
+	printf("output:\n");
+	lynx_print_data(result, 50);
+	printf("expected:\n");
+	lynx_print_data(wookies_micro_loader_plaintext_bin, 50);
     }
-}
 
-void CopyOperand(unsigned char *A, unsigned char *B, int m, char inverted)
-{
-    int i, j;
-
-    if (inverted) {
-        int j;
-        j = 0;
-        for (i = m - 1; i >= 0; i--) {
-	    B[j++] = A[i];
-        }
+    if (Compare(result, wookies_micro_loader_plaintext_bin, 50)) {
+    	printf("LynxDecrypt works\n");
     } else {
-        for (i = 0; i < m; i++) {
-	    B[i] = A[i];
-        }
+	    printf("LynxDecrypt fails\n");
     }
-}
 
-#define bool char
-#define false 0
-#define true 1
-
-bool Compare(unsigned char *A, unsigned char *B, int m)
-{
-    int i;
-    bool res = true;
-
-    for (i = 0; i < m; i++) {
-	if (B[i] != A[i])
-	    res = false;
+    if (CompareModExp(wookies_micro_loader_encrypted_bin,
+                      sizeof(wookies_micro_loader_encrypted_bin)) &&
+        CompareModExp(HarrysEncryptedLoader, LOADER_LENGTH)) {
+    	printf("MontModExp works\n");
+    } else {
+	    printf("MontModExp fails\n");
     }
-    return res;
-}
-
-static unsigned char PublicKey[chunkLength];
 
-/* Computes A = InputData**PrivateKey mod PublicKey.
-   (1) Inputs length in bytes of operands.
-   (2) Inputs InputData, then PrivateKey, then PublicKey, most significant byte first. Most
-       significant bit of most significant byte of PublicKey must be zero.
-   (3) Computes A.
-   (4) Outputs A, most significant byte first.
- */
-int main(int argc, char *argv[])
-{
-    int m;
-    memset(result, 0, 600);
-
-    LynxDecrypt(wookies_micro_loader_encrypted_bin);
-
-    printf("output:\n");
-    print_data(result, 50);
-    printf("expected:\n");
-    print_data(wookies_micro_loader_plaintext_bin, 50);
-
-    if (Compare(result, wookies_micro_loader_plaintext_bin, 50)) {
-    	printf("LynxDecrypt works\n");
+    if (CompareBatch(HarrysEncryptedLoader, LOADER_LENGTH)) {
+    	printf("Batch works\n");
     } else {
-	    printf("LynxDecrypt fails\n");
+	    printf("Batch fails\n");
     }
 
+    if (stats)
+	lynx_stats_print(stderr, stats, json);
+
     return 0;
 }